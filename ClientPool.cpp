@@ -0,0 +1,225 @@
+// ClientPool.cpp
+#include "pch.h"
+#include "ClientPool.h"
+#include "Logger.h"
+#include "Utf.h"
+#include <algorithm>
+
+// Everything here runs without a window to show errors in, they go to the log
+static void logInjectionError(const wchar_t* error) {
+    char message[LOG_PAYLOAD_SIZE];
+    if (Utf::toUtf8(error, message) < 0) {
+        message[0] = 0;
+    }
+    Logger::getInstance().write(LOG_LEVEL_WARNING, 0, message);
+}
+
+ClientPool::ClientPool()
+    : m_size(0)
+    , m_refillThread(nullptr)
+    , m_refillEvent(nullptr)
+    , m_stopping(false)
+{
+}
+
+ClientPool::~ClientPool() {
+    stop();
+}
+
+bool ClientPool::start(const wchar_t* commandLine, LPCWSTR currentDirectory, const EntryPointParameters* parameters, int count, int size) {
+    if (m_refillThread || !commandLine || !currentDirectory || count < 0 || (count && !parameters) || size <= 0) {
+        return false;
+    }
+
+    // The caller's strings don't outlive the call
+    m_commandLine = commandLine;
+    m_currentDirectory = currentDirectory;
+    m_dllPaths.clear();
+    m_entryPoints.clear();
+    for (int i = 0; i < count; i++) {
+        if (!parameters[i].dll_path || !parameters[i].entry_point) {
+            return false;
+        }
+        m_dllPaths.push_back(parameters[i].dll_path);
+        m_entryPoints.push_back(parameters[i].entry_point);
+    }
+    m_parameters.assign(parameters, parameters + count);
+    for (int i = 0; i < count; i++) {
+        m_parameters[i].dll_path = &m_dllPaths[i][0];
+        m_parameters[i].entry_point = &m_entryPoints[i][0];
+    }
+
+    m_size = (std::min)((size_t)size, (size_t)CLIENT_POOL_MAX_SIZE);
+    m_stopping = false;
+    m_refillEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    m_refillThread = CreateThread(nullptr, 0, refillThreadProc, this, 0, nullptr);
+    if (!m_refillThread) {
+        CloseHandle(m_refillEvent);
+        m_refillEvent = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void ClientPool::stop() {
+    if (!m_refillThread) {
+        return;
+    }
+
+    // A client being prepared has to land in m_ready before it's cleared,
+    // or nothing would ever terminate it
+    m_stopping = true;
+    SetEvent(m_refillEvent);
+    WaitForSingleObject(m_refillThread, INFINITE);
+    CloseHandle(m_refillThread);
+    m_refillThread = nullptr;
+    CloseHandle(m_refillEvent);
+    m_refillEvent = nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& client : m_ready) {
+        discard(client);
+    }
+    m_ready.clear();
+}
+
+DWORD WINAPI ClientPool::refillThreadProc(LPVOID param) {
+    ((ClientPool*)param)->refillLoop();
+    return 0;
+}
+
+void ClientPool::refillLoop() {
+    while (!m_stopping) {
+        size_t ready;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ready = m_ready.size();
+        }
+        if (ready >= m_size) {
+            WaitForSingleObject(m_refillEvent, INFINITE);
+            continue;
+        }
+
+        PooledClient client;
+        if (!createClient(&client)) {
+            Logger::getInstance().write(LOG_LEVEL_WARNING, GetLastError(), "Failed to prepare a pooled client");
+            WaitForSingleObject(m_refillEvent, CLIENT_POOL_RETRY_DELAY_MS);
+            continue;
+        }
+
+        if (m_stopping) {
+            discard(client);
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ready.push_back(client);
+    }
+}
+
+bool ClientPool::createClient(PooledClient* client) {
+    client->libraries.clear();
+    if (!CreateSuspendedClient(m_commandLine.c_str(), m_currentDirectory.c_str(), &client->processInfo)) {
+        return false;
+    }
+
+    for (const auto& parameters : m_parameters) {
+        InjectedLibrary library;
+        const wchar_t* error = nullptr;
+        if (!InjectLibrary(client->processInfo.hProcess, parameters, &library, &error)) {
+            logInjectionError(error);
+            discard(*client);
+            return false;
+        }
+
+        // Everything short of the entry point, on a thread of its own while the main thread stays suspended
+        if (library.prewarm) {
+            InjectPayloadAndExecute(client->processInfo.hProcess, library.prewarm, nullptr, 0, &error);
+            if (error) {
+                logInjectionError(error);
+                discard(*client);
+                return false;
+            }
+        }
+        client->libraries.push_back(library);
+    }
+    return true;
+}
+
+DWORD ClientPool::handOut(PooledClient& client) {
+    for (const auto& library : client.libraries) {
+        const wchar_t* error = nullptr;
+        InjectPayloadAndExecute(client.processInfo.hProcess, library.entryPoint, nullptr, 0, &error);
+        if (error) {
+            logInjectionError(error);
+        }
+    }
+
+    DWORD processId = client.processInfo.dwProcessId;
+    ResumeThread(client.processInfo.hThread);
+    CloseHandle(client.processInfo.hThread);
+    CloseHandle(client.processInfo.hProcess);
+    return processId;
+}
+
+void ClientPool::discard(PooledClient& client) {
+    TerminateProcess(client.processInfo.hProcess, 0);
+    CloseHandle(client.processInfo.hThread);
+    CloseHandle(client.processInfo.hProcess);
+}
+
+DWORD ClientPool::acquire() {
+    for (;;) {
+        PooledClient client;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_ready.empty()) {
+                break;
+            }
+            client = m_ready.front();
+            m_ready.pop_front();
+        }
+        if (m_refillEvent) {
+            SetEvent(m_refillEvent);
+        }
+
+        // Killed while it sat in the pool, try the next one
+        if (WaitForSingleObject(client.processInfo.hProcess, 0) != WAIT_TIMEOUT) {
+            discard(client);
+            continue;
+        }
+        return handOut(client);
+    }
+
+    // Pool drained faster than it refills, do it the slow way
+    if (m_commandLine.empty()) {
+        return 0;
+    }
+    PooledClient client;
+    if (!createClient(&client)) {
+        return 0;
+    }
+    return handOut(client);
+}
+
+int ClientPool::getReadyCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (int)m_ready.size();
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) bool StartClientPool(const wchar_t* source, LPCWSTR lpCurrentDirectory, EntryPointParameters* entryPointParameters, int numParams, int size) {
+    return ClientPool::getInstance().start(source, lpCurrentDirectory, entryPointParameters, numParams, size);
+}
+
+extern "C" __declspec(dllexport) void StopClientPool() {
+    ClientPool::getInstance().stop();
+}
+
+extern "C" __declspec(dllexport) DWORD AcquirePooledClient() {
+    return ClientPool::getInstance().acquire();
+}
+
+extern "C" __declspec(dllexport) int GetPooledClientCount() {
+    return ClientPool::getInstance().getReadyCount();
+}
@@ -0,0 +1,86 @@
+// ClientPool.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include "EntryPointParameter.h"
+#include "Injection.h"
+
+// Most clients kept waiting at once
+#define CLIENT_POOL_MAX_SIZE 8
+
+// Pause after a client fails to come up before trying another one
+#define CLIENT_POOL_RETRY_DELAY_MS 5000
+
+// Clients created and injected ahead of time, so handing one out only costs
+// the entry points and a resume. Each pooled client is created suspended,
+// every library is injected and its Prewarm export, if any, is run: for the
+// injector that starts the runtime and resolves Init without calling it.
+// A background thread keeps the pool topped up.
+//
+// Clients nobody took are terminated when the pool stops.
+class ClientPool {
+public:
+    static ClientPool& getInstance() {
+        static ClientPool instance;
+        return instance;
+    }
+
+    // Copies the launch parameters and starts filling the pool
+    bool start(const wchar_t* commandLine, LPCWSTR currentDirectory, const EntryPointParameters* parameters, int count, int size);
+    void stop();
+    bool isRunning() const { return m_refillThread != nullptr; }
+
+    // Resumes a ready client and returns its pid. Launches one on the spot when none is ready. 0 on failure.
+    DWORD acquire();
+
+    int getReadyCount();
+
+private:
+    struct PooledClient {
+        PROCESS_INFORMATION processInfo;
+        std::vector<InjectedLibrary> libraries;
+    };
+
+    ClientPool();
+    ~ClientPool();
+
+    // No copy or move
+    ClientPool(const ClientPool&) = delete;
+    ClientPool& operator=(const ClientPool&) = delete;
+    ClientPool(ClientPool&&) = delete;
+    ClientPool& operator=(ClientPool&&) = delete;
+
+    static DWORD WINAPI refillThreadProc(LPVOID param);
+    void refillLoop();
+
+    // Up to, and including, the prewarm step
+    bool createClient(PooledClient* client);
+
+    // Entry points, resume, and the handles are closed
+    DWORD handOut(PooledClient& client);
+    static void discard(PooledClient& client);
+
+    std::wstring m_commandLine;
+    std::wstring m_currentDirectory;
+    std::vector<std::wstring> m_dllPaths;
+    std::vector<std::wstring> m_entryPoints;
+    std::vector<EntryPointParameters> m_parameters;  // point into the strings above
+
+    std::deque<PooledClient> m_ready;
+    size_t m_size;
+    std::mutex m_mutex;
+
+    HANDLE m_refillThread;
+    HANDLE m_refillEvent;
+    volatile bool m_stopping;
+};
+
+// Exports for managed code
+extern "C" __declspec(dllexport) bool StartClientPool(const wchar_t* source, LPCWSTR lpCurrentDirectory, EntryPointParameters* entryPointParameters, int numParams, int size);
+extern "C" __declspec(dllexport) void StopClientPool();
+extern "C" __declspec(dllexport) DWORD AcquirePooledClient();
+extern "C" __declspec(dllexport) int GetPooledClientCount();
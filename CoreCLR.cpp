@@ -1,7 +1,15 @@
 #include "pch.h"
 #include "CoreCLR.hpp"
+#include "Logger.h"
+#include "Utf.h"
 #include <iostream>
 
+/* Largest overrides file accepted, it's a handful of lines; bigger ones are ignored whole */
+#define RUNTIME_OVERRIDES_MAX_SIZE (64 * 1024)
+
+/* hostfxr's HostApiBufferTooSmall, the expected answer to a size query */
+#define HOST_API_BUFFER_TOO_SMALL ((int32_t)0x80008098)
+
 CoreCLR::CoreCLR(int* success)
 {
 	if (load_hostfxr())
@@ -26,12 +34,30 @@ bool CoreCLR::load_hostfxr()
 	m_get_delegate_fptr = (hostfxr_get_runtime_delegate_fn)get_export(lib, "hostfxr_get_runtime_delegate");
 	m_close_fptr = (hostfxr_close_fn)get_export(lib, "hostfxr_close");
 
+	// Only needed for overrides, so not required
+	m_set_property_fptr = (hostfxr_set_runtime_property_value_fn)get_export(lib, "hostfxr_set_runtime_property_value");
+	m_get_properties_fptr = (hostfxr_get_runtime_properties_fn)get_export(lib, "hostfxr_get_runtime_properties");
+
 	return (m_init_fptr && m_get_delegate_fptr && m_close_fptr);
 }
 
-bool CoreCLR::load_runtime(const string_t runtime_config_path)
+bool CoreCLR::load_runtime(const string_t runtime_config_path, const string_t overrides_path)
 {
-	m_load_assembly_and_get_function_pointer = get_dotnet_load_assembly(runtime_config_path.c_str());
+	// Nothing the last launch resolved from has changed, hand its properties straight to coreclr
+	if (m_property_cache.load(runtime_config_path, overrides_path))
+	{
+		bool runtime_started = false;
+		m_load_assembly_and_get_function_pointer = start_from_cache(&runtime_started);
+		if (m_load_assembly_and_get_function_pointer != nullptr)
+			return true;
+		m_property_cache.invalidate();
+
+		// The runtime is already up in this process, hostpolicy would fail to initialize it again
+		if (runtime_started)
+			return false;
+	}
+
+	m_load_assembly_and_get_function_pointer = get_dotnet_load_assembly(runtime_config_path.c_str(), overrides_path);
 	return m_load_assembly_and_get_function_pointer != nullptr;
 }
 
@@ -56,7 +82,169 @@ void* CoreCLR::get_export(void* h, const char* name)
 	return f;
 }
 
-load_assembly_and_get_function_pointer_fn CoreCLR::get_dotnet_load_assembly(const char_t* config_path)
+bool CoreCLR::read_runtime_overrides(const string_t& path, std::vector<std::pair<string_t, string_t>>* overrides)
+{
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Refuse rather than truncate, a cut off last line would still be applied
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart > RUNTIME_OVERRIDES_MAX_SIZE)
+	{
+		CloseHandle(file);
+		Logger::getInstance().write(LOG_LEVEL_WARNING, 0, "Runtime overrides file too large, ignored");
+		return false;
+	}
+
+	std::vector<char> buffer((size_t)size.QuadPart + 1);
+	DWORD length = 0;
+	BOOL read = ReadFile(file, buffer.data(), (DWORD)size.QuadPart, &length, nullptr);
+	CloseHandle(file);
+	if (!read || length != (DWORD)size.QuadPart)
+		return false;
+	const char* text = buffer.data();
+
+	// Skip a UTF-8 BOM
+	size_t position = 0;
+	if (length >= 3 && (unsigned char)text[0] == 0xEF && (unsigned char)text[1] == 0xBB && (unsigned char)text[2] == 0xBF)
+		position = 3;
+
+	while (position < length)
+	{
+		size_t line_end = position;
+		while (line_end < length && text[line_end] != '\n')
+			line_end++;
+
+		// Trim, then skip blank lines and comments
+		size_t begin = position;
+		size_t end = line_end;
+		while (begin < end && (text[begin] == ' ' || text[begin] == '\t'))
+			begin++;
+		while (end > begin && (text[end - 1] == ' ' || text[end - 1] == '\t' || text[end - 1] == '\r'))
+			end--;
+		position = line_end + 1;
+
+		if (begin == end || text[begin] == '#' || text[begin] == ';')
+			continue;
+
+		size_t separator = begin;
+		while (separator < end && text[separator] != '=')
+			separator++;
+		if (separator == end)
+		{
+			Logger::getInstance().write(LOG_LEVEL_WARNING, 0, "Runtime override line without '=' ignored");
+			continue;
+		}
+
+		size_t name_end = separator;
+		while (name_end > begin && (text[name_end - 1] == ' ' || text[name_end - 1] == '\t'))
+			name_end--;
+		size_t value_begin = separator + 1;
+		while (value_begin < end && (text[value_begin] == ' ' || text[value_begin] == '\t'))
+			value_begin++;
+		if (name_end == begin)
+			continue;
+
+		wchar_t name[256];
+		wchar_t value[1024];
+		if (Utf::toUtf16(text + begin, name_end - begin, name, 256) < 0 || Utf::toUtf16(text + value_begin, end - value_begin, value, 1024) < 0)
+		{
+			Logger::getInstance().write(LOG_LEVEL_WARNING, 0, "Runtime override too long, ignored");
+			continue;
+		}
+		overrides->emplace_back(name, value);
+	}
+	return true;
+}
+
+void CoreCLR::apply_runtime_overrides(hostfxr_handle context, const string_t& overrides_path)
+{
+	if (overrides_path.empty())
+		return;
+
+	std::vector<std::pair<string_t, string_t>> overrides;
+	if (!read_runtime_overrides(overrides_path, &overrides) || overrides.empty())
+		return;
+
+	if (!m_set_property_fptr)
+	{
+		Logger::getInstance().write(LOG_LEVEL_WARNING, 0, "hostfxr can't set runtime properties, overrides ignored");
+		return;
+	}
+
+	for (const auto& property : overrides)
+	{
+		int rc = m_set_property_fptr(context, property.first.c_str(), property.second.c_str());
+		char name[256];
+		char message[LOG_PAYLOAD_SIZE];
+		Utf::toUtf8(property.first.c_str(), property.first.length(), name, sizeof(name));
+		_snprintf_s(message, _TRUNCATE, rc == 0 ? "Runtime override %s" : "Runtime override %s rejected", name);
+		Logger::getInstance().write(rc == 0 ? LOG_LEVEL_INFO : LOG_LEVEL_WARNING, (DWORD)rc, message);
+	}
+}
+
+void CoreCLR::save_property_cache(hostfxr_handle context, const char_t* config_path, const string_t& overrides_path)
+{
+	if (!m_get_properties_fptr)
+		return;
+
+	size_t count = 0;
+	int rc = m_get_properties_fptr(context, &count, nullptr, nullptr);
+	if (rc != HOST_API_BUFFER_TOO_SMALL || count == 0)
+		return;
+
+	std::vector<const char_t*> keys(count);
+	std::vector<const char_t*> values(count);
+	if (m_get_properties_fptr(context, &count, keys.data(), values.data()) != 0)
+		return;
+
+	if (!m_property_cache.save(config_path, overrides_path, count, keys.data(), values.data()))
+		Logger::getInstance().write(LOG_LEVEL_DEBUG, 0, "Runtime properties not cached");
+}
+
+load_assembly_and_get_function_pointer_fn CoreCLR::start_from_cache(bool* runtime_started)
+{
+	*runtime_started = false;
+
+	HMODULE coreclr = LoadLibraryW(m_property_cache.getCoreClrPath().c_str());
+	if (!coreclr)
+		return nullptr;
+
+	coreclr_initialize_ptr initialize = (coreclr_initialize_ptr)get_export(coreclr, "coreclr_initialize");
+	coreclr_create_delegate_ptr create_delegate = (coreclr_create_delegate_ptr)get_export(coreclr, "coreclr_create_delegate");
+	if (!initialize || !create_delegate)
+		return nullptr;
+
+	wchar_t exe_path[MAX_PATH] = { 0 };
+	char exe_path_utf8[MAX_PATH * 3];
+	GetModuleFileNameW(nullptr, exe_path, MAX_PATH);
+	Utf::toUtf8(exe_path, exe_path_utf8);
+
+	// Same domain name and activator hostpolicy would use
+	void* host_handle = nullptr;
+	unsigned int domain_id = 0;
+	int hr = initialize(exe_path_utf8, "clrhost", m_property_cache.getCount(), m_property_cache.getKeys(), m_property_cache.getValues(), &host_handle, &domain_id);
+	if (hr < 0)
+	{
+		Logger::getInstance().write(LOG_LEVEL_WARNING, (DWORD)hr, "coreclr_initialize failed with cached runtime properties");
+		return nullptr;
+	}
+	*runtime_started = true;
+
+	void* delegate = nullptr;
+	hr = create_delegate(host_handle, domain_id, "System.Private.CoreLib", "Internal.Runtime.InteropServices.ComponentActivator", "LoadAssemblyAndGetFunctionPointer", &delegate);
+	if (hr < 0 || delegate == nullptr)
+	{
+		Logger::getInstance().write(LOG_LEVEL_ERROR, (DWORD)hr, "Failed to create the component activator delegate");
+		return nullptr;
+	}
+
+	Logger::getInstance().write(LOG_LEVEL_INFO, 0, "Runtime started from cached properties");
+	return (load_assembly_and_get_function_pointer_fn)delegate;
+}
+
+load_assembly_and_get_function_pointer_fn CoreCLR::get_dotnet_load_assembly(const char_t* config_path, const string_t& overrides_path)
 {
 	// Load .NET Core
 	hostfxr_handle context = nullptr;
@@ -67,6 +255,10 @@ load_assembly_and_get_function_pointer_fn CoreCLR::get_dotnet_load_assembly(cons
 		return nullptr;
 	}
 
+	// Properties can only change before the runtime starts, which getting the delegate does
+	apply_runtime_overrides(context, overrides_path);
+	save_property_cache(context, config_path, overrides_path);
+
 	// Get the load assembly function pointer
 	m_get_delegate_fptr(context, hdt_load_assembly_and_get_function_pointer, (void**)&m_load_assembly_and_get_function_pointer);
 	m_close_fptr(context);
@@ -1,11 +1,19 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <utility>
 #include "./nethost/nethost.h"
 #include "core-setup/hostfxr.h"
 #include "core-setup/coreclr_delegates.h"
+#include "core-setup/coreclrhost.h"
+#include "RuntimePropertyCache.h"
 using string_t = std::basic_string<char_t>;
 
+/* Runtime property overrides, one "name=value" per line. Looked up next to the launcher unless the variable points elsewhere. */
+#define RUNTIME_OVERRIDES_FILE L"Chorizite.Injector.runtime.ini"
+#define RUNTIME_OVERRIDES_ENV L"CHORIZITE_RUNTIME_OVERRIDES"
+
 class CoreCLR
 {
 	public:
@@ -19,9 +27,11 @@ class CoreCLR
 		/**
 		 * \brief Initializes and starts the .NET Core runtime.
 		 * \param runtime_config_path The full path to the runtimeconfig file for the assembly to be loaded *.runtimeconfig.json
+		 * \param overrides_path Optional file of runtime properties applied on top of the runtimeconfig, e.g.
+		 *        System.Runtime.TieredPGO=false or System.GC.HeapHardLimit=0x20000000. Missing files are ignored.
 		 * \return True if the operation succeeded, else false.
 		 */
-		bool load_runtime(const string_t runtime_config_path);
+		bool load_runtime(const string_t runtime_config_path, const string_t overrides_path = string_t());
 
 		/**
 		 * \param assembly_path Fully qualified path to assembly.
@@ -39,12 +49,30 @@ class CoreCLR
 		hostfxr_initialize_for_runtime_config_fn m_init_fptr{};
 		hostfxr_get_runtime_delegate_fn m_get_delegate_fptr{};
 		hostfxr_close_fn m_close_fptr{};
+		hostfxr_set_runtime_property_value_fn m_set_property_fptr{};
+		hostfxr_get_runtime_properties_fn m_get_properties_fptr{};
 		load_assembly_and_get_function_pointer_fn m_load_assembly_and_get_function_pointer = nullptr;
 
+		/* Properties hostfxr resolved on an earlier launch. */
+		RuntimePropertyCache m_property_cache;
+
 		/* Helper functions. */
 		void* load_library(const char_t* path);
 		void* get_export(void* h, const char* name);
-		load_assembly_and_get_function_pointer_fn get_dotnet_load_assembly(const char_t* config_path);
+		load_assembly_and_get_function_pointer_fn get_dotnet_load_assembly(const char_t* config_path, const string_t& overrides_path);
+
+		/** Parses the overrides file into name/value pairs, false if there is no such file. */
+		bool read_runtime_overrides(const string_t& path, std::vector<std::pair<string_t, string_t>>* overrides);
+
+		/** Sets each override on a context that hasn't started the runtime yet. */
+		void apply_runtime_overrides(hostfxr_handle context, const string_t& overrides_path);
+
+		/** Records the context's resolved properties for the next launch. */
+		void save_property_cache(hostfxr_handle context, const char_t* config_path, const string_t& overrides_path);
+
+		/** Starts coreclr directly with the cached properties, skipping hostfxr's framework resolution.
+		    runtime_started is set once coreclr_initialize succeeded, hostfxr can't be tried after that. */
+		load_assembly_and_get_function_pointer_fn start_from_cache(bool* runtime_started);
 
 		/**  Using the nethost library, discovers the location of hostfxr and retrieves function exports. */
 		bool load_hostfxr();
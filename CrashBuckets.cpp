@@ -0,0 +1,114 @@
+// CrashBuckets.cpp
+#include "pch.h"
+#include "CrashBuckets.h"
+#include "ModuleTracker.h"
+#include "Hash.h"
+#include <sstream>
+#include <iomanip>
+
+// How long we keep retrying while another client holds a bucket's counter
+#define CRASH_BUCKET_LOCK_RETRIES 100
+#define CRASH_BUCKET_LOCK_WAIT_MS 10
+
+CrashBucketIndex::CrashBucketIndex() {
+}
+
+void CrashBucketIndex::setRoot(const std::wstring& dumpPath) {
+    m_root = dumpPath + L"crashes\\";
+}
+
+DWORD64 CrashBucketIndex::computeSignature(const DWORD64* pcs, size_t count) {
+    DWORD64 hash = HASH_FNV1A_OFFSET_BASIS;
+    if (count > CRASH_SIGNATURE_FRAMES) {
+        count = CRASH_SIGNATURE_FRAMES;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        // The tracker's table doesn't need the loader lock, which the crashing
+        // thread may well be holding. If its own lock is busy the loader has
+        // to do, better than waiting on a lock we might own.
+        TrackedModule tracked;
+        DWORD64 moduleBase = 0;
+        const wchar_t* moduleName = nullptr;
+        wchar_t modulePath[MAX_PATH] = { 0 };
+        if (ModuleTracker::getInstance().tryFindModule(pcs[i], &tracked)) {
+            moduleBase = tracked.base;
+            moduleName = tracked.name();
+        }
+        else {
+            HMODULE module = nullptr;
+            if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                (LPCWSTR)(ULONG_PTR)pcs[i], &module)) {
+                const char marker[] = "<jit>";
+                hash = Hash::fnv1a(hash, marker, sizeof(marker));
+                continue;
+            }
+
+            // Only the file name, install locations differ between machines
+            GetModuleFileNameW(module, modulePath, MAX_PATH);
+            moduleName = wcsrchr(modulePath, L'\\');
+            moduleName = moduleName ? moduleName + 1 : modulePath;
+            moduleBase = (DWORD64)(ULONG_PTR)module;
+        }
+
+        for (const wchar_t* c = moduleName; *c; c++) {
+            wchar_t lower = towlower(*c);
+            hash = Hash::fnv1a(hash, &lower, sizeof(lower));
+        }
+
+        DWORD offset = (DWORD)(pcs[i] - moduleBase);
+        hash = Hash::fnv1a(hash, &offset, sizeof(offset));
+    }
+
+    return hash;
+}
+
+CrashBucketAction CrashBucketIndex::record(DWORD64 signature, std::wstring* reportPath) {
+    std::wstringstream bucketName;
+    bucketName << std::hex << std::setw(16) << std::setfill(L'0') << signature;
+    std::wstring bucketDir = m_root + bucketName.str() + L"\\";
+
+    CreateDirectoryW(m_root.c_str(), nullptr);
+    CreateDirectoryW(bucketDir.c_str(), nullptr);
+
+    // The counter file doubles as the bucket lock
+    std::wstring counterPath = bucketDir + L"count";
+    HANDLE hCounter = INVALID_HANDLE_VALUE;
+    for (int attempt = 0; attempt < CRASH_BUCKET_LOCK_RETRIES; attempt++) {
+        hCounter = CreateFileW(counterPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hCounter != INVALID_HANDLE_VALUE || GetLastError() != ERROR_SHARING_VIOLATION) {
+            break;
+        }
+        Sleep(CRASH_BUCKET_LOCK_WAIT_MS);
+    }
+
+    // Without the index we'd rather report too much than lose the crash
+    if (hCounter == INVALID_HANDLE_VALUE) {
+        if (reportPath) *reportPath = bucketDir + L"report.txt";
+        return CrashBucketAction::FullReport;
+    }
+
+    DWORD count = 0;
+    DWORD bytesRead = 0;
+    if (!ReadFile(hCounter, &count, sizeof(count), &bytesRead, nullptr) || bytesRead != sizeof(count)) {
+        count = 0;
+    }
+    count++;
+
+    DWORD bytesWritten = 0;
+    SetFilePointer(hCounter, 0, nullptr, FILE_BEGIN);
+    WriteFile(hCounter, &count, sizeof(count), &bytesWritten, nullptr);
+    CloseHandle(hCounter);
+
+    if (count == 1) {
+        if (reportPath) *reportPath = bucketDir + L"report.txt";
+        return CrashBucketAction::FullReport;
+    }
+
+    if (count - 1 <= CRASH_BUCKET_MAX_SAMPLES) {
+        if (reportPath) *reportPath = bucketDir + L"sample-" + std::to_wstring(count - 1) + L".txt";
+        return CrashBucketAction::Sample;
+    }
+
+    return CrashBucketAction::CountOnly;
+}
@@ -0,0 +1,40 @@
+// CrashBuckets.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+
+// Frames from the top of the faulting stack that make up a crash signature
+#define CRASH_SIGNATURE_FRAMES 8
+
+// Lightweight sample reports kept per known bucket
+#define CRASH_BUCKET_MAX_SAMPLES 5
+
+// What to do with a crash once its bucket has been looked up
+enum class CrashBucketAction {
+    FullReport, // first time we've seen this signature: report, dialog and dump
+    Sample,     // known signature, still collecting a few sample reports
+    CountOnly   // known signature with enough samples, just bump the counter
+};
+
+// On-disk crash bucket index, shared by every client writing to the same dump
+// path. Each signature gets its own directory under <dumpPath>crashes\ holding
+// a counter file that is updated under an exclusive open, so concurrent clients
+// hitting the same bug agree on who writes the full report.
+class CrashBucketIndex {
+public:
+    CrashBucketIndex();
+
+    void setRoot(const std::wstring& dumpPath);
+
+    // Stable across runs and ASLR: hashes module name + offset of the top frames,
+    // frames outside any module (JIT code) only contribute a marker
+    static DWORD64 computeSignature(const DWORD64* pcs, size_t count);
+
+    // Bumps the bucket's counter and decides how much of the crash to keep.
+    // reportPath receives where the (full or sample) report should be written.
+    CrashBucketAction record(DWORD64 signature, std::wstring* reportPath);
+
+private:
+    std::wstring m_root;
+};
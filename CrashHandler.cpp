@@ -1,23 +1,27 @@
 // CrashHandler.cpp
 #include "pch.h"
 #include "CrashHandler.h"
+#include "FrameWalker.h"
+#include "HangWatchdog.h"
+#include "SymbolStore.h"
+#include "ModuleTracker.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "Telemetry.h"
+#include "Threads.h"
+#include "Utf.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <chrono>
 #include <iomanip>
 #include <filesystem>
+#include <algorithm>
 #include <psapi.h>
 #pragma comment(lib, "psapi.lib")
-// For .NET integration
-#include <metahost.h>
-#include <mscoree.h>
-
-#pragma comment(lib, "mscoree.lib")
 
 // Global instance for callbacks
 CrashHandler* g_crashHandlerInstance = nullptr;
-bool didError = false;
 
 CrashHandler::CrashHandler()
     : m_symbolsInitialized(false)
@@ -27,17 +31,39 @@ CrashHandler::CrashHandler()
     , m_vectoredExceptionHandle(nullptr)
     , m_appDomainCallbackToken(nullptr)
     , m_managedResolver(nullptr)
+    , m_managedBatchResolver(nullptr)
     , m_managedExtraInfoResolver(nullptr) 
     , m_dotNetResolverAvailable(false)
     , m_dotNetExtraInfoResolverAvailable(false)
+    , m_managedStackCapture(nullptr)
+    , m_managedFrameCount(0)
+    , m_reporterThreadId(0)
+    , m_reportDoneEvent(nullptr)
+    , m_threadSnapshotCount(0)
 {
     memset(m_managedSymbolBuffer, 0, sizeof(m_managedSymbolBuffer));
     memset(m_managedExtraBuffer, 0, sizeof(m_managedExtraBuffer));
+    m_reportDoneEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
     g_crashHandlerInstance = this;
 }
 
 CrashHandler::~CrashHandler() {
-    shutdown();
+    // Static destruction runs under the loader lock, and the singletons we
+    // start in initialize were constructed after us so they're already gone.
+    // Only undo what's ours; the real teardown is shutdown(), called through
+    // ShutdownNativeCrashHandler while the process is still intact.
+    if (m_vectoredExceptionHandle) {
+        RemoveVectoredExceptionHandler(m_vectoredExceptionHandle);
+        m_vectoredExceptionHandle = nullptr;
+    }
+    if (m_previousFilter) {
+        SetUnhandledExceptionFilter(m_previousFilter);
+        m_previousFilter = nullptr;
+    }
+    if (m_reportDoneEvent) {
+        CloseHandle(m_reportDoneEvent);
+        m_reportDoneEvent = nullptr;
+    }
     g_crashHandlerInstance = nullptr;
 }
 
@@ -46,22 +72,45 @@ bool CrashHandler::initialize(const std::wstring& dumpPath) {
 
     m_dumpPath = dumpPath;
 
+    // Up first, so everything after this can log
+    Logger::getInstance().start(m_dumpPath + L"logs\\");
+    Tracer::getInstance().setExitDumpPath(m_dumpPath + L"traces\\trace-" + std::to_wstring(GetCurrentProcessId()) + L".json");
+
+    // Nothing gets allocated for the thread snapshot once we're crashing
+    if (!m_threadSnapshots) {
+        m_threadSnapshots.reset(new ThreadStackSnapshot[CRASH_MAX_THREADS]);
+    }
+
     // Create dump directory if it doesn't exist
     //std::filesystem::create_directories(dumpPath);
+    m_crashBuckets.setRoot(m_dumpPath);
+    SymbolStore::getInstance().setRoot(m_dumpPath + L"symbols\\");
 
     // Set up the symbol handler
     if (!initializeSymbols()) {
         return false;
     }
 
+    // Connect to the launcher's crash monitor if it is watching this process
+    m_monitorClient.open(GetCurrentProcessId());
+
+    // Live counters for the launcher, whether or not it ever looks at them
+    Telemetry::getInstance().start();
+
     // Set up exception handling
     m_previousFilter = SetUnhandledExceptionFilter(unhandledExceptionFilter);
     m_vectoredExceptionHandle = AddVectoredExceptionHandler(1, vectoredExceptionHandler);
 
+    // Freezes never reach the exception handlers, the watchdog covers those
+    HangWatchdog::getInstance().start(m_dumpPath);
+
     return true;
 }
 
 void CrashHandler::shutdown() {
+    HangWatchdog::getInstance().stop();
+    SymbolStore::getInstance().stopPrefetch();
+
     std::lock_guard<std::mutex> lock(m_crashHandlerMutex);
 
     // Restore previous exception handlers
@@ -75,8 +124,15 @@ void CrashHandler::shutdown() {
         m_previousFilter = nullptr;
     }
 
+    m_monitorClient.close();
+    Telemetry::getInstance().stop();
+    Tracer::getInstance().dumpAtExit();
+    Logger::getInstance().stop();
+
     // Clean up symbols
     if (m_symbolsInitialized) {
+        ModuleTracker::getInstance().detachSymbols();
+        ModuleTracker::getInstance().stop();
         SymCleanup(GetCurrentProcess());
         m_symbolsInitialized = false;
     }
@@ -86,56 +142,10 @@ void CrashHandler::setSymbolPath(const std::wstring& symbolPath) {
     std::lock_guard<std::mutex> lock(m_crashHandlerMutex);
     m_symbolPath = symbolPath;
 
-    // Set up a default symbol path that includes:
-    // 1. The module directory (where the executable is)
-    // 2. Visual Studio's symbol cache
-    std::wstring vsSymCache = L"C:\\Users\\";
-    wchar_t userName[MAX_PATH];
-    DWORD userNameSize = MAX_PATH;
-    if (GetUserName(userName, &userNameSize)) {
-        vsSymCache += userName;
-        vsSymCache += L"\\AppData\\Local\\Temp\\SymbolCache";
-    }
-    // Get the module path where the application is running
-    wchar_t modulePath[MAX_PATH];
-    GetModuleFileNameW(NULL, modulePath, MAX_PATH);
-    std::wstring moduleDir = modulePath;
-    moduleDir = moduleDir.substr(0, moduleDir.find_last_of(L"\\/") + 1);
-
-    // Use the module directory as part of the symbol path
-    std::wstringstream symbolPathStream;
-    symbolPathStream << moduleDir << L";"
-        << m_symbolPath << L";"
-        << vsSymCache << L";"
-        << L"srv*https://msdl.microsoft.com/download/symbols";
+    std::wstring symbolPathStr = buildSymbolSearchPath();
 
     if (m_symbolsInitialized) {
-        std::wstring symbolPathStr = symbolPathStream.str();
-        char* symbolPathCStr = new char[symbolPathStr.length() + 1];
-        wcstombs(symbolPathCStr, symbolPathStr.c_str(), symbolPathStr.length() + 1);
-        SymSetSearchPath(GetCurrentProcess(), symbolPathCStr);
-        delete[] symbolPathCStr;
-
-        HMODULE hMod = GetModuleHandleW(L"xlua.dll");
-        if (hMod == NULL) {
-            return;
-        }
-
-        MODULEINFO modInfo;
-        if (!GetModuleInformation(GetCurrentProcess(), hMod, &modInfo, sizeof(MODULEINFO))) {
-            return;
-        }
-
-        SymLoadModuleExW(
-            GetCurrentProcess(),
-            NULL,
-            L"xlua.dll",
-            NULL,
-            (DWORD64)modInfo.lpBaseOfDll,
-            modInfo.SizeOfImage,
-            NULL,
-            0
-        );
+        SymSetSearchPathW(GetCurrentProcess(), symbolPathStr.c_str());
     }
 }
 
@@ -145,6 +155,10 @@ void CrashHandler::registerManagedSymbolResolver(ManagedSymbolResolverFunc resol
     m_dotNetResolverAvailable = (resolver != nullptr);
 }
 
+void CrashHandler::registerManagedBatchSymbolResolver(ManagedBatchSymbolResolverFunc resolver) {
+    m_managedBatchResolver = resolver;
+}
+
 // Add a method to register the .NET symbol resolver
 void CrashHandler::registerManagedExtraInfoResolver(ManagedExtraInfoResolverFunc resolver) {
     m_managedExtraInfoResolver = resolver;
@@ -163,13 +177,64 @@ std::string CrashHandler::resolveSymbol(DWORD64 address) {
     }
 
     // If .NET resolver didn't work or isn't available, fall back to native resolver
+    return resolveNativeSymbol(address);
+}
+
+// Resolves a batch of frames with a single managed transition, anything the
+// managed side doesn't know about goes through dbghelp
+std::vector<std::string> CrashHandler::resolveSymbols(const std::vector<DWORD64>& addresses) {
+    std::vector<std::string> symbols(addresses.size());
+    if (addresses.empty()) {
+        return symbols;
+    }
+
+    ManagedBatchSymbolResolverFunc batchResolver = m_managedBatchResolver;
+    if (!batchResolver) {
+        for (size_t i = 0; i < addresses.size(); i++) {
+            symbols[i] = resolveSymbol(addresses[i]);
+        }
+        return symbols;
+    }
+
+    // Output arena is owned by this call, so concurrent resolves never share a buffer
+    const int bytesPerFrame = 512;
+    int count = (int)addresses.size();
+    std::vector<char> arena((size_t)count * bytesPerFrame);
+    std::vector<int> offsets(count, -1);
+
+    int used = batchResolver(addresses.data(), count, arena.data(), (int)arena.size(), offsets.data());
+    int arenaSize = (int)arena.size();
+
+    for (int i = 0; i < count; i++) {
+        int offset = offsets[i];
+        if (used >= 0 && offset >= 0 && offset < arenaSize && arena[offset] != '\0') {
+            // Never trust the managed side to have terminated the last name
+            size_t length = strnlen(&arena[offset], (size_t)(arenaSize - offset));
+            symbols[i].assign(&arena[offset], length);
+        }
+        else if (used < 0) {
+            // Batch failed as a whole, try the per frame path
+            symbols[i] = resolveSymbol(addresses[i]);
+        }
+        else {
+            symbols[i] = resolveNativeSymbol(addresses[i]);
+        }
+    }
+
+    return symbols;
+}
+
+std::string CrashHandler::resolveNativeSymbol(DWORD64 address) {
     if (!m_symbolsInitialized) {
         std::stringstream result;
         result << "0x" << std::hex << address;
-        MessageBoxA(nullptr, result.str().c_str(), "Failed m_symbolsInitialized", MB_OK);
+        Logger::getInstance().write(LOG_LEVEL_WARNING, 0, "Symbol lookup before the symbol handler was initialized");
         return result.str();
     }
 
+    // Pick up anything loaded or unloaded since the last lookup
+    ModuleTracker::getInstance().syncSymbols();
+
     // Get module information
     IMAGEHLP_MODULE moduleInfo;
     moduleInfo.SizeOfStruct = sizeof(IMAGEHLP_MODULE);
@@ -251,6 +316,17 @@ LONG WINAPI CrashHandler::vectoredExceptionHandler(EXCEPTION_POINTERS* exception
     return EXCEPTION_CONTINUE_SEARCH;
 }
 
+std::wstring FormatReportTimestamp() {
+    auto now = std::chrono::system_clock::now();
+    auto timeT = std::chrono::system_clock::to_time_t(now);
+    std::tm tm;
+    localtime_s(&tm, &timeT);
+
+    std::wstringstream stream;
+    stream << std::put_time(&tm, L"%Y%m%d-%H%M%S");
+    return stream.str();
+}
+
 // Constants for dialog controls
 #define IDC_TEXTAREA     1001
 #define IDC_SEND_BUTTON  1002
@@ -285,11 +361,34 @@ void CrashHandler::handleException(EXCEPTION_POINTERS* exceptionPointers) {
 		return;
 	}
 
-    std::lock_guard<std::mutex> lock(m_crashHandlerMutex);
-
     // Prevent multiple crash dialogs
-    if (didError) return;
-    didError = true;
+    if (!electReporter()) return;
+
+    Logger::getInstance().write(LOG_LEVEL_ERROR, exceptionPointers->ExceptionRecord->ExceptionCode, "Unhandled exception");
+
+    // Known crashes only bump their bucket, so a crash storm can't fill the disk
+    DWORD64 signaturePcs[CRASH_SIGNATURE_FRAMES];
+    size_t signatureFrames = FrameWalker::walk(exceptionPointers->ContextRecord, signaturePcs, nullptr, CRASH_SIGNATURE_FRAMES);
+    std::wstring reportPath;
+    CrashBucketAction bucketAction = m_crashBuckets.record(CrashBucketIndex::computeSignature(signaturePcs, signatureFrames), &reportPath);
+    if (bucketAction == CrashBucketAction::CountOnly) {
+        finishReport();
+        return;
+    }
+
+    // Let the monitor capture everything from outside, it writes the report and dump
+    DWORD monitorFlags = bucketAction == CrashBucketAction::Sample ? CRASH_MONITOR_FLAG_NO_DUMP : 0;
+    if (m_monitorClient.isConnected() && m_monitorClient.signal(exceptionPointers, GetCurrentThreadId(), monitorFlags)) {
+        finishReport();
+        return;
+    }
+
+    // Snapshot managed frames for every thread first, the native trace merges them in.
+    // This runs managed code, so it has to happen before anything is suspended.
+    int managedFrameCount = captureManagedFrames();
+
+    // Freeze everybody else and grab their stacks
+    int threadCount = captureAllThreads();
 
     // Capture and log the stack trace
     std::vector<std::string> stackTrace = captureStackTrace(exceptionPointers->ContextRecord);
@@ -303,12 +402,31 @@ void CrashHandler::handleException(EXCEPTION_POINTERS* exceptionPointers) {
     std::wstringstream report;
 
     report << L"Exception Code: 0x" << std::hex << exceptionPointers->ExceptionRecord->ExceptionCode << std::dec << L"\r\n"
-        << L"Exception Address: 0x" << std::hex << exceptionPointers->ExceptionRecord->ExceptionAddress << std::dec << L"\r\n\r\n";
+        << L"Exception Address: 0x" << std::hex << exceptionPointers->ExceptionRecord->ExceptionAddress << std::dec << L"\r\n";
+    report << describeFaultAddress(exceptionPointers->ExceptionRecord) << L"\r\n";
     report << L"Stack Trace:\r\n";
     for (const auto& frame : stackTrace) {
         report << L"  " << frame.c_str() << L"\r\n";
     }
 
+    // Every other thread, with its managed frames merged in
+    if (threadCount > 0) {
+        report << L"\r\nOther Threads:\r\n";
+        for (const auto& line : formatThreadSnapshots()) {
+            report << line.c_str() << L"\r\n";
+        }
+    }
+    // Managed stacks of every other thread
+    else if (managedFrameCount > 0) {
+        std::vector<std::string> managedStacks = formatManagedFrames(GetCurrentThreadId());
+        if (!managedStacks.empty()) {
+            report << L"\r\nManaged Threads:\r\n";
+            for (const auto& line : managedStacks) {
+                report << line.c_str() << L"\r\n";
+            }
+        }
+    }
+
     /*
     report << "\r\nLoaded modules:\r\n";
     HANDLE hProcess = GetCurrentProcess();
@@ -331,20 +449,75 @@ void CrashHandler::handleException(EXCEPTION_POINTERS* exceptionPointers) {
 
     // append extra info if available
     if (m_dotNetExtraInfoResolverAvailable && m_managedExtraInfoResolver) {
-        wchar_t* reportCStr = new wchar_t[report.str().length() + 1];
-        wcscpy_s(reportCStr, report.str().length() + 1, report.str().c_str());
-        char* reportCStrA = new char[report.str().length() * 2 + 1];
-        size_t convertedChars;
-        wcstombs_s(&convertedChars, reportCStrA, report.str().length() * 2 + 1, reportCStr, report.str().length() + 1);
         const char* managedExtraInfo = m_managedExtraInfoResolver();
-        delete[] reportCStr;
-        delete[] reportCStrA;
 
         if (managedExtraInfo && managedExtraInfo[0] != '\0') {
             report << managedExtraInfo;
         }
     }
 
+    writeReportFile(reportPath, report.str());
+
+    // Only new signatures interrupt the user
+    if (bucketAction == CrashBucketAction::FullReport) {
+        showCrashDialog(report.str());
+    }
+    finishReport();
+}
+
+void CrashHandler::writeReportFile(const std::wstring& path, const std::wstring& text) {
+    if (path.empty() || text.empty()) {
+        return;
+    }
+
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    // Converted a chunk at a time through the stack, the heap may be what crashed
+    char utf8[CRASH_REPORT_CHUNK_SIZE * 3 + 1];
+    size_t offset = 0;
+    while (offset < text.length()) {
+        size_t count = (std::min)((size_t)CRASH_REPORT_CHUNK_SIZE, text.length() - offset);
+
+        // Keep surrogate pairs in one chunk
+        if (count > 1 && offset + count < text.length() && text[offset + count - 1] >= 0xD800 && text[offset + count - 1] <= 0xDBFF) {
+            count--;
+        }
+
+        int length = Utf::toUtf8(text.c_str() + offset, count, utf8, sizeof(utf8));
+        if (length < 0) {
+            break;
+        }
+        DWORD written = 0;
+        WriteFile(hFile, utf8, (DWORD)length, &written, nullptr);
+        offset += count;
+    }
+    CloseHandle(hFile);
+}
+
+bool CrashHandler::electReporter() {
+    DWORD threadId = GetCurrentThreadId();
+    DWORD expected = 0;
+    if (m_reporterThreadId.compare_exchange_strong(expected, threadId)) {
+        return true;
+    }
+
+    // A crash inside our own report just falls through, anyone else waits for it
+    if (expected != threadId && m_reportDoneEvent) {
+        WaitForSingleObject(m_reportDoneEvent, INFINITE);
+    }
+    return false;
+}
+
+void CrashHandler::finishReport() {
+    if (m_reportDoneEvent) {
+        SetEvent(m_reportDoneEvent);
+    }
+}
+
+void CrashHandler::showCrashDialog(const std::wstring& text) {
     // Create the dialog
     HINSTANCE hInstance = GetModuleHandle(NULL);
 
@@ -361,7 +534,8 @@ void CrashHandler::handleException(EXCEPTION_POINTERS* exceptionPointers) {
     RegisterClassEx(&wcex);
 
     // Store the report text in a static variable for the dialog to access
-    static std::wstring reportText = report.str();
+    static std::wstring reportText;
+    reportText = text;
 
     // Create and show the dialog
     int screenWidth = GetSystemMetrics(SM_CXSCREEN);
@@ -420,24 +594,76 @@ void CrashHandler::handleException(EXCEPTION_POINTERS* exceptionPointers) {
     }
 }
 
+// For access violations: what the faulting address was and what was mapped there
+std::wstring CrashHandler::describeFaultAddress(const EXCEPTION_RECORD* record) {
+    if (record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || record->NumberParameters < 2) {
+        return std::wstring();
+    }
+
+    ULONG_PTR faultAddress = record->ExceptionInformation[1];
+    const wchar_t* access = record->ExceptionInformation[0] == 1 ? L"write" : record->ExceptionInformation[0] == 8 ? L"execute" : L"read";
+
+    std::wstringstream description;
+    description << L"Fault Address: 0x" << std::hex << faultAddress << L" (" << access << L")";
+
+    // Straight to the kernel: the MemoryMap takes a lock and may snapshot
+    // the whole address space, neither of which belongs in a crash
+    MEMORY_BASIC_INFORMATION mbi;
+    if (VirtualQuery((LPCVOID)faultAddress, &mbi, sizeof(mbi))) {
+        ULONG_PTR regionBase = (ULONG_PTR)mbi.BaseAddress;
+        const wchar_t* state = mbi.State == MEM_COMMIT ? L"committed" : mbi.State == MEM_RESERVE ? L"reserved" : L"free";
+        description << L" in " << state << L" region 0x" << regionBase << L"-0x" << (regionBase + mbi.RegionSize)
+            << L" protect 0x" << mbi.Protect;
+
+        TrackedModule module;
+        if (mbi.Type == MEM_IMAGE && ModuleTracker::getInstance().tryFindModule((DWORD64)(ULONG_PTR)mbi.AllocationBase, &module)) {
+            description << L" of " << module.name();
+        }
+    }
+    description << std::dec << L"\r\n";
+
+    return description.str();
+}
+
 bool CrashHandler::initializeSymbols() {
     if (m_symbolsInitialized) {
         return true;
     }
 
-    SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES);
+    // Never prompt, and never go looking for a symbol server on our own
+    SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES | SYMOPT_NO_PROMPTS
+        | SYMOPT_FAIL_CRITICAL_ERRORS | SYMOPT_DISABLE_SYMSRV_AUTODETECT);
+
+    std::wstring symbolPathStr = buildSymbolSearchPath();
+
+    // Modules come from the tracker rather than a one-time enumeration, so
+    // anything loaded later (plugins, Lua natives) is picked up as it loads
+    if (!SymInitializeW(GetCurrentProcess(), symbolPathStr.c_str(), FALSE)) {
+        Logger::getInstance().write(LOG_LEVEL_ERROR, GetLastError(), "Failed to initialize symbols");
+        return false;
+    }
 
-    // Set up a default symbol path that includes:
-    // 1. The module directory (where the executable is)
-    // 2. Visual Studio's symbol cache
-    std::wstring vsSymCache = L"C:\\Users\\";
-    wchar_t userName[MAX_PATH];
-    DWORD userNameSize = MAX_PATH;
-    if (GetUserName(userName, &userNameSize)) {
-        vsSymCache += userName;
-        vsSymCache += L"\\AppData\\Local\\Temp\\SymbolCache";
+    ModuleTracker& moduleTracker = ModuleTracker::getInstance();
+    if (moduleTracker.start()) {
+        moduleTracker.attachSymbols(GetCurrentProcess());
     }
+    else {
+        SymRefreshModuleList(GetCurrentProcess());
+    }
+    m_symbolsInitialized = true;
+
+    return true;
+}
+
+bool CrashHandler::ensureSymbols() {
+    std::lock_guard<std::mutex> lock(m_crashHandlerMutex);
+    return initializeSymbols();
+}
 
+// Everything on the path is local: the app, the client, the Lua natives, any
+// user supplied directories and the local symbol store. Crash-time resolution
+// must never wait on a download, the store is filled by the background prefetch.
+std::wstring CrashHandler::buildSymbolSearchPath() {
     // Get the module path where the application is running
     wchar_t modulePath[MAX_PATH];
     GetModuleFileNameW(NULL, modulePath, MAX_PATH);
@@ -447,34 +673,170 @@ bool CrashHandler::initializeSymbols() {
     std::wstring  pluginsDir = appDir + L"plugins\\Lua\\runtimes\\win-x86\\native\\";
 
     std::wstringstream symbolPathStream;
-    symbolPathStream << appDir.c_str() << L";"
-        << moduleDir.c_str() << L";"
-        << pluginsDir.c_str() << L";"
-        << vsSymCache << L";"
-        << L"srv*https://msdl.microsoft.com/download/symbols";
+    symbolPathStream << appDir << L";"
+        << moduleDir << L";"
+        << pluginsDir;
 
+    if (!m_symbolPath.empty()) {
+        symbolPathStream << L";" << m_symbolPath;
+    }
 
-    std::wstring symbolPathStr = symbolPathStream.str();
-    char* symbolPathCStr = new char[symbolPathStr.length() + 1];
-    wcstombs(symbolPathCStr, symbolPathStr.c_str(), symbolPathStr.length() + 1);
-
-    if (!SymInitialize(GetCurrentProcess(), symbolPathCStr, TRUE)) {
-        MessageBoxA(nullptr, "Failed to initialize symbols.", symbolPathCStr, MB_OK);
-        return false;
+    std::wstring storePath = SymbolStore::getInstance().localSearchPath();
+    if (!storePath.empty()) {
+        symbolPathStream << L";" << storePath;
     }
-    delete[] symbolPathCStr;
-    m_symbolsInitialized = true;
 
-    return true;
+    return symbolPathStream.str();
 }
 
 std::vector<std::string> CrashHandler::captureStackTrace(CONTEXT* context) {
     std::vector<std::string> stackTrace;
 
+    // Walk into fixed arrays first, nothing is allocated until the frames are captured
+    DWORD64 pcs[MAX_STACK_FRAMES];
+    DWORD64 sps[MAX_STACK_FRAMES];
+    size_t frameCount = FrameWalker::walk(context, pcs, sps, MAX_STACK_FRAMES);
+
+#ifdef _M_IX86
+    // The EBP chain stops dead in frame pointer omitted code, let dbghelp have a go at it
+    if (frameCount < 2) {
+        frameCount = walkStackWithDbgHelp(context, pcs, sps, MAX_STACK_FRAMES);
+    }
+#endif
+
+    std::vector<DWORD64> addresses(pcs, pcs + frameCount);
+    std::vector<DWORD64> stackPointers(sps, sps + frameCount);
+
+    // Resolve the whole trace at once so managed frames cost a single transition
+    std::vector<std::string> symbols = resolveSymbols(addresses);
+
+    return formatFrames(GetCurrentThreadId(), addresses, stackPointers, symbols);
+}
+
+std::vector<std::string> CrashHandler::formatFrames(DWORD threadId, const std::vector<DWORD64>& addresses,
+    const std::vector<DWORD64>& stackPointers, const std::vector<std::string>& symbols) {
+    std::vector<std::string> stackTrace;
+
+    // Merge in the managed frames captured for this thread. Both lists run from
+    // the top of the stack down, so they are ordered by increasing stack pointer.
+    // A native frame whose pc is a managed frame's ip is the same frame and
+    // takes the managed name.
+    int managed = nextManagedFrame(threadId, 0);
+    int frameNum = 0;
+    for (size_t i = 0; i < symbols.size(); i++) {
+        while (managed >= 0 && m_managedFrames[managed].instructionPointer != addresses[i]
+            && m_managedFrames[managed].stackPointer != 0 && m_managedFrames[managed].stackPointer < stackPointers[i]) {
+            std::stringstream frameDesc;
+            frameDesc << "#" << frameNum++ << ": [managed] " << m_managedFrames[managed].method;
+            stackTrace.push_back(frameDesc.str());
+            managed = nextManagedFrame(threadId, managed + 1);
+        }
+
+        std::stringstream frameDesc;
+        if (managed >= 0 && m_managedFrames[managed].instructionPointer == addresses[i]) {
+            frameDesc << "#" << frameNum++ << ": [managed] " << m_managedFrames[managed].method;
+            managed = nextManagedFrame(threadId, managed + 1);
+        }
+        else {
+            frameDesc << "#" << frameNum++ << ": " << symbols[i];
+        }
+        stackTrace.push_back(frameDesc.str());
+    }
+
+    // Whatever is left sits below the last native frame we could walk
+    while (managed >= 0) {
+        std::stringstream frameDesc;
+        frameDesc << "#" << frameNum++ << ": [managed] " << m_managedFrames[managed].method;
+        stackTrace.push_back(frameDesc.str());
+        managed = nextManagedFrame(threadId, managed + 1);
+    }
+
+    return stackTrace;
+}
+
+int CrashHandler::captureAllThreads() {
+    m_threadSnapshotCount = 0;
+    if (!m_threadSnapshots) {
+        return 0;
+    }
+
+    DWORD threadIds[CRASH_MAX_THREADS];
+    HANDLE threads[CRASH_MAX_THREADS];
+    int suspended = 0;
+
+    bool listed = Threads::forEachOther([&](DWORD threadId) {
+        HANDLE hThread = Threads::suspend(threadId, THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION);
+        if (hThread) {
+            threadIds[suspended] = threadId;
+            threads[suspended] = hThread;
+            suspended++;
+        }
+        return suspended < CRASH_MAX_THREADS;
+    });
+    if (!listed) {
+        return 0;
+    }
+
+    // Everyone is frozen, walk the stacks without touching the heap
+    int count = 0;
+    for (int i = 0; i < suspended; i++) {
+        ThreadStackSnapshot& thread = m_threadSnapshots[count];
+        thread.threadId = threadIds[i];
+        thread.depth = (DWORD)FrameWalker::walkThread(threads[i], thread.pcs, thread.sps, CRASH_THREAD_DEPTH);
+        if (thread.depth > 0) {
+            count++;
+        }
+    }
+
+    // Let them go before symbolizing, they may hold the heap or loader lock
+    for (int i = 0; i < suspended; i++) {
+        Threads::resume(threads[i]);
+    }
+
+    m_threadSnapshotCount = count;
+    return count;
+}
+
+std::vector<std::string> CrashHandler::formatThreadSnapshots() {
+    std::vector<std::string> lines;
+
+    // Resolve every pc of every thread in a single batch
+    std::vector<DWORD64> addresses;
+    for (int i = 0; i < m_threadSnapshotCount; i++) {
+        addresses.insert(addresses.end(), m_threadSnapshots[i].pcs, m_threadSnapshots[i].pcs + m_threadSnapshots[i].depth);
+    }
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+    std::vector<std::string> symbols = resolveSymbols(addresses);
+
+    for (int i = 0; i < m_threadSnapshotCount; i++) {
+        const ThreadStackSnapshot& thread = m_threadSnapshots[i];
+
+        std::vector<DWORD64> threadAddresses(thread.pcs, thread.pcs + thread.depth);
+        std::vector<DWORD64> threadStackPointers(thread.sps, thread.sps + thread.depth);
+        std::vector<std::string> threadSymbols;
+        for (DWORD64 pc : threadAddresses) {
+            size_t index = std::lower_bound(addresses.begin(), addresses.end(), pc) - addresses.begin();
+            threadSymbols.push_back(symbols[index]);
+        }
+
+        std::stringstream header;
+        header << "  Thread " << thread.threadId << ":";
+        lines.push_back(header.str());
+
+        for (const auto& frame : formatFrames(thread.threadId, threadAddresses, threadStackPointers, threadSymbols)) {
+            lines.push_back("    " + frame);
+        }
+    }
+
+    return lines;
+}
+
+#ifdef _M_IX86
+size_t CrashHandler::walkStackWithDbgHelp(CONTEXT* context, DWORD64* pcs, DWORD64* sps, size_t capacity) {
     STACKFRAME stackFrame;
     memset(&stackFrame, 0, sizeof(stackFrame));
 
-#ifdef _M_IX86
     DWORD machineType = IMAGE_FILE_MACHINE_I386;
     stackFrame.AddrPC.Offset = context->Eip;
     stackFrame.AddrPC.Mode = AddrModeFlat;
@@ -482,17 +844,18 @@ std::vector<std::string> CrashHandler::captureStackTrace(CONTEXT* context) {
     stackFrame.AddrFrame.Mode = AddrModeFlat;
     stackFrame.AddrStack.Offset = context->Esp;
     stackFrame.AddrStack.Mode = AddrModeFlat;
-#else
-#error "Unsupported platform"
-#endif
 
-    for (int frameNum = 0; ; ++frameNum) {
+    // StackWalk modifies the context, keep the caller's intact
+    CONTEXT walkContext = *context;
+
+    size_t count = 0;
+    while (count < capacity) {
         if (!StackWalk(
             machineType,
             GetCurrentProcess(),
             GetCurrentThread(),
             &stackFrame,
-            context,
+            &walkContext,
             nullptr,
             SymFunctionTableAccess,
             SymGetModuleBase,
@@ -504,55 +867,126 @@ std::vector<std::string> CrashHandler::captureStackTrace(CONTEXT* context) {
             break;
         }
 
-        std::stringstream frameDesc;
-        frameDesc << "#" << frameNum << ": " << resolveSymbol(stackFrame.AddrPC.Offset);
-
-        stackTrace.push_back(frameDesc.str());
+        pcs[count] = stackFrame.AddrPC.Offset;
+        sps[count] = stackFrame.AddrStack.Offset;
+        count++;
     }
 
-    return stackTrace;
+    return count;
 }
+#endif
 
 // .NET integration methods
 void CrashHandler::registerManagedCallbacks() {
-    // This would be implemented using the CLR hosting APIs
-    // Simplified implementation for illustration
-    ICLRMetaHost* metaHost = nullptr;
-    if (FAILED(CLRCreateInstance(CLSID_CLRMetaHost, IID_ICLRMetaHost, (void**)&metaHost))) {
-        return;
+    // The frame buffer is allocated up front, nothing is allocated for it at crash time
+    if (!m_managedFrames) {
+        m_managedFrames.reset(new ManagedStackFrame[MANAGED_STACK_CAPACITY]);
+        memset(m_managedFrames.get(), 0, sizeof(ManagedStackFrame) * MANAGED_STACK_CAPACITY);
+    }
+}
+
+void CrashHandler::registerManagedStackCapture(ManagedStackCaptureFunc capture) {
+    registerManagedCallbacks();
+    m_managedStackCapture = capture;
+}
+
+int CrashHandler::captureManagedFrames() {
+    m_managedFrameCount = 0;
+    if (!m_managedStackCapture || !m_managedFrames) {
+        return 0;
+    }
+
+    int count = m_managedStackCapture(m_managedFrames.get(), MANAGED_STACK_CAPACITY);
+    if (count < 0) {
+        count = 0;
+    }
+    if (count > MANAGED_STACK_CAPACITY) {
+        count = MANAGED_STACK_CAPACITY;
+    }
+
+    // Make sure every name is terminated before we start printing them
+    for (int i = 0; i < count; i++) {
+        m_managedFrames[i].method[sizeof(m_managedFrames[i].method) - 1] = '\0';
     }
 
-    // This would attach to AppDomain.UnhandledException
-    // Implementation would involve getting the runtime, getting the AppDomain,
-    // and setting up event handlers
+    m_managedFrameCount = count;
+    return count;
+}
 
-    metaHost->Release();
+int CrashHandler::nextManagedFrame(DWORD threadId, int start) {
+    for (int i = start; i < m_managedFrameCount; i++) {
+        if (m_managedFrames[i].threadId == threadId) {
+            return i;
+        }
+    }
+    return -1;
 }
 
-void CrashHandler::handleManagedException(void* exception) {
-    // This would handle a managed exception
-    // We would use the .NET metadata APIs to extract information
+std::vector<std::string> CrashHandler::formatManagedFrames(DWORD skipThreadId) {
+    std::vector<std::string> lines;
+    DWORD currentThread = 0;
+    int frameNum = 0;
 
-    // Capture managed stack trace
-    std::vector<std::string> managedStack = captureManagedStackTrace(exception);
+    // Frames come grouped by thread, top of stack first
+    for (int i = 0; i < m_managedFrameCount; i++) {
+        const ManagedStackFrame& frame = m_managedFrames[i];
+        if (frame.threadId == skipThreadId) {
+            continue;
+        }
 
-    // Log managed exception details
-    // This would involve using ICorDebug or Microsoft.Diagnostics.Runtime
+        if (lines.empty() || frame.threadId != currentThread) {
+            currentThread = frame.threadId;
+            frameNum = 0;
+
+            std::stringstream header;
+            header << "  Thread " << frame.threadId << ":";
+            lines.push_back(header.str());
+        }
+
+        std::stringstream frameDesc;
+        frameDesc << "    #" << frameNum++ << ": " << frame.method;
+        lines.push_back(frameDesc.str());
+    }
+
+    return lines;
 }
 
-std::vector<std::string> CrashHandler::captureManagedStackTrace(void* exception) {
-    std::vector<std::string> stackTrace;
+void CrashHandler::handleManagedException(const char* description) {
+    if (m_dotNetExtraInfoResolverAvailable == false) {
+        return;
+    }
+
+    // Prevent multiple crash dialogs
+    if (!electReporter()) return;
 
-    // This would use the Microsoft.Diagnostics.Runtime API
-    // or ICorDebug to walk the managed stack
+    Logger::getInstance().write(LOG_LEVEL_ERROR, 0, description ? description : "Unhandled managed exception");
 
-    // For a real implementation, this would involve:
-    // 1. Attaching to the CLR
-    // 2. Getting the thread where the exception occurred
-    // 3. Walking the stack frames
-    // 4. Resolving method names and source information from PDBs
+    std::vector<std::string> managedStack = captureManagedStackTrace();
 
-    return stackTrace;
+    std::wstringstream report;
+    report << L"Unhandled Managed Exception:\r\n";
+    if (description && description[0] != '\0') {
+        report << description << L"\r\n";
+    }
+    report << L"\r\nManaged Threads:\r\n";
+    for (const auto& line : managedStack) {
+        report << line.c_str() << L"\r\n";
+    }
+
+    if (m_managedExtraInfoResolver) {
+        const char* managedExtraInfo = m_managedExtraInfoResolver();
+        if (managedExtraInfo && managedExtraInfo[0] != '\0') {
+            report << managedExtraInfo;
+        }
+    }
+
+    showCrashDialog(report.str());
+    finishReport();
+}
+
+std::vector<std::string> CrashHandler::captureManagedStackTrace() {
+    captureManagedFrames();
+    return formatManagedFrames(0);
 }
 
 
@@ -576,4 +1010,25 @@ extern "C" __declspec(dllexport) void RegisterManagedExtraInfoResolver(const cha
 	if (g_crashHandlerInstance) {
 		g_crashHandlerInstance->registerManagedExtraInfoResolver(resolverFunc);
 	}
+}
+
+// Add an export for registering the batched managed symbol resolver
+extern "C" __declspec(dllexport) void RegisterManagedBatchSymbolResolver(int (*resolverFunc)(const DWORD64*, int, char*, int, int*)) {
+    if (g_crashHandlerInstance) {
+        g_crashHandlerInstance->registerManagedBatchSymbolResolver(resolverFunc);
+    }
+}
+
+// Add an export for registering the managed stack snapshot callback
+extern "C" __declspec(dllexport) void RegisterManagedStackCapture(int (*captureFunc)(ManagedStackFrame*, int)) {
+    if (g_crashHandlerInstance) {
+        g_crashHandlerInstance->registerManagedStackCapture(captureFunc);
+    }
+}
+
+// Add an export for reporting an unhandled managed exception
+extern "C" __declspec(dllexport) void ReportManagedException(const char* description) {
+    if (g_crashHandlerInstance) {
+        g_crashHandlerInstance->handleManagedException(description);
+    }
 }
\ No newline at end of file
@@ -7,6 +7,9 @@
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include "CrashMonitor.h"
+#include "CrashBuckets.h"
 
 #pragma comment(lib, "Dbghelp.lib")
 
@@ -17,6 +20,34 @@ namespace Microsoft {
     }
 }
 
+// Number of managed frames (all threads) the preallocated snapshot buffer holds
+#define MANAGED_STACK_CAPACITY 2048
+
+// A single managed frame, filled in by the managed stack capture callback.
+// Frames are grouped by thread and ordered from the top of each stack down.
+struct ManagedStackFrame {
+    DWORD threadId;             // OS thread id
+    DWORD reserved;
+    DWORD64 instructionPointer;
+    DWORD64 stackPointer;       // 0 if unknown, used to order the frame among native frames
+    char method[240];           // e.g. "Chorizite.Core!Chorizite.Core.Plugins.PluginManager.Load"
+};
+
+// Most threads captured in the all-threads crash snapshot, and the depth kept per thread
+#define CRASH_MAX_THREADS 256
+#define CRASH_THREAD_DEPTH 64
+
+// UTF-16 characters converted per write when saving a report
+#define CRASH_REPORT_CHUNK_SIZE 2048
+
+// Raw stack of one thread, captured while every other thread is suspended
+struct ThreadStackSnapshot {
+    DWORD threadId;
+    DWORD depth;
+    DWORD64 pcs[CRASH_THREAD_DEPTH];
+    DWORD64 sps[CRASH_THREAD_DEPTH];
+};
+
 class CrashHandler {
 public:
     static CrashHandler& getInstance() {
@@ -25,6 +56,9 @@ public:
     }
 
     bool initialize(const std::wstring& dumpPath);
+
+    // Stops the watchdog, logger and the rest. Has to be called explicitly
+    // before exit, not from a static destructor.
     void shutdown();
 
     // Settings
@@ -47,6 +81,16 @@ public:
     // Track if the .NET resolver is available
     bool m_dotNetResolverAvailable;
 
+    // Function pointer type for the batched .NET symbol resolver. Resolves
+    // `count` addresses in one transition, writing NUL terminated names into
+    // the caller owned arena and each name's start into offsets (-1 when the
+    // address is not managed). Returns the number of arena bytes used, or a
+    // negative value on failure.
+    typedef int (*ManagedBatchSymbolResolverFunc)(const DWORD64* addresses, int count, char* arena, int arenaSize, int* offsets);
+
+    // Pointer to the batched managed resolver function
+    ManagedBatchSymbolResolverFunc m_managedBatchResolver;
+
     // Function pointer type for the .NET symbol resolver
     typedef const char* (*ManagedExtraInfoResolverFunc)();
 
@@ -59,6 +103,17 @@ public:
     // Track if the .NET resolver is available
     bool m_dotNetExtraInfoResolverAvailable;
 
+    // Function pointer type for the .NET stack snapshot. Writes up to `capacity`
+    // frames for all managed threads and returns how many were written.
+    typedef int (*ManagedStackCaptureFunc)(ManagedStackFrame* frames, int capacity);
+
+    // Pointer to the managed stack capture function
+    ManagedStackCaptureFunc m_managedStackCapture;
+
+    // Preallocated snapshot buffer and the number of frames from the last capture
+    std::unique_ptr<ManagedStackFrame[]> m_managedFrames;
+    int m_managedFrameCount;
+
     // In CrashHandler.cpp, update the constructor to initialize new members
     CrashHandler();
     ~CrashHandler();
@@ -73,21 +128,48 @@ public:
     static LONG WINAPI unhandledExceptionFilter(EXCEPTION_POINTERS* exceptionPointers);
     static LONG WINAPI vectoredExceptionHandler(EXCEPTION_POINTERS* exceptionPointers);
     void handleException(EXCEPTION_POINTERS* exceptionPointers);
+    void showCrashDialog(const std::wstring& text);
+    void writeReportFile(const std::wstring& path, const std::wstring& text);
+    std::wstring describeFaultAddress(const EXCEPTION_RECORD* record);
+
+    // First crash wins, everybody else waits for its report instead of queueing on a lock
+    bool electReporter();
+    void finishReport();
 
-    // Symbol resolution
+    // Symbol resolution. initializeSymbols expects m_crashHandlerMutex held,
+    // ensureSymbols takes it and is what other components call.
     bool initializeSymbols();
+    bool ensureSymbols();
+    std::wstring buildSymbolSearchPath();
     std::string resolveSymbol(DWORD64 address);
+    std::string resolveNativeSymbol(DWORD64 address);
+    std::vector<std::string> resolveSymbols(const std::vector<DWORD64>& addresses);
 
     // Stack walking
     std::vector<std::string> captureStackTrace(CONTEXT* context);
+    std::vector<std::string> formatFrames(DWORD threadId, const std::vector<DWORD64>& addresses, const std::vector<DWORD64>& stackPointers, const std::vector<std::string>& symbols);
+    int captureAllThreads();
+    std::vector<std::string> formatThreadSnapshots();
+#ifdef _M_IX86
+    size_t walkStackWithDbgHelp(CONTEXT* context, DWORD64* pcs, DWORD64* sps, size_t capacity);
+#endif
 
     // .NET specific functionality
-    void handleManagedException(void* exception);
-    std::vector<std::string> captureManagedStackTrace(void* exception);
+    void handleManagedException(const char* description);
+    std::vector<std::string> captureManagedStackTrace();
+    int captureManagedFrames();
+    int nextManagedFrame(DWORD threadId, int start);
+    std::vector<std::string> formatManagedFrames(DWORD skipThreadId);
+
+    // Add a method to register the .NET stack snapshot callback
+    void registerManagedStackCapture(ManagedStackCaptureFunc capture);
 
     // Add a method to register the .NET symbol resolver
     void registerManagedSymbolResolver(ManagedSymbolResolverFunc resolver);
 
+    // Register the batched .NET symbol resolver, preferred over the per frame one
+    void registerManagedBatchSymbolResolver(ManagedBatchSymbolResolverFunc resolver);
+
     // Add a method to register the .NET symbol resolver
     void registerManagedExtraInfoResolver(ManagedExtraInfoResolverFunc resolver);
 
@@ -99,13 +181,35 @@ public:
     bool m_autoReport;
     std::mutex m_crashHandlerMutex;
 
+    // Thread that owns the crash report, 0 until something crashes
+    std::atomic<DWORD> m_reporterThreadId;
+    HANDLE m_reportDoneEvent;
+
+    // Preallocated all-threads snapshot and the number of threads in the last capture
+    std::unique_ptr<ThreadStackSnapshot[]> m_threadSnapshots;
+    int m_threadSnapshotCount;
+
     // Previous exception filter
     LPTOP_LEVEL_EXCEPTION_FILTER m_previousFilter;
     void* m_vectoredExceptionHandle;
 
+    // Out-of-process monitor, connected when the launcher is watching us
+    CrashMonitorClient m_monitorClient;
+
+    // Deduplicates crashes by stack signature across all clients sharing m_dumpPath
+    CrashBucketIndex m_crashBuckets;
+
     // .NET integration
     void* m_appDomainCallbackToken;
 };
 
+// yyyyMMdd-HHmmss, shared by all report file names
+std::wstring FormatReportTimestamp();
+
 // Helper for C# code to access the crash handler
-extern "C" __declspec(dllexport) void RegisterManagedCrashHandler();
\ No newline at end of file
+extern "C" __declspec(dllexport) void RegisterManagedCrashHandler();
+extern "C" __declspec(dllexport) void RegisterManagedSymbolResolver(const char* (*resolverFunc)(DWORD64));
+extern "C" __declspec(dllexport) void RegisterManagedExtraInfoResolver(const char* (*resolverFunc)());
+extern "C" __declspec(dllexport) void RegisterManagedBatchSymbolResolver(int (*resolverFunc)(const DWORD64*, int, char*, int, int*));
+extern "C" __declspec(dllexport) void RegisterManagedStackCapture(int (*captureFunc)(ManagedStackFrame*, int));
+extern "C" __declspec(dllexport) void ReportManagedException(const char* description);
\ No newline at end of file
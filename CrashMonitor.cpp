@@ -0,0 +1,436 @@
+// CrashMonitor.cpp
+#include "pch.h"
+#include "CrashMonitor.h"
+#include "CrashHandler.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+CrashMonitorClient::CrashMonitorClient()
+    : m_mapping(nullptr)
+    , m_signalEvent(nullptr)
+    , m_doneEvent(nullptr)
+    , m_channel(nullptr)
+{
+}
+
+CrashMonitorClient::~CrashMonitorClient() {
+    close();
+}
+
+bool CrashMonitorClient::open(DWORD processId) {
+    if (m_channel) {
+        return true;
+    }
+
+    wchar_t name[128];
+
+    swprintf_s(name, CRASH_MONITOR_MAPPING_NAME, processId);
+    m_mapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name);
+
+    swprintf_s(name, CRASH_MONITOR_SIGNAL_NAME, processId);
+    m_signalEvent = OpenEventW(EVENT_MODIFY_STATE, FALSE, name);
+
+    swprintf_s(name, CRASH_MONITOR_DONE_NAME, processId);
+    m_doneEvent = OpenEventW(SYNCHRONIZE, FALSE, name);
+
+    // No monitor is watching this client
+    if (!m_mapping || !m_signalEvent || !m_doneEvent) {
+        close();
+        return false;
+    }
+
+    m_channel = (CrashMonitorChannel*)MapViewOfFile(m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(CrashMonitorChannel));
+    if (!m_channel) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void CrashMonitorClient::close() {
+    if (m_channel) {
+        UnmapViewOfFile(m_channel);
+        m_channel = nullptr;
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_signalEvent) {
+        CloseHandle(m_signalEvent);
+        m_signalEvent = nullptr;
+    }
+    if (m_doneEvent) {
+        CloseHandle(m_doneEvent);
+        m_doneEvent = nullptr;
+    }
+}
+
+bool CrashMonitorClient::signal(EXCEPTION_POINTERS* exceptionPointers, DWORD threadId, DWORD flags) {
+    if (!m_channel) {
+        return false;
+    }
+
+    m_channel->processId = GetCurrentProcessId();
+    m_channel->threadId = threadId;
+    m_channel->exceptionCode = exceptionPointers->ExceptionRecord->ExceptionCode;
+    m_channel->flags = flags;
+    m_channel->exceptionPointers = (ULONG64)(ULONG_PTR)exceptionPointers;
+    MemoryBarrier();
+
+    if (!SetEvent(m_signalEvent)) {
+        return false;
+    }
+
+    return WaitForSingleObject(m_doneEvent, CRASH_MONITOR_TIMEOUT_MS) == WAIT_OBJECT_0;
+}
+
+CrashMonitor::CrashMonitor()
+    : m_running(false)
+    , m_fullMemoryDump(true)
+{
+}
+
+CrashMonitor::~CrashMonitor() {
+    stop();
+}
+
+bool CrashMonitor::start(const std::wstring& dumpPath) {
+    std::lock_guard<std::mutex> lock(m_clientsMutex);
+
+    m_dumpPath = dumpPath;
+    if (!m_dumpPath.empty() && m_dumpPath.back() != L'\\' && m_dumpPath.back() != L'/') {
+        m_dumpPath += L"\\";
+    }
+
+    m_running = true;
+    return true;
+}
+
+void CrashMonitor::stop() {
+    std::vector<std::unique_ptr<WatchedClient>> clients;
+    {
+        std::lock_guard<std::mutex> lock(m_clientsMutex);
+        m_running = false;
+        clients.swap(m_clients);
+    }
+
+    for (auto& client : clients) {
+        releaseClient(client.get(), true);
+    }
+}
+
+void CrashMonitor::enableFullMemoryDump(bool enable) {
+    m_fullMemoryDump = enable;
+}
+
+bool CrashMonitor::watch(HANDLE hProcess, DWORD processId) {
+    if (!m_running) {
+        return false;
+    }
+
+    std::unique_ptr<WatchedClient> client(new WatchedClient());
+    memset(client.get(), 0, sizeof(WatchedClient));
+    client->processId = processId;
+
+    // Keep our own handle, the caller closes theirs once the client is resumed
+    if (!DuplicateHandle(GetCurrentProcess(), hProcess, GetCurrentProcess(), &client->hProcess, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        return false;
+    }
+
+    wchar_t name[128];
+
+    swprintf_s(name, CRASH_MONITOR_MAPPING_NAME, processId);
+    client->hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(CrashMonitorChannel), name);
+
+    swprintf_s(name, CRASH_MONITOR_SIGNAL_NAME, processId);
+    client->hSignalEvent = CreateEventW(nullptr, FALSE, FALSE, name);
+
+    swprintf_s(name, CRASH_MONITOR_DONE_NAME, processId);
+    client->hDoneEvent = CreateEventW(nullptr, FALSE, FALSE, name);
+
+    if (client->hMapping) {
+        client->channel = (CrashMonitorChannel*)MapViewOfFile(client->hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(CrashMonitorChannel));
+    }
+
+    if (!client->channel || !client->hSignalEvent || !client->hDoneEvent) {
+        releaseClient(client.get(), false);
+        return false;
+    }
+
+    WatchedClient* rawClient = client.get();
+    {
+        std::lock_guard<std::mutex> lock(m_clientsMutex);
+        m_clients.push_back(std::move(client));
+    }
+
+    if (!RegisterWaitForSingleObject(&rawClient->hSignalWait, rawClient->hSignalEvent, onClientSignaled, rawClient, INFINITE, WT_EXECUTELONGFUNCTION)
+        || !RegisterWaitForSingleObject(&rawClient->hExitWait, rawClient->hProcess, onClientExited, rawClient, INFINITE, WT_EXECUTEONLYONCE)) {
+        onClientExited(rawClient, FALSE);
+        return false;
+    }
+
+    return true;
+}
+
+VOID CALLBACK CrashMonitor::onClientSignaled(PVOID context, BOOLEAN timedOut) {
+    WatchedClient* client = (WatchedClient*)context;
+    CrashMonitor& monitor = CrashMonitor::getInstance();
+
+    monitor.captureClient(client);
+
+    // Let the client continue with its own exception handling
+    SetEvent(client->hDoneEvent);
+}
+
+VOID CALLBACK CrashMonitor::onClientExited(PVOID context, BOOLEAN timedOut) {
+    WatchedClient* client = (WatchedClient*)context;
+    CrashMonitor& monitor = CrashMonitor::getInstance();
+
+    std::unique_ptr<WatchedClient> owned;
+    {
+        std::lock_guard<std::mutex> lock(monitor.m_clientsMutex);
+        auto it = std::find_if(monitor.m_clients.begin(), monitor.m_clients.end(),
+            [client](const std::unique_ptr<WatchedClient>& c) { return c.get() == client; });
+        if (it == monitor.m_clients.end()) {
+            // Already released by stop()
+            return;
+        }
+        owned = std::move(*it);
+        monitor.m_clients.erase(it);
+    }
+
+    // Can't block on our own wait from inside its callback
+    if (owned->hExitWait) {
+        UnregisterWait(owned->hExitWait);
+        owned->hExitWait = nullptr;
+    }
+    monitor.releaseClient(owned.get(), true);
+}
+
+void CrashMonitor::releaseClient(WatchedClient* client, bool waitForCallbacks) {
+    HANDLE completion = waitForCallbacks ? INVALID_HANDLE_VALUE : nullptr;
+
+    if (client->hSignalWait) {
+        UnregisterWaitEx(client->hSignalWait, completion);
+        client->hSignalWait = nullptr;
+    }
+    if (client->hExitWait) {
+        UnregisterWaitEx(client->hExitWait, completion);
+        client->hExitWait = nullptr;
+    }
+    if (client->channel) {
+        UnmapViewOfFile(client->channel);
+        client->channel = nullptr;
+    }
+    if (client->hMapping) {
+        CloseHandle(client->hMapping);
+        client->hMapping = nullptr;
+    }
+    if (client->hSignalEvent) {
+        CloseHandle(client->hSignalEvent);
+        client->hSignalEvent = nullptr;
+    }
+    if (client->hDoneEvent) {
+        CloseHandle(client->hDoneEvent);
+        client->hDoneEvent = nullptr;
+    }
+    if (client->hProcess) {
+        CloseHandle(client->hProcess);
+        client->hProcess = nullptr;
+    }
+}
+
+void CrashMonitor::captureClient(WatchedClient* client) {
+    std::lock_guard<std::mutex> lock(m_captureMutex);
+
+    CrashMonitorChannel channel = *client->channel;
+    HANDLE hProcess = client->hProcess;
+
+    // Pull the exception record and faulting context out of the client
+    EXCEPTION_POINTERS remotePointers = { 0 };
+    EXCEPTION_RECORD record = { 0 };
+    CONTEXT context = { 0 };
+    if (!ReadProcessMemory(hProcess, (LPCVOID)(ULONG_PTR)channel.exceptionPointers, &remotePointers, sizeof(remotePointers), nullptr)
+        || !ReadProcessMemory(hProcess, remotePointers.ExceptionRecord, &record, sizeof(record), nullptr)
+        || !ReadProcessMemory(hProcess, remotePointers.ContextRecord, &context, sizeof(context), nullptr)) {
+        return;
+    }
+
+    std::wstring baseName = m_dumpPath + L"crash-" + std::to_wstring(client->processId) + L"-" + FormatReportTimestamp();
+
+    std::vector<std::string> stackTrace;
+    HANDLE hThread = OpenThread(THREAD_ALL_ACCESS, FALSE, channel.threadId);
+    if (hThread) {
+        stackTrace = captureRemoteStackTrace(hProcess, hThread, context);
+        CloseHandle(hThread);
+    }
+
+    std::ofstream report(baseName + L".txt");
+    report << "Process: " << client->processId << "\r\n"
+        << "Thread: " << channel.threadId << "\r\n"
+        << "Exception Code: 0x" << std::hex << record.ExceptionCode << std::dec << "\r\n"
+        << "Exception Address: 0x" << std::hex << record.ExceptionAddress << std::dec << "\r\n\r\n";
+
+#ifdef _M_IX86
+    report << "Registers:\r\n" << std::hex << std::setfill('0')
+        << "  EAX=" << std::setw(8) << context.Eax << " EBX=" << std::setw(8) << context.Ebx
+        << " ECX=" << std::setw(8) << context.Ecx << " EDX=" << std::setw(8) << context.Edx << "\r\n"
+        << "  ESI=" << std::setw(8) << context.Esi << " EDI=" << std::setw(8) << context.Edi
+        << " EBP=" << std::setw(8) << context.Ebp << " ESP=" << std::setw(8) << context.Esp << "\r\n"
+        << "  EIP=" << std::setw(8) << context.Eip << " EFL=" << std::setw(8) << context.EFlags << "\r\n\r\n"
+        << std::dec << std::setfill(' ');
+#endif
+
+    report << "Stack Trace:\r\n";
+    for (const auto& frame : stackTrace) {
+        report << "  " << frame << "\r\n";
+    }
+    report.close();
+
+    if ((channel.flags & CRASH_MONITOR_FLAG_NO_DUMP) == 0) {
+        writeMiniDump(client, baseName + L".dmp");
+    }
+}
+
+std::vector<std::string> CrashMonitor::captureRemoteStackTrace(HANDLE hProcess, HANDLE hThread, CONTEXT context) {
+    std::vector<std::string> stackTrace;
+
+    // Search next to the client executable first
+    wchar_t clientPath[MAX_PATH] = { 0 };
+    GetModuleFileNameExW(hProcess, nullptr, clientPath, MAX_PATH);
+    std::wstring clientDir = clientPath;
+    clientDir = clientDir.substr(0, clientDir.find_last_of(L"\\/") + 1);
+    std::wstring searchPath = clientDir + L";" + m_dumpPath;
+
+    SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES);
+    if (!SymInitializeW(hProcess, searchPath.c_str(), TRUE)) {
+        return stackTrace;
+    }
+
+    STACKFRAME64 stackFrame;
+    memset(&stackFrame, 0, sizeof(stackFrame));
+
+#ifdef _M_IX86
+    DWORD machineType = IMAGE_FILE_MACHINE_I386;
+    stackFrame.AddrPC.Offset = context.Eip;
+    stackFrame.AddrPC.Mode = AddrModeFlat;
+    stackFrame.AddrFrame.Offset = context.Ebp;
+    stackFrame.AddrFrame.Mode = AddrModeFlat;
+    stackFrame.AddrStack.Offset = context.Esp;
+    stackFrame.AddrStack.Mode = AddrModeFlat;
+#elif defined(_M_X64)
+    DWORD machineType = IMAGE_FILE_MACHINE_AMD64;
+    stackFrame.AddrPC.Offset = context.Rip;
+    stackFrame.AddrPC.Mode = AddrModeFlat;
+    stackFrame.AddrFrame.Offset = context.Rbp;
+    stackFrame.AddrFrame.Mode = AddrModeFlat;
+    stackFrame.AddrStack.Offset = context.Rsp;
+    stackFrame.AddrStack.Mode = AddrModeFlat;
+#elif defined(_M_ARM64)
+    DWORD machineType = IMAGE_FILE_MACHINE_ARM64;
+    stackFrame.AddrPC.Offset = context.Pc;
+    stackFrame.AddrPC.Mode = AddrModeFlat;
+    stackFrame.AddrFrame.Offset = context.Fp;
+    stackFrame.AddrFrame.Mode = AddrModeFlat;
+    stackFrame.AddrStack.Offset = context.Sp;
+    stackFrame.AddrStack.Mode = AddrModeFlat;
+#endif
+
+    for (int frameNum = 0; ; ++frameNum) {
+        if (!StackWalk64(
+            machineType,
+            hProcess,
+            hThread,
+            &stackFrame,
+            &context,
+            nullptr,
+            SymFunctionTableAccess64,
+            SymGetModuleBase64,
+            nullptr)) {
+            break;
+        }
+
+        if (stackFrame.AddrPC.Offset == 0) {
+            break;
+        }
+
+        std::stringstream frameDesc;
+        frameDesc << "#" << frameNum << ": " << resolveRemoteSymbol(hProcess, stackFrame.AddrPC.Offset);
+
+        stackTrace.push_back(frameDesc.str());
+    }
+
+    SymCleanup(hProcess);
+    return stackTrace;
+}
+
+std::string CrashMonitor::resolveRemoteSymbol(HANDLE hProcess, DWORD64 address) {
+    IMAGEHLP_MODULE64 moduleInfo;
+    moduleInfo.SizeOfStruct = sizeof(IMAGEHLP_MODULE64);
+    std::string moduleName = "Unknown";
+
+    if (SymGetModuleInfo64(hProcess, address, &moduleInfo)) {
+        moduleName = moduleInfo.ModuleName;
+    }
+
+    DWORD64 displacement = 0;
+    char buffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME * sizeof(TCHAR)];
+    PSYMBOL_INFO symbol = (PSYMBOL_INFO)buffer;
+    symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+    symbol->MaxNameLen = MAX_SYM_NAME;
+    std::stringstream result;
+
+    if (SymFromAddr(hProcess, address, &displacement, symbol)) {
+        IMAGEHLP_LINE64 line;
+        DWORD lineDisplacement = 0;
+        line.SizeOfStruct = sizeof(IMAGEHLP_LINE64);
+        if (SymGetLineFromAddr64(hProcess, address, &lineDisplacement, &line)) {
+            result << moduleName << "!" << symbol->Name << " at " << line.FileName << ":" << line.LineNumber;
+        }
+        else {
+            result << moduleName << "!" << "0x" << std::hex << address << " " << symbol->Name << " + 0x" << std::hex << displacement;
+        }
+    }
+    else {
+        result << moduleName << "!" << "0x" << std::hex << address;
+    }
+
+    return result.str();
+}
+
+bool CrashMonitor::writeMiniDump(WatchedClient* client, const std::wstring& path) {
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // The exception pointers live in the client, let dbghelp read them from there
+    MINIDUMP_EXCEPTION_INFORMATION exceptionInfo;
+    exceptionInfo.ThreadId = client->channel->threadId;
+    exceptionInfo.ExceptionPointers = (PEXCEPTION_POINTERS)(ULONG_PTR)client->channel->exceptionPointers;
+    exceptionInfo.ClientPointers = TRUE;
+
+    MINIDUMP_TYPE dumpType = m_fullMemoryDump
+        ? (MINIDUMP_TYPE)(MiniDumpWithFullMemory | MiniDumpWithHandleData | MiniDumpWithThreadInfo)
+        : (MINIDUMP_TYPE)(MiniDumpWithIndirectlyReferencedMemory | MiniDumpWithThreadInfo);
+
+    BOOL result = MiniDumpWriteDump(client->hProcess, client->processId, hFile, dumpType, &exceptionInfo, nullptr, nullptr);
+    CloseHandle(hFile);
+    return result == TRUE;
+}
+
+// Export for the launcher, clients started by LaunchInjected afterwards are watched
+extern "C" __declspec(dllexport) bool StartCrashMonitor(const wchar_t* dumpPath) {
+    if (!dumpPath) return false;
+    return CrashMonitor::getInstance().start(dumpPath);
+}
+
+extern "C" __declspec(dllexport) void StopCrashMonitor() {
+    CrashMonitor::getInstance().stop();
+}
@@ -0,0 +1,120 @@
+// CrashMonitor.h
+#pragma once
+
+#include <Windows.h>
+#include <DbgHelp.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#pragma comment(lib, "Dbghelp.lib")
+
+// Per-client kernel object names, formatted with the client's process id.
+// The launcher creates these before the client is resumed, the injected
+// CrashHandler opens them during initialize.
+#define CRASH_MONITOR_MAPPING_NAME L"Local\\Chorizite.CrashMonitor.%lu"
+#define CRASH_MONITOR_SIGNAL_NAME  L"Local\\Chorizite.CrashMonitor.%lu.Signal"
+#define CRASH_MONITOR_DONE_NAME    L"Local\\Chorizite.CrashMonitor.%lu.Done"
+
+// How long a crashing client waits for the monitor to finish its capture
+#define CRASH_MONITOR_TIMEOUT_MS 120000
+
+// Known crash bucket, the monitor writes the report but skips the dump
+#define CRASH_MONITOR_FLAG_NO_DUMP 0x1
+
+// Shared block the crashing client fills in before signalling the monitor
+struct CrashMonitorChannel {
+    DWORD processId;
+    DWORD threadId;
+    DWORD exceptionCode;
+    DWORD flags;
+    ULONG64 exceptionPointers; // EXCEPTION_POINTERS* in the client's address space
+};
+
+// Client side of the channel, lives inside the injected CrashHandler.
+// Everything is opened up front so signalling at crash time is a couple of
+// stores and a SetEvent.
+class CrashMonitorClient {
+public:
+    CrashMonitorClient();
+    ~CrashMonitorClient();
+
+    bool open(DWORD processId);
+    void close();
+    bool isConnected() const { return m_channel != nullptr; }
+
+    // Publishes the exception to the monitor and blocks until it has finished
+    // capturing. Returns false if the monitor did not answer in time.
+    bool signal(EXCEPTION_POINTERS* exceptionPointers, DWORD threadId, DWORD flags);
+
+private:
+    HANDLE m_mapping;
+    HANDLE m_signalEvent;
+    HANDLE m_doneEvent;
+    CrashMonitorChannel* m_channel;
+};
+
+// Launcher side: watches any number of clients and captures the stack,
+// registers and a minidump from outside the crashed process.
+class CrashMonitor {
+public:
+    static CrashMonitor& getInstance() {
+        static CrashMonitor instance;
+        return instance;
+    }
+
+    bool start(const std::wstring& dumpPath);
+    void stop();
+    bool isRunning() const { return m_running; }
+
+    void enableFullMemoryDump(bool enable);
+
+    // Creates the channel for a (still suspended) client and starts waiting on it
+    bool watch(HANDLE hProcess, DWORD processId);
+
+private:
+    struct WatchedClient {
+        DWORD processId;
+        HANDLE hProcess;
+        HANDLE hMapping;
+        HANDLE hSignalEvent;
+        HANDLE hDoneEvent;
+        HANDLE hSignalWait;
+        HANDLE hExitWait;
+        CrashMonitorChannel* channel;
+    };
+
+    CrashMonitor();
+    ~CrashMonitor();
+
+    // No copy or move
+    CrashMonitor(const CrashMonitor&) = delete;
+    CrashMonitor& operator=(const CrashMonitor&) = delete;
+    CrashMonitor(CrashMonitor&&) = delete;
+    CrashMonitor& operator=(CrashMonitor&&) = delete;
+
+    // Thread pool callbacks
+    static VOID CALLBACK onClientSignaled(PVOID context, BOOLEAN timedOut);
+    static VOID CALLBACK onClientExited(PVOID context, BOOLEAN timedOut);
+
+    void captureClient(WatchedClient* client);
+    std::vector<std::string> captureRemoteStackTrace(HANDLE hProcess, HANDLE hThread, CONTEXT context);
+    std::string resolveRemoteSymbol(HANDLE hProcess, DWORD64 address);
+    bool writeMiniDump(WatchedClient* client, const std::wstring& path);
+    void releaseClient(WatchedClient* client, bool waitForCallbacks);
+
+    std::wstring m_dumpPath;
+    bool m_running;
+    bool m_fullMemoryDump;
+
+    std::vector<std::unique_ptr<WatchedClient>> m_clients;
+    std::mutex m_clientsMutex;
+
+    // dbghelp is single threaded, captures for different clients are serialized
+    std::mutex m_captureMutex;
+};
+
+// Launcher exports
+extern "C" __declspec(dllexport) bool StartCrashMonitor(const wchar_t* dumpPath);
+extern "C" __declspec(dllexport) void StopCrashMonitor();
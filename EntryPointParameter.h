@@ -3,6 +3,8 @@
 /* For C# source, see EntryPoint.cs */
 #define CURRENT_VERSION 8
 
+struct NativeFunctionTable;
+
 enum EntryPointFlags : int
 {
 	None = 0
@@ -22,4 +24,18 @@ public:
 	EntryPointParameters() = default;
 };
 
+/**
+ * What Bootstrap hands managed Init: the entry point parameters followed by
+ * what only the injector can fill in. Kept out of EntryPointParameters, which
+ * the launcher passes to LaunchInjected and StartClientPool as an array, so
+ * its layout never changes under an older launcher. Init tells whether the
+ * extra fields are there from the size it is given.
+ */
+struct InitParameters
+{
+public:
+	EntryPointParameters entry_point_parameters;
+	const NativeFunctionTable* native_functions { nullptr }; /* See NativeFunctionTable.h */
+};
+
 DEFINE_ENUM_FLAG_OPERATORS(EntryPointFlags);
\ No newline at end of file
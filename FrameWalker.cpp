@@ -0,0 +1,224 @@
+// FrameWalker.cpp
+#include "pch.h"
+#include "FrameWalker.h"
+
+// The committed part of a stack is one region running from the current stack
+// pointer up to the stack base, so a single query bounds the whole walk
+bool FrameWalker::getStackBounds(ULONG_PTR stackPointer, ULONG_PTR* low, ULONG_PTR* high) {
+    MEMORY_BASIC_INFORMATION mbi;
+    if (!VirtualQuery((LPCVOID)stackPointer, &mbi, sizeof(mbi))) {
+        return false;
+    }
+    if (mbi.State != MEM_COMMIT || (mbi.Protect & (PAGE_READWRITE | PAGE_EXECUTE_READWRITE)) == 0) {
+        return false;
+    }
+
+    *low = stackPointer;
+    *high = (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize;
+    return true;
+}
+
+#if defined(_M_X64) || defined(_M_ARM64)
+PRUNTIME_FUNCTION FrameWalker::lookupImageFunctionEntry(DWORD64 pc, DWORD64* imageBase, bool* inImage) {
+    *inImage = false;
+
+    // VirtualQuery is a plain syscall, no user mode lock behind it
+    MEMORY_BASIC_INFORMATION mbi;
+    if (!VirtualQuery((LPCVOID)pc, &mbi, sizeof(mbi)) || mbi.State != MEM_COMMIT || mbi.Type != MEM_IMAGE) {
+        return nullptr;
+    }
+
+    BYTE* base = (BYTE*)mbi.AllocationBase;
+    IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)base;
+    if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
+        return nullptr;
+    }
+    IMAGE_NT_HEADERS* ntHeaders = (IMAGE_NT_HEADERS*)(base + dosHeader->e_lfanew);
+    if (ntHeaders->Signature != IMAGE_NT_SIGNATURE) {
+        return nullptr;
+    }
+
+    *inImage = true;
+    *imageBase = (DWORD64)base;
+
+    const IMAGE_DATA_DIRECTORY& directory = ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+    if (directory.VirtualAddress == 0 || directory.Size < sizeof(RUNTIME_FUNCTION)) {
+        return nullptr;
+    }
+
+    PRUNTIME_FUNCTION functions = (PRUNTIME_FUNCTION)(base + directory.VirtualAddress);
+    size_t functionCount = directory.Size / sizeof(RUNTIME_FUNCTION);
+    DWORD rva = (DWORD)(pc - (DWORD64)base);
+
+    // .pdata is sorted by start address, find the last entry starting at or below the pc
+    size_t low = 0;
+    size_t high = functionCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (functions[middle].BeginAddress <= rva) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    if (low == 0) {
+        return nullptr;
+    }
+
+    PRUNTIME_FUNCTION function = &functions[low - 1];
+#if defined(_M_X64)
+    if (rva >= function->EndAddress) {
+        return nullptr;
+    }
+    // Indirect entry, points at the entry that holds the unwind data
+    if (function->UnwindData & 1) {
+        function = (PRUNTIME_FUNCTION)(base + (function->UnwindData & ~1UL));
+    }
+#else
+    // Length is in the packed entry itself or in the first word of the .xdata
+    DWORD length = (function->UnwindData & 3)
+        ? (function->UnwindData >> 2) & 0x7ff
+        : *(DWORD*)(base + function->UnwindData) & 0x3ffff;
+    if (rva >= function->BeginAddress + length * 4) {
+        return nullptr;
+    }
+#endif
+    return function;
+}
+#endif
+
+size_t FrameWalker::walk(const CONTEXT* context, DWORD64* pcs, DWORD64* sps, size_t capacity) {
+    return unwind(context, pcs, sps, capacity, false);
+}
+
+size_t FrameWalker::unwind(const CONTEXT* context, DWORD64* pcs, DWORD64* sps, size_t capacity, bool imagesOnly) {
+    size_t count = 0;
+    if (!context || !pcs || capacity == 0) {
+        return 0;
+    }
+
+#if defined(_M_IX86)
+    ULONG_PTR pc = context->Eip;
+    ULONG_PTR sp = context->Esp;
+    ULONG_PTR fp = context->Ebp;
+
+    ULONG_PTR low = 0;
+    ULONG_PTR high = 0;
+
+    pcs[count] = pc;
+    if (sps) sps[count] = sp;
+    count++;
+
+    if (!getStackBounds(sp, &low, &high)) {
+        return count;
+    }
+
+    // Each frame starts with [saved ebp][return address]
+    while (count < capacity) {
+        if (fp < low || fp > high - 2 * sizeof(ULONG_PTR) || (fp & (sizeof(ULONG_PTR) - 1)) != 0) {
+            break;
+        }
+
+        ULONG_PTR nextFp = ((ULONG_PTR*)fp)[0];
+        ULONG_PTR returnAddress = ((ULONG_PTR*)fp)[1];
+        if (returnAddress == 0) {
+            break;
+        }
+
+        pcs[count] = returnAddress;
+        if (sps) sps[count] = fp + 2 * sizeof(ULONG_PTR);
+        count++;
+
+        // The chain has to move towards the stack base or it's garbage
+        if (nextFp <= fp) {
+            break;
+        }
+        fp = nextFp;
+    }
+#elif defined(_M_X64) || defined(_M_ARM64)
+    CONTEXT current = *context;
+
+    while (count < capacity) {
+#if defined(_M_X64)
+        DWORD64 pc = current.Rip;
+        DWORD64 sp = current.Rsp;
+#else
+        DWORD64 pc = current.Pc;
+        DWORD64 sp = current.Sp;
+#endif
+        if (pc == 0) {
+            break;
+        }
+
+        pcs[count] = pc;
+        if (sps) sps[count] = sp;
+        count++;
+
+        DWORD64 imageBase = 0;
+        PRUNTIME_FUNCTION function = nullptr;
+        if (imagesOnly) {
+            // JIT code or a stub, can't be unwound without the dynamic function tables
+            bool inImage = false;
+            function = lookupImageFunctionEntry(pc, &imageBase, &inImage);
+            if (!inImage) {
+                break;
+            }
+        }
+        else {
+            function = RtlLookupFunctionEntry(pc, &imageBase, nullptr);
+        }
+
+        if (function) {
+            PVOID handlerData = nullptr;
+            DWORD64 establisherFrame = 0;
+            RtlVirtualUnwind(UNW_FLAG_NHANDLER, imageBase, pc, function, &current, &handlerData, &establisherFrame, nullptr);
+        }
+        else {
+            // Leaf function without unwind data, the return address is right there
+#if defined(_M_X64)
+            ULONG_PTR low = 0;
+            ULONG_PTR high = 0;
+            if (!getStackBounds((ULONG_PTR)sp, &low, &high) || sp > high - sizeof(DWORD64)) {
+                break;
+            }
+            current.Rip = *(DWORD64*)sp;
+            current.Rsp = sp + sizeof(DWORD64);
+#else
+            if (current.Lr == pc) {
+                break;
+            }
+            current.Pc = current.Lr;
+#endif
+        }
+
+#if defined(_M_X64)
+        DWORD64 nextPc = current.Rip;
+        DWORD64 nextSp = current.Rsp;
+#else
+        DWORD64 nextPc = current.Pc;
+        DWORD64 nextSp = current.Sp;
+#endif
+        // Unwinding must make progress up the stack
+        if (nextSp < sp || (nextSp == sp && nextPc == pc)) {
+            break;
+        }
+    }
+#else
+#error "Unsupported platform"
+#endif
+
+    return count;
+}
+
+size_t FrameWalker::walkThread(HANDLE hThread, DWORD64* pcs, DWORD64* sps, size_t capacity) {
+    CONTEXT context;
+    memset(&context, 0, sizeof(context));
+    context.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+
+    if (!GetThreadContext(hThread, &context)) {
+        return 0;
+    }
+
+    return unwind(&context, pcs, sps, capacity, true);
+}
@@ -0,0 +1,39 @@
+// FrameWalker.h
+#pragma once
+
+#include <Windows.h>
+
+// Upper bound for a single walk, callers size their arrays with this
+#define MAX_STACK_FRAMES 256
+
+// Raw native frame walker. Writes the pc and stack pointer of each frame into
+// caller provided arrays; it never allocates and never calls into dbghelp, so
+// it can run inside an exception handler.
+//
+// x86 follows the EBP chain, bounded by the committed stack region.
+// x64 and ARM64 unwind through the function tables (RtlVirtualUnwind). On
+// the current thread the lookup goes through RtlLookupFunctionEntry, which
+// also covers JIT code since the runtime registers its tables.
+//
+// RtlLookupFunctionEntry takes the loader's function table lock, which a
+// suspended thread may be holding, so walking another thread reads the
+// .pdata of the image the pc falls in directly instead. That takes no locks
+// but doesn't know about dynamic function tables: the walk stops at the first
+// frame outside an image.
+class FrameWalker {
+public:
+    // Walks from the given context. sps may be null. Returns the frame count.
+    static size_t walk(const CONTEXT* context, DWORD64* pcs, DWORD64* sps, size_t capacity);
+
+    // Walks another thread, which the caller must have suspended
+    static size_t walkThread(HANDLE hThread, DWORD64* pcs, DWORD64* sps, size_t capacity);
+
+private:
+    static size_t unwind(const CONTEXT* context, DWORD64* pcs, DWORD64* sps, size_t capacity, bool imagesOnly);
+    static bool getStackBounds(ULONG_PTR stackPointer, ULONG_PTR* low, ULONG_PTR* high);
+
+#if defined(_M_X64) || defined(_M_ARM64)
+    // Lock free function table lookup, inImage is false when pc isn't in a mapped image
+    static PRUNTIME_FUNCTION lookupImageFunctionEntry(DWORD64 pc, DWORD64* imageBase, bool* inImage);
+#endif
+};
@@ -0,0 +1,208 @@
+// HangWatchdog.cpp
+#include "pch.h"
+#include "HangWatchdog.h"
+#include "FrameWalker.h"
+#include "CrashHandler.h"
+#include "Telemetry.h"
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+// How often the watchdog looks at the heartbeat while things are healthy
+#define HANG_POLL_INTERVAL_MS 100
+
+HangWatchdog::HangWatchdog()
+    : m_heartbeat(0)
+    , m_heartbeatThreadId(0)
+    , m_thresholdMs(2000)
+    , m_sampleIntervalMs(10)
+    , m_thread(nullptr)
+    , m_stopEvent(nullptr)
+{
+}
+
+HangWatchdog::~HangWatchdog() {
+    stop();
+}
+
+bool HangWatchdog::start(const std::wstring& reportPath) {
+    if (m_thread) {
+        return true;
+    }
+
+    m_reportPath = reportPath;
+    if (!m_samples) {
+        m_samples.reset(new HangSample[HANG_MAX_SAMPLES]);
+    }
+
+    m_stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!m_stopEvent) {
+        return false;
+    }
+
+    m_thread = CreateThread(nullptr, 0, watchdogThreadProc, this, 0, nullptr);
+    if (!m_thread) {
+        CloseHandle(m_stopEvent);
+        m_stopEvent = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+void HangWatchdog::stop() {
+    if (!m_thread) {
+        return;
+    }
+
+    SetEvent(m_stopEvent);
+    WaitForSingleObject(m_thread, INFINITE);
+    CloseHandle(m_thread);
+    CloseHandle(m_stopEvent);
+    m_thread = nullptr;
+    m_stopEvent = nullptr;
+}
+
+void HangWatchdog::configure(DWORD thresholdMs, DWORD sampleIntervalMs) {
+    if (thresholdMs > 0) {
+        m_thresholdMs = thresholdMs;
+    }
+    if (sampleIntervalMs > 0) {
+        m_sampleIntervalMs = sampleIntervalMs;
+    }
+}
+
+DWORD WINAPI HangWatchdog::watchdogThreadProc(LPVOID param) {
+    ((HangWatchdog*)param)->run();
+    return 0;
+}
+
+void HangWatchdog::run() {
+    LONG lastValue = m_heartbeat;
+    ULONGLONG lastChange = GetTickCount64();
+    bool reported = false;
+
+    while (WaitForSingleObject(m_stopEvent, HANG_POLL_INTERVAL_MS) == WAIT_TIMEOUT) {
+        // Already awake on a steady tick, so it keeps the launcher's memory counters fresh too
+        Telemetry::getInstance().sampleProcess();
+
+        LONG value = m_heartbeat;
+        ULONGLONG now = GetTickCount64();
+
+        if (value != lastValue) {
+            lastValue = value;
+            lastChange = now;
+            reported = false;
+            continue;
+        }
+
+        // Not armed until the first heartbeat, and one report per stall
+        if (value == 0 || reported || now - lastChange < m_thresholdMs) {
+            continue;
+        }
+
+        size_t sampleCount = sampleStall(value);
+        if (sampleCount > 0) {
+            writeReport(sampleCount, GetTickCount64() - lastChange);
+        }
+        reported = true;
+    }
+}
+
+size_t HangWatchdog::sampleStall(LONG stalledValue) {
+    HANDLE hThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION, FALSE, (DWORD)m_heartbeatThreadId);
+    if (!hThread) {
+        return 0;
+    }
+
+    size_t count = 0;
+    while (count < HANG_MAX_SAMPLES && m_heartbeat == stalledValue) {
+        HangSample& sample = m_samples[count];
+        sample.depth = 0;
+
+        if (SuspendThread(hThread) != (DWORD)-1) {
+            sample.depth = (DWORD)FrameWalker::walkThread(hThread, sample.pcs, nullptr, HANG_MAX_DEPTH);
+            ResumeThread(hThread);
+        }
+
+        if (sample.depth > 0) {
+            count++;
+        }
+
+        if (WaitForSingleObject(m_stopEvent, m_sampleIntervalMs) != WAIT_TIMEOUT) {
+            break;
+        }
+    }
+
+    CloseHandle(hThread);
+    return count;
+}
+
+void HangWatchdog::writeReport(size_t sampleCount, ULONGLONG stallMs) {
+    // Rank the distinct stacks by how often the thread was caught in them
+    std::map<std::vector<DWORD64>, DWORD> stacks;
+    for (size_t i = 0; i < sampleCount; i++) {
+        std::vector<DWORD64> pcs(m_samples[i].pcs, m_samples[i].pcs + m_samples[i].depth);
+        stacks[pcs]++;
+    }
+
+    std::vector<std::pair<DWORD, const std::vector<DWORD64>*>> ranked;
+    std::vector<DWORD64> addresses;
+    for (const auto& stack : stacks) {
+        ranked.push_back(std::make_pair(stack.second, &stack.first));
+        addresses.insert(addresses.end(), stack.first.begin(), stack.first.end());
+    }
+    std::sort(ranked.begin(), ranked.end(),
+        [](const std::pair<DWORD, const std::vector<DWORD64>*>& a, const std::pair<DWORD, const std::vector<DWORD64>*>& b) { return a.first > b.first; });
+
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+    CrashHandler& crashHandler = CrashHandler::getInstance();
+    std::vector<std::string> symbols;
+    if (crashHandler.ensureSymbols()) {
+        symbols = crashHandler.resolveSymbols(addresses);
+    }
+
+    std::wstring path = m_reportPath + L"hang-" + std::to_wstring(GetCurrentProcessId()) + L"-" + FormatReportTimestamp() + L".txt";
+    std::ofstream report(path);
+    if (!report) {
+        return;
+    }
+
+    report << "Hang detected on thread " << (DWORD)m_heartbeatThreadId << "\r\n"
+        << "Heartbeat stalled for at least " << stallMs << " ms\r\n"
+        << "Samples: " << sampleCount << " every " << m_sampleIntervalMs << " ms\r\n\r\n";
+
+    for (const auto& entry : ranked) {
+        report << entry.first << " of " << sampleCount << " samples:\r\n";
+
+        int frameNum = 0;
+        for (DWORD64 pc : *entry.second) {
+            report << "  #" << frameNum++ << ": ";
+
+            auto it = std::lower_bound(addresses.begin(), addresses.end(), pc);
+            size_t index = it - addresses.begin();
+            if (index < symbols.size()) {
+                report << symbols[index];
+            }
+            else {
+                report << "0x" << std::hex << pc << std::dec;
+            }
+            report << "\r\n";
+        }
+        report << "\r\n";
+    }
+}
+
+// Exports for managed code, Heartbeat is meant to be called once per frame
+extern "C" __declspec(dllexport) void Heartbeat() {
+    HangWatchdog::getInstance().heartbeat();
+    Telemetry::getInstance().frame();
+}
+
+extern "C" __declspec(dllexport) void ConfigureHangWatchdog(int thresholdMs, int sampleIntervalMs) {
+    HangWatchdog::getInstance().configure(thresholdMs > 0 ? (DWORD)thresholdMs : 0, sampleIntervalMs > 0 ? (DWORD)sampleIntervalMs : 0);
+}
@@ -0,0 +1,73 @@
+// HangWatchdog.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <memory>
+
+// Stack samples kept per hang, at the default interval that's two seconds of stall
+#define HANG_MAX_SAMPLES 200
+
+// Deepest stack kept per hang sample
+#define HANG_MAX_DEPTH 64
+
+// Watches a heartbeat counter that managed code bumps once per frame/tick.
+// When it stops moving for longer than the threshold, the heartbeat thread is
+// sampled every few milliseconds until it recovers (or the sample buffer is
+// full) and a hang report with the ranked stacks is written next to the
+// crash reports.
+class HangWatchdog {
+public:
+    static HangWatchdog& getInstance() {
+        static HangWatchdog instance;
+        return instance;
+    }
+
+    bool start(const std::wstring& reportPath);
+    void stop();
+
+    void configure(DWORD thresholdMs, DWORD sampleIntervalMs);
+
+    // Called from the watched thread, the first caller becomes the watched thread
+    void heartbeat() {
+        if (m_heartbeatThreadId == 0) {
+            InterlockedCompareExchange(&m_heartbeatThreadId, (LONG)GetCurrentThreadId(), 0);
+        }
+        InterlockedIncrement(&m_heartbeat);
+    }
+
+private:
+    struct HangSample {
+        DWORD depth;
+        DWORD64 pcs[HANG_MAX_DEPTH];
+    };
+
+    HangWatchdog();
+    ~HangWatchdog();
+
+    // No copy or move
+    HangWatchdog(const HangWatchdog&) = delete;
+    HangWatchdog& operator=(const HangWatchdog&) = delete;
+    HangWatchdog(HangWatchdog&&) = delete;
+    HangWatchdog& operator=(HangWatchdog&&) = delete;
+
+    static DWORD WINAPI watchdogThreadProc(LPVOID param);
+    void run();
+    size_t sampleStall(LONG stalledValue);
+    void writeReport(size_t sampleCount, ULONGLONG stallMs);
+
+    volatile LONG m_heartbeat;
+    volatile LONG m_heartbeatThreadId;
+
+    std::wstring m_reportPath;
+    DWORD m_thresholdMs;
+    DWORD m_sampleIntervalMs;
+
+    std::unique_ptr<HangSample[]> m_samples;
+
+    HANDLE m_thread;
+    HANDLE m_stopEvent;
+};
+
+extern "C" __declspec(dllexport) void Heartbeat();
+extern "C" __declspec(dllexport) void ConfigureHangWatchdog(int thresholdMs, int sampleIntervalMs);
@@ -0,0 +1,27 @@
+// Hash.h
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64-bit FNV-1a. Stable across runs and builds, so its values can key files
+// on disk (crash buckets, the signature cache).
+#define HASH_FNV1A_OFFSET_BASIS 14695981039346656037ULL
+#define HASH_FNV1A_PRIME 1099511628211ULL
+
+class Hash {
+public:
+    // Continues `hash` over the bytes, start from HASH_FNV1A_OFFSET_BASIS
+    static uint64_t fnv1a(uint64_t hash, const void* data, size_t length) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < length; i++) {
+            hash ^= bytes[i];
+            hash *= HASH_FNV1A_PRIME;
+        }
+        return hash;
+    }
+
+    static uint64_t fnv1a(const void* data, size_t length) {
+        return fnv1a(HASH_FNV1A_OFFSET_BASIS, data, length);
+    }
+};
@@ -0,0 +1,555 @@
+// HookEngine.cpp
+#include "pch.h"
+#include "HookEngine.h"
+#include "InstructionDecoder.h"
+#include "MemoryMap.h"
+#include "Threads.h"
+
+#if defined(_M_X64)
+#define HOOK_IS_64BIT true
+#define HOOK_RELAY_SIZE 14 // jmp [rip+0] followed by the absolute address
+#elif defined(_M_IX86)
+#define HOOK_IS_64BIT false
+#define HOOK_RELAY_SIZE 0
+#endif
+
+HookEngine::HookEngine()
+    : m_transactionThreadId(0)
+{
+}
+
+HookEngine::~HookEngine() {
+    // Hooks are left in place, the process is going away with the code they point at
+}
+
+bool HookEngine::isWithinRel32(const BYTE* from, const BYTE* to) {
+#if defined(_M_X64)
+    // Leave room for the block, so anything inside it is in reach
+    LONGLONG distance = (LONGLONG)to - (LONGLONG)from;
+    return distance > -0x7FF00000LL && distance < 0x7FF00000LL;
+#else
+    return true;
+#endif
+}
+
+BYTE* HookEngine::allocateBlockNear(BYTE* target) {
+#if defined(_M_X64)
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    ULONG_PTR minAddress = (ULONG_PTR)systemInfo.lpMinimumApplicationAddress;
+    ULONG_PTR maxAddress = (ULONG_PTR)systemInfo.lpMaximumApplicationAddress;
+    ULONG_PTR reach = 0x7FF00000 - HOOK_BLOCK_SIZE;
+    ULONG_PTR origin = (ULONG_PTR)target;
+
+    if (origin > minAddress + reach) minAddress = origin - reach;
+    if (origin + reach < maxAddress) maxAddress = origin + reach;
+
+    // The map can be stale, if somebody took the spot since, refresh around it and try again
+    MemoryMap& memoryMap = MemoryMap::getInstance();
+    for (int attempt = 0; attempt < 8; attempt++) {
+        ULONG_PTR address = memoryMap.findFree(origin, HOOK_BLOCK_SIZE, minAddress, maxAddress);
+        if (!address) {
+            return nullptr;
+        }
+
+        void* block = VirtualAlloc((LPVOID)address, HOOK_BLOCK_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+        memoryMap.refresh(address, HOOK_BLOCK_SIZE);
+        if (block) {
+            return (BYTE*)block;
+        }
+    }
+
+    return nullptr;
+#else
+    return (BYTE*)VirtualAlloc(nullptr, HOOK_BLOCK_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+#endif
+}
+
+BYTE* HookEngine::allocateTrampoline(BYTE* target) {
+    for (auto& block : m_blocks) {
+        if (!block.freeSlots.empty() && isWithinRel32(target, block.base) && isWithinRel32(target, block.base + HOOK_BLOCK_SIZE)) {
+            BYTE* slot = block.freeSlots.back();
+            block.freeSlots.pop_back();
+            return slot;
+        }
+    }
+
+    BYTE* base = allocateBlockNear(target);
+    if (!base) {
+        return nullptr;
+    }
+
+    TrampolineBlock block;
+    block.base = base;
+    for (size_t offset = HOOK_BLOCK_SIZE; offset >= HOOK_TRAMPOLINE_SIZE * 2; offset -= HOOK_TRAMPOLINE_SIZE) {
+        block.freeSlots.push_back(base + offset - HOOK_TRAMPOLINE_SIZE);
+    }
+    m_blocks.push_back(block);
+    return base;
+}
+
+void HookEngine::freeTrampoline(BYTE* trampoline) {
+    for (auto& block : m_blocks) {
+        if (trampoline >= block.base && trampoline < block.base + HOOK_BLOCK_SIZE) {
+            // Anything still jumping in here should stop hard, not run stale code
+            memset(trampoline, 0xCC, HOOK_TRAMPOLINE_SIZE);
+            block.freeSlots.push_back(trampoline);
+            return;
+        }
+    }
+}
+
+static void writeRel32(BYTE* at, const BYTE* nextInstruction, const BYTE* destination) {
+    LONG relative = (LONG)((LONG_PTR)destination - (LONG_PTR)nextInstruction);
+    memcpy(at, &relative, sizeof(relative));
+}
+
+int HookEngine::prepareHook(BYTE* target, void* detour, Hook* hook) {
+#if !defined(_M_IX86) && !defined(_M_X64)
+    return HOOK_STATUS_UNSUPPORTED_INSTRUCTION;
+#else
+    // Re-query just the target's allocation, it may have been mapped since the last snapshot
+    MemoryMap& memoryMap = MemoryMap::getInstance();
+    MemoryRegion region;
+    memoryMap.refresh((ULONG_PTR)target, HOOK_PATCH_SIZE);
+    if (!memoryMap.query((ULONG_PTR)target, &region) || !MemoryMap::isExecutable(region)) {
+        return HOOK_STATUS_NOT_EXECUTABLE;
+    }
+
+    BYTE* trampoline = allocateTrampoline(target);
+    if (!trampoline) {
+        return HOOK_STATUS_OUT_OF_MEMORY;
+    }
+
+    hook->target = target;
+    hook->detour = detour;
+    hook->trampoline = trampoline;
+
+    // Copy whole instructions until the patch fits, fixing up anything relative
+    size_t offset = 0;
+    size_t out = 0;
+    BYTE count = 0;
+    const BYTE* branchTargets[HOOK_MAX_INSTRUCTIONS];
+    BYTE branchCount = 0;
+    int status = HOOK_STATUS_OK;
+
+    while (offset < HOOK_PATCH_SIZE) {
+        DecodedInstruction instruction;
+        BYTE* source = target + offset;
+        size_t length = InstructionDecoder::decode(source, INSTRUCTION_MAX_LENGTH, HOOK_IS_64BIT, &instruction);
+        if (length == 0) {
+            status = HOOK_STATUS_UNSUPPORTED_INSTRUCTION;
+            break;
+        }
+
+        // Function ends before there's room for the patch
+        bool terminates = (instruction.flags & (INSTRUCTION_FLAG_RETURN | INSTRUCTION_FLAG_JUMP)) != 0;
+        if (terminates && offset + length < HOOK_PATCH_SIZE) {
+            status = HOOK_STATUS_UNSUPPORTED_INSTRUCTION;
+            break;
+        }
+
+        BYTE* destination = trampoline + out;
+        const BYTE* next = source + length;
+        size_t written = 0;
+
+        if (instruction.flags & INSTRUCTION_FLAG_REL8) {
+            const BYTE* branchTarget = next + (signed char)source[instruction.relOffset];
+            BYTE opcode = instruction.opcode;
+
+            if (opcode == 0xEB) {
+                destination[0] = 0xE9;
+                writeRel32(destination + 1, destination + 5, branchTarget);
+                written = 5;
+            }
+            else if (opcode >= 0x70 && opcode <= 0x7F) {
+                destination[0] = 0x0F;
+                destination[1] = 0x80 | (opcode & 0x0F);
+                writeRel32(destination + 2, destination + 6, branchTarget);
+                written = 6;
+            }
+            else {
+                // jcxz / loop only come in rel8
+                status = HOOK_STATUS_UNSUPPORTED_INSTRUCTION;
+                break;
+            }
+            branchTargets[branchCount++] = branchTarget;
+        }
+        else if (instruction.flags & INSTRUCTION_FLAG_REL32) {
+            LONG relative;
+            memcpy(&relative, source + instruction.relOffset, sizeof(relative));
+            const BYTE* branchTarget = next + relative;
+            if (!isWithinRel32(destination + length, branchTarget)) {
+                status = HOOK_STATUS_UNSUPPORTED_INSTRUCTION;
+                break;
+            }
+
+            memcpy(destination, source, length);
+            writeRel32(destination + instruction.relOffset, destination + length, branchTarget);
+            written = length;
+            branchTargets[branchCount++] = branchTarget;
+        }
+        else if (instruction.flags & INSTRUCTION_FLAG_RIP_RELATIVE) {
+            LONG displacement;
+            memcpy(&displacement, source + instruction.dispOffset, sizeof(displacement));
+            const BYTE* operand = next + displacement;
+            if (!isWithinRel32(destination + length, operand)) {
+                status = HOOK_STATUS_UNSUPPORTED_INSTRUCTION;
+                break;
+            }
+
+            memcpy(destination, source, length);
+            writeRel32(destination + instruction.dispOffset, destination + length, operand);
+            written = length;
+        }
+        else {
+            memcpy(destination, source, length);
+            written = length;
+        }
+
+        hook->oldOffsets[count] = (BYTE)offset;
+        hook->newOffsets[count] = (BYTE)out;
+        count++;
+        offset += length;
+        out += written;
+
+        if (out + HOOK_PATCH_SIZE + HOOK_RELAY_SIZE > HOOK_TRAMPOLINE_SIZE) {
+            status = HOOK_STATUS_UNSUPPORTED_INSTRUCTION;
+            break;
+        }
+    }
+
+    // A branch back into the bytes we're about to overwrite can't be redirected
+    for (BYTE i = 0; status == HOOK_STATUS_OK && i < branchCount; i++) {
+        if (branchTargets[i] > target && branchTargets[i] < target + offset) {
+            status = HOOK_STATUS_UNSUPPORTED_INSTRUCTION;
+        }
+    }
+
+    if (status != HOOK_STATUS_OK) {
+        freeTrampoline(trampoline);
+        hook->trampoline = nullptr;
+        return status;
+    }
+
+    // Back to the rest of the original function
+    BYTE* jumpBack = trampoline + out;
+    jumpBack[0] = 0xE9;
+    writeRel32(jumpBack + 1, jumpBack + 5, target + offset);
+
+#if defined(_M_X64)
+    // The detour may be anywhere, the patch jumps here and this goes the rest of the way
+    BYTE* relay = jumpBack + 5;
+    relay[0] = 0xFF;
+    relay[1] = 0x25;
+    memset(relay + 2, 0, 4);
+    memcpy(relay + 6, &detour, sizeof(detour));
+    hook->relay = relay;
+#else
+    hook->relay = (BYTE*)detour;
+#endif
+
+    memcpy(hook->original, target, offset);
+    hook->stolenLength = (BYTE)offset;
+    hook->relocatedLength = (BYTE)out;
+    hook->instructionCount = count;
+
+    FlushInstructionCache(GetCurrentProcess(), trampoline, HOOK_TRAMPOLINE_SIZE);
+    return HOOK_STATUS_OK;
+#endif
+}
+
+// Both of these run with every other thread frozen: no allocations
+bool HookEngine::writePatch(Hook* hook) {
+    DWORD oldProtect = 0;
+    if (!VirtualProtect(hook->target, hook->stolenLength, PAGE_EXECUTE_READWRITE, &oldProtect)) {
+        return false;
+    }
+
+    hook->target[0] = 0xE9;
+    writeRel32(hook->target + 1, hook->target + HOOK_PATCH_SIZE, hook->relay);
+
+    VirtualProtect(hook->target, hook->stolenLength, oldProtect, &oldProtect);
+    FlushInstructionCache(GetCurrentProcess(), hook->target, hook->stolenLength);
+    return true;
+}
+
+bool HookEngine::restoreOriginal(Hook* hook) {
+    DWORD oldProtect = 0;
+    if (!VirtualProtect(hook->target, hook->stolenLength, PAGE_EXECUTE_READWRITE, &oldProtect)) {
+        return false;
+    }
+
+    memcpy(hook->target, hook->original, hook->stolenLength);
+
+    VirtualProtect(hook->target, hook->stolenLength, oldProtect, &oldProtect);
+    FlushInstructionCache(GetCurrentProcess(), hook->target, hook->stolenLength);
+    return true;
+}
+
+void HookEngine::moveThreadIp(HANDLE hThread, const std::vector<PendingChange>& changes) {
+#if defined(_M_IX86) || defined(_M_X64)
+    CONTEXT context;
+    context.ContextFlags = CONTEXT_CONTROL;
+    if (!GetThreadContext(hThread, &context)) {
+        return;
+    }
+
+#if defined(_M_X64)
+    BYTE* ip = (BYTE*)context.Rip;
+#else
+    BYTE* ip = (BYTE*)context.Eip;
+#endif
+    BYTE* newIp = ip;
+
+    for (const auto& change : changes) {
+        const Hook* hook = change.hook;
+        if (!change.applied) {
+            continue;
+        }
+
+        if (change.install && ip >= hook->target && ip < hook->target + hook->stolenLength) {
+            // Caught inside the bytes we just overwrote, carry on in the trampoline
+            for (BYTE i = 0; i < hook->instructionCount; i++) {
+                if (hook->target + hook->oldOffsets[i] == ip) {
+                    newIp = hook->trampoline + hook->newOffsets[i];
+                }
+            }
+        }
+        else if (!change.install && ip >= hook->trampoline && ip <= hook->trampoline + hook->relocatedLength) {
+            // Running the relocated copy of a hook going away, back to the original bytes
+            if (ip == hook->trampoline + hook->relocatedLength) {
+                newIp = hook->target + hook->stolenLength;
+            }
+            for (BYTE i = 0; i < hook->instructionCount; i++) {
+                if (hook->trampoline + hook->newOffsets[i] == ip) {
+                    newIp = hook->target + hook->oldOffsets[i];
+                }
+            }
+        }
+#if defined(_M_X64)
+        else if (!change.install && ip >= hook->relay && ip < hook->relay + HOOK_RELAY_SIZE) {
+            // About to take the relay we're freeing, it was headed for the detour anyway
+            newIp = (BYTE*)hook->detour;
+        }
+#endif
+    }
+
+    if (newIp != ip) {
+#if defined(_M_X64)
+        context.Rip = (DWORD64)newIp;
+#else
+        context.Eip = (DWORD)newIp;
+#endif
+        SetThreadContext(hThread, &context);
+    }
+#endif
+}
+
+int HookEngine::commitLocked() {
+    if (m_pending.empty()) {
+        return HOOK_STATUS_OK;
+    }
+
+    std::vector<PendingChange> changes;
+    changes.swap(m_pending);
+
+    // Make room up front, nothing may touch the heap while threads are frozen
+    m_hooks.reserve(m_hooks.size() + changes.size());
+
+    HANDLE threads[HOOK_MAX_THREADS];
+    int suspended = 0;
+    Threads::forEachOther([&](DWORD threadId) {
+        HANDLE hThread = Threads::suspend(threadId, THREAD_GET_CONTEXT | THREAD_SET_CONTEXT | THREAD_QUERY_INFORMATION);
+        if (hThread) {
+            threads[suspended++] = hThread;
+        }
+        return suspended < HOOK_MAX_THREADS;
+    });
+
+    // Everyone is frozen, patch the whole batch at once
+    for (auto& change : changes) {
+        change.applied = change.install ? writePatch(change.hook) : restoreOriginal(change.hook);
+    }
+
+    for (int i = 0; i < suspended; i++) {
+        moveThreadIp(threads[i], changes);
+    }
+
+    for (int i = 0; i < suspended; i++) {
+        Threads::resume(threads[i]);
+    }
+
+    int status = HOOK_STATUS_OK;
+    for (auto& change : changes) {
+        Hook* hook = change.hook;
+        if (!change.applied) {
+            status = HOOK_STATUS_PROTECT_FAILED;
+            if (change.install) {
+                freeTrampoline(hook->trampoline);
+                delete hook;
+            }
+            continue;
+        }
+
+        if (change.install) {
+            hook->installed = true;
+            m_hooks.push_back(hook);
+        }
+        else {
+            for (auto it = m_hooks.begin(); it != m_hooks.end(); ++it) {
+                if (*it == hook) {
+                    m_hooks.erase(it);
+                    break;
+                }
+            }
+            freeTrampoline(hook->trampoline);
+            delete hook;
+        }
+    }
+
+    return status;
+}
+
+HookEngine::Hook* HookEngine::findHook(void* target) {
+    for (Hook* hook : m_hooks) {
+        if (hook->target == target) {
+            return hook;
+        }
+    }
+    return nullptr;
+}
+
+bool HookEngine::isQueued(void* target) {
+    for (const auto& change : m_pending) {
+        if (change.hook->target == target) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int HookEngine::beginTransaction() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_transactionThreadId) {
+        return HOOK_STATUS_TRANSACTION_BUSY;
+    }
+    m_transactionThreadId = GetCurrentThreadId();
+    return HOOK_STATUS_OK;
+}
+
+int HookEngine::commitTransaction() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_transactionThreadId != GetCurrentThreadId()) {
+        return HOOK_STATUS_NO_TRANSACTION;
+    }
+
+    int status = commitLocked();
+    m_transactionThreadId = 0;
+    return status;
+}
+
+void HookEngine::abortTransaction() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_transactionThreadId != GetCurrentThreadId()) {
+        return;
+    }
+
+    for (const auto& change : m_pending) {
+        if (change.install) {
+            freeTrampoline(change.hook->trampoline);
+            delete change.hook;
+        }
+    }
+    m_pending.clear();
+    m_transactionThreadId = 0;
+}
+
+int HookEngine::createHook(void* target, void* detour, void** original) {
+    if (!target || !detour) {
+        return HOOK_STATUS_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool inTransaction = m_transactionThreadId == GetCurrentThreadId();
+    if (m_transactionThreadId && !inTransaction) {
+        return HOOK_STATUS_TRANSACTION_BUSY;
+    }
+
+    if (findHook(target) || isQueued(target)) {
+        return HOOK_STATUS_ALREADY_HOOKED;
+    }
+
+    Hook* hook = new Hook();
+    memset(hook, 0, sizeof(Hook));
+    int status = prepareHook((BYTE*)target, detour, hook);
+    if (status != HOOK_STATUS_OK) {
+        delete hook;
+        return status;
+    }
+
+    // Valid before the patch goes live, the detour may run the moment we commit
+    if (original) {
+        *original = hook->trampoline;
+    }
+
+    PendingChange change = { true, false, hook };
+    m_pending.push_back(change);
+    return inTransaction ? HOOK_STATUS_OK : commitLocked();
+}
+
+int HookEngine::removeHook(void* target) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool inTransaction = m_transactionThreadId == GetCurrentThreadId();
+    if (m_transactionThreadId && !inTransaction) {
+        return HOOK_STATUS_TRANSACTION_BUSY;
+    }
+
+    // Created and removed in the same transaction, it never went live
+    for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+        if (it->hook->target == target && it->install) {
+            freeTrampoline(it->hook->trampoline);
+            delete it->hook;
+            m_pending.erase(it);
+            return HOOK_STATUS_OK;
+        }
+        if (it->hook->target == target) {
+            return HOOK_STATUS_NOT_HOOKED;
+        }
+    }
+
+    Hook* hook = findHook(target);
+    if (!hook) {
+        return HOOK_STATUS_NOT_HOOKED;
+    }
+
+    PendingChange change = { false, false, hook };
+    m_pending.push_back(change);
+    return inTransaction ? HOOK_STATUS_OK : commitLocked();
+}
+
+bool HookEngine::isHooked(void* target) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return findHook(target) != nullptr;
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) int HookBeginTransaction() {
+    return HookEngine::getInstance().beginTransaction();
+}
+
+extern "C" __declspec(dllexport) int HookCommitTransaction() {
+    return HookEngine::getInstance().commitTransaction();
+}
+
+extern "C" __declspec(dllexport) void HookAbortTransaction() {
+    HookEngine::getInstance().abortTransaction();
+}
+
+extern "C" __declspec(dllexport) int HookCreate(void* target, void* detour, void** original) {
+    return HookEngine::getInstance().createHook(target, detour, original);
+}
+
+extern "C" __declspec(dllexport) int HookRemove(void* target) {
+    return HookEngine::getInstance().removeHook(target);
+}
@@ -0,0 +1,127 @@
+// HookEngine.h
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+#include <mutex>
+
+// Status codes returned by the hook exports
+#define HOOK_STATUS_OK                      0
+#define HOOK_STATUS_INVALID_ARGUMENT        1
+#define HOOK_STATUS_ALREADY_HOOKED          2
+#define HOOK_STATUS_NOT_HOOKED              3
+#define HOOK_STATUS_NOT_EXECUTABLE          4
+#define HOOK_STATUS_UNSUPPORTED_INSTRUCTION 5
+#define HOOK_STATUS_OUT_OF_MEMORY           6
+#define HOOK_STATUS_NO_TRANSACTION          7
+#define HOOK_STATUS_TRANSACTION_BUSY        8
+#define HOOK_STATUS_PROTECT_FAILED          9
+
+// Size of the patch written over the target: jmp rel32
+#define HOOK_PATCH_SIZE 5
+
+// Worst case of the instructions moved out of the target: up to four bytes
+// short of the patch, plus one full length instruction
+#define HOOK_MAX_STOLEN (HOOK_PATCH_SIZE - 1 + 15)
+#define HOOK_MAX_INSTRUCTIONS HOOK_MAX_STOLEN
+
+// One trampoline slot: relocated code, the jump back, and (x64) a relay to the detour
+#define HOOK_TRAMPOLINE_SIZE 128
+
+// Trampolines are carved out of blocks this size, within rel32 reach of their targets
+#define HOOK_BLOCK_SIZE (64 * 1024)
+
+// Most threads frozen while a batch is applied
+#define HOOK_MAX_THREADS 1024
+
+// Inline hooks with transactional, batched install and removal.
+//
+// Hooks are queued between beginTransaction and commitTransaction, which
+// freezes the other threads once, writes every patch, moves any thread caught
+// inside patched bytes to the matching spot in the trampoline (or back, on
+// removal) and lets them go. Trampolines are built before threads are frozen,
+// so nothing allocates while another thread might be holding the heap lock.
+//
+// Removing a hook frees its trampoline: the caller has to make sure nobody is
+// still running through the detour's call to the original.
+class HookEngine {
+public:
+    static HookEngine& getInstance() {
+        static HookEngine instance;
+        return instance;
+    }
+
+    int beginTransaction();
+    int commitTransaction();
+    void abortTransaction();
+
+    // Outside a transaction these commit immediately. `original` receives the
+    // trampoline that calls the unhooked function.
+    int createHook(void* target, void* detour, void** original);
+    int removeHook(void* target);
+
+    bool isHooked(void* target);
+
+private:
+    struct Hook {
+        BYTE* target;
+        void* detour;
+        BYTE* trampoline;
+        BYTE* relay;                        // jump the patch lands on, the detour itself on x86
+        BYTE original[HOOK_MAX_STOLEN];
+        BYTE stolenLength;
+        BYTE relocatedLength;
+        BYTE instructionCount;
+        BYTE oldOffsets[HOOK_MAX_INSTRUCTIONS];
+        BYTE newOffsets[HOOK_MAX_INSTRUCTIONS];
+        bool installed;
+    };
+
+    struct TrampolineBlock {
+        BYTE* base;
+        std::vector<BYTE*> freeSlots;
+    };
+
+    struct PendingChange {
+        bool install;
+        bool applied;
+        Hook* hook;
+    };
+
+    HookEngine();
+    ~HookEngine();
+
+    // No copy or move
+    HookEngine(const HookEngine&) = delete;
+    HookEngine& operator=(const HookEngine&) = delete;
+    HookEngine(HookEngine&&) = delete;
+    HookEngine& operator=(HookEngine&&) = delete;
+
+    // Everything below expects m_mutex to be held
+    int prepareHook(BYTE* target, void* detour, Hook* hook);
+    int commitLocked();
+    Hook* findHook(void* target);
+    bool isQueued(void* target);
+
+    BYTE* allocateTrampoline(BYTE* target);
+    void freeTrampoline(BYTE* trampoline);
+    static BYTE* allocateBlockNear(BYTE* target);
+    static bool isWithinRel32(const BYTE* from, const BYTE* to);
+
+    bool writePatch(Hook* hook);
+    bool restoreOriginal(Hook* hook);
+    void moveThreadIp(HANDLE hThread, const std::vector<PendingChange>& changes);
+
+    std::vector<Hook*> m_hooks;
+    std::vector<PendingChange> m_pending;
+    std::vector<TrampolineBlock> m_blocks;
+    DWORD m_transactionThreadId;
+    std::mutex m_mutex;
+};
+
+// Exports for managed code
+extern "C" __declspec(dllexport) int HookBeginTransaction();
+extern "C" __declspec(dllexport) int HookCommitTransaction();
+extern "C" __declspec(dllexport) void HookAbortTransaction();
+extern "C" __declspec(dllexport) int HookCreate(void* target, void* detour, void** original);
+extern "C" __declspec(dllexport) int HookRemove(void* target);
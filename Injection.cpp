@@ -0,0 +1,121 @@
+// Injection.cpp
+#include "pch.h"
+#include "Injection.h"
+#include "CrashMonitor.h"
+#include "Utf.h"
+#include <memory>
+
+// Function to inject a payload and execute it remotely
+DWORD __fastcall InjectPayloadAndExecute(HANDLE hProcess, LPTHREAD_START_ROUTINE lpStartAddress, LPCVOID lpBuffer, SIZE_T dwSize, const wchar_t** error) {
+    void* allocatedMemory = nullptr;
+    HANDLE remoteThread;
+    DWORD exitCode = 0;
+
+    if (lpBuffer && dwSize) {
+        allocatedMemory = VirtualAllocEx(hProcess, nullptr, dwSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (allocatedMemory) {
+            WriteProcessMemory(hProcess, allocatedMemory, lpBuffer, dwSize, nullptr);
+        }
+        else {
+            DWORD lastError = GetLastError();
+            if (error) {
+                *error = L"Failed to inject payload";
+            }
+            else {
+                MessageBoxA(nullptr, "Failed to Inject Payload.", "Failed", MB_OK);
+            }
+            return lastError;
+        }
+    }
+
+    remoteThread = CreateRemoteThread(hProcess, nullptr, 0, lpStartAddress, allocatedMemory, 0, nullptr);
+    if (remoteThread) {
+        WaitForSingleObject(remoteThread, INFINITE);
+        GetExitCodeThread(remoteThread, &exitCode);
+    }
+    else {
+        DWORD lastError = GetLastError();
+        if (allocatedMemory) {
+            VirtualFreeEx(hProcess, allocatedMemory, 0, MEM_RELEASE);
+        }
+        if (error) {
+            *error = L"Failed to create remote thread";
+        }
+        else {
+            MessageBoxA(nullptr, "Failed to create remote thread.", "Failed", MB_OK);
+        }
+        return lastError;
+    }
+
+    if (allocatedMemory) {
+        VirtualFreeEx(hProcess, allocatedMemory, 0, MEM_RELEASE);
+    }
+
+    if (remoteThread) {
+        CloseHandle(remoteThread);
+    }
+
+    return exitCode;
+}
+
+bool CreateSuspendedClient(const wchar_t* commandLine, LPCWSTR currentDirectory, PROCESS_INFORMATION* processInfo) {
+    STARTUPINFOW startupInfo = { sizeof(STARTUPINFOW) };
+
+    // CreateProcessW may write to the command line
+    size_t length = wcslen(commandLine) + 1;
+    std::unique_ptr<wchar_t[]> cmdLine(new wchar_t[length]);
+    wcscpy_s(cmdLine.get(), length, commandLine);
+
+    if (!CreateProcessW(nullptr, cmdLine.get(), nullptr, nullptr, FALSE, CREATE_SUSPENDED, nullptr, currentDirectory, &startupInfo, processInfo)) {
+        return false;
+    }
+
+    // Set up the crash channel before the client gets a chance to run
+    if (CrashMonitor::getInstance().isRunning()) {
+        CrashMonitor::getInstance().watch(processInfo->hProcess, processInfo->dwProcessId);
+    }
+    return true;
+}
+
+bool InjectLibrary(HANDLE hProcess, const EntryPointParameters& parameters, InjectedLibrary* library, const wchar_t** error) {
+    library->entryPoint = nullptr;
+    library->prewarm = nullptr;
+
+    HMODULE kernelModule = GetModuleHandleW(L"kernel32.dll");
+    if (!kernelModule) {
+        *error = L"Failed to load kernel32.dll";
+        return false;
+    }
+    auto loadLibraryW = reinterpret_cast<HMODULE(__stdcall*)(LPCWSTR)>(GetProcAddress(kernelModule, "LoadLibraryW"));
+
+    wchar_t* injectedLibName = parameters.dll_path;
+    const wchar_t* injectError = nullptr;
+    InjectPayloadAndExecute(hProcess, (LPTHREAD_START_ROUTINE)loadLibraryW, injectedLibName, 2 * wcslen(injectedLibName), &injectError);
+    if (injectError) {
+        *error = injectError;
+        return false;
+    }
+    HMODULE loadedLibrary = ::LoadLibraryW(injectedLibName);
+    if (!loadedLibrary) {
+        *error = L"Failed to load library";
+        return false;
+    }
+
+    // Export names are plain ASCII, anything that doesn't fit can't be one
+    char procName[256];
+    if (Utf::toUtf8(parameters.entry_point, procName) < 0) {
+        *error = L"Entry point name too long";
+        FreeLibrary(loadedLibrary);
+        return false;
+    }
+
+    library->entryPoint = (LPTHREAD_START_ROUTINE)GetProcAddress(loadedLibrary, procName);
+    library->prewarm = (LPTHREAD_START_ROUTINE)GetProcAddress(loadedLibrary, INJECTED_PREWARM_EXPORT);
+    FreeLibrary(loadedLibrary);
+
+    if (!library->entryPoint) {
+        *error = L"Entry point not found";
+        return false;
+    }
+    return true;
+}
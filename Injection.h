@@ -0,0 +1,29 @@
+// Injection.h
+#pragma once
+
+#include <Windows.h>
+#include "EntryPointParameter.h"
+
+// Optional export an injected library can provide. The client pool runs it
+// while the client is still suspended, ahead of the library's entry point.
+#define INJECTED_PREWARM_EXPORT "Prewarm"
+
+// A library loaded into a client. The exports are resolved in our own copy
+// of it, system and our libraries share a base across processes of a session.
+struct InjectedLibrary {
+    LPTHREAD_START_ROUTINE entryPoint;
+    LPTHREAD_START_ROUTINE prewarm;     // null when the library has none
+};
+
+// Copies lpBuffer into the process, if given, and runs lpStartAddress on a
+// remote thread with it. Returns the thread's exit code, or the last error
+// if it couldn't be started. Failures are shown in a message box unless
+// `error` is given, then it says what went wrong and nothing is shown.
+DWORD __fastcall InjectPayloadAndExecute(HANDLE hProcess, LPTHREAD_START_ROUTINE lpStartAddress, LPCVOID lpBuffer, SIZE_T dwSize, const wchar_t** error = nullptr);
+
+// Creates the client suspended and hooks it up to the crash monitor
+bool CreateSuspendedClient(const wchar_t* commandLine, LPCWSTR currentDirectory, PROCESS_INFORMATION* processInfo);
+
+// Loads the library into the client and resolves its exports. On failure
+// `error` says what went wrong, callers decide whether to show it.
+bool InjectLibrary(HANDLE hProcess, const EntryPointParameters& parameters, InjectedLibrary* library, const wchar_t** error);
@@ -0,0 +1,277 @@
+// InstructionDecoder.cpp
+#include "InstructionDecoder.h"
+#include <string.h>
+
+// Operand layout of each opcode
+#define N   0x00 // nothing after the opcode
+#define M   0x01 // ModRM (+ SIB + displacement)
+#define I8  0x02 // imm8
+#define I16 0x04 // imm16
+#define IZ  0x08 // imm16 or imm32 depending on operand size
+#define R8  0x10 // rel8
+#define RZ  0x20 // rel32
+#define AM  0x40 // moffs, sized by the address size
+#define X   0x80 // prefix, escape, invalid or handled by hand
+
+static const uint8_t g_primaryTable[256] = {
+    /* 00 */ M, M, M, M, I8, IZ, N, N, M, M, M, M, I8, IZ, N, X,
+    /* 10 */ M, M, M, M, I8, IZ, N, N, M, M, M, M, I8, IZ, N, N,
+    /* 20 */ M, M, M, M, I8, IZ, X, N, M, M, M, M, I8, IZ, X, N,
+    /* 30 */ M, M, M, M, I8, IZ, X, N, M, M, M, M, I8, IZ, X, N,
+    /* 40 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 50 */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+    /* 60 */ N, N, M, M, X, X, X, X, IZ, M | IZ, I8, M | I8, N, N, N, N,
+    /* 70 */ R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8, R8,
+    /* 80 */ M | I8, M | IZ, M | I8, M | I8, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* 90 */ N, N, N, N, N, N, N, N, N, N, X, N, N, N, N, N,
+    /* A0 */ AM, AM, AM, AM, N, N, N, N, I8, IZ, N, N, N, N, N, N,
+    /* B0 */ I8, I8, I8, I8, I8, I8, I8, I8, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ,
+    /* C0 */ M | I8, M | I8, I16, N, M, M, M | I8, M | IZ, I16 | I8, N, I16, N, N, I8, N, N,
+    /* D0 */ M, M, M, M, I8, I8, N, N, M, M, M, M, M, M, M, M,
+    /* E0 */ R8, R8, R8, R8, I8, I8, I8, I8, RZ, RZ, X, R8, N, N, N, N,
+    /* F0 */ X, N, X, X, N, N, M, M, N, N, N, N, N, N, M, M,
+};
+
+static const uint8_t g_twoByteTable[256] = {
+    /* 00 */ M, M, M, M, X, N, N, N, N, N, X, N, X, M, N, M | I8,
+    /* 10 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* 20 */ M, M, M, M, X, X, X, X, M, M, M, M, M, M, M, M,
+    /* 30 */ N, N, N, N, N, N, X, N, X, X, X, X, X, X, X, X,
+    /* 40 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* 50 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* 60 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* 70 */ M | I8, M | I8, M | I8, M | I8, M, M, M, N, M, M, X, X, M, M, M, M,
+    /* 80 */ RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ, RZ,
+    /* 90 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* A0 */ N, N, N, M, M | I8, M, X, X, N, N, N, M, M | I8, M, M, M,
+    /* B0 */ M, M, M, M, M, M, M, M, M, M, M | I8, M, M, M, M, M,
+    /* C0 */ M, M, M | I8, M, M | I8, M | I8, M | I8, M, N, N, N, N, N, N, N, N,
+    /* D0 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* E0 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+    /* F0 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+};
+
+static bool isLegacyPrefix(uint8_t value) {
+    switch (value) {
+    case 0x66: case 0x67: case 0xF0: case 0xF2: case 0xF3:
+    case 0x26: case 0x2E: case 0x36: case 0x3E: case 0x64: case 0x65:
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t InstructionDecoder::decode(const uint8_t* code, size_t available, bool is64Bit, DecodedInstruction* instruction) {
+    if (!code || !instruction) {
+        return 0;
+    }
+    memset(instruction, 0, sizeof(DecodedInstruction));
+
+    if (available > INSTRUCTION_MAX_LENGTH) {
+        available = INSTRUCTION_MAX_LENGTH;
+    }
+
+    size_t i = 0;
+    bool operandSize16 = false;
+    bool addressOverride = false;
+    bool rexW = false;
+
+    while (i < available && isLegacyPrefix(code[i])) {
+        if (code[i] == 0x66) operandSize16 = true;
+        if (code[i] == 0x67) addressOverride = true;
+        i++;
+    }
+    if (i >= available) {
+        return 0;
+    }
+
+    if (is64Bit && (code[i] & 0xF0) == 0x40) {
+        rexW = (code[i] & 0x08) != 0;
+        i++;
+        if (i >= available) {
+            return 0;
+        }
+    }
+
+    uint8_t map = INSTRUCTION_MAP_PRIMARY;
+    uint8_t operands = 0;
+    uint8_t first = code[i];
+
+    // In 32 bit code C4/C5/62 are only VEX/EVEX when the next byte looks like a register ModRM
+    bool extendedEncoding = (first == 0xC4 || first == 0xC5 || first == 0x62)
+        && (is64Bit || (i + 1 < available && (code[i + 1] & 0xC0) == 0xC0));
+
+    if (extendedEncoding && first == 0x62) {
+        // EVEX, not worth sizing for what we hook
+        return 0;
+    }
+    else if (extendedEncoding) {
+        if (first == 0xC5) {
+            map = INSTRUCTION_MAP_0F;
+            i += 2;
+        }
+        else {
+            if (i + 2 >= available) {
+                return 0;
+            }
+            map = code[i + 1] & 0x1F;
+            if (map < INSTRUCTION_MAP_0F || map > INSTRUCTION_MAP_0F3A) {
+                return 0;
+            }
+            i += 3;
+        }
+        if (i >= available) {
+            return 0;
+        }
+
+        instruction->opcodeOffset = (uint8_t)i;
+        instruction->opcode = code[i];
+        if (map == INSTRUCTION_MAP_0F) operands = g_twoByteTable[code[i]];
+        else if (map == INSTRUCTION_MAP_0F38) operands = M;
+        else operands = M | I8;
+        i++;
+    }
+    else if (first == 0x0F) {
+        i++;
+        if (i >= available) {
+            return 0;
+        }
+
+        if (code[i] == 0x38 || code[i] == 0x3A) {
+            map = code[i] == 0x38 ? INSTRUCTION_MAP_0F38 : INSTRUCTION_MAP_0F3A;
+            operands = code[i] == 0x38 ? M : M | I8;
+            i++;
+            if (i >= available) {
+                return 0;
+            }
+        }
+        else {
+            map = INSTRUCTION_MAP_0F;
+            operands = g_twoByteTable[code[i]];
+        }
+
+        instruction->opcodeOffset = (uint8_t)i;
+        instruction->opcode = code[i];
+        i++;
+    }
+    else {
+        instruction->opcodeOffset = (uint8_t)i;
+        instruction->opcode = first;
+        operands = g_primaryTable[first];
+        i++;
+
+        // Far call/jmp ptr16:32, gone in 64 bit mode
+        if (first == 0x9A || first == 0xEA) {
+            if (is64Bit) {
+                return 0;
+            }
+            operands = IZ | I16;
+            instruction->flags |= first == 0x9A ? INSTRUCTION_FLAG_CALL : INSTRUCTION_FLAG_JUMP;
+        }
+    }
+    instruction->opcodeMap = map;
+
+    if (operands & X) {
+        return 0;
+    }
+
+    if (operands & M) {
+        if (i >= available) {
+            return 0;
+        }
+        uint8_t modrm = code[i++];
+        uint8_t mod = modrm >> 6;
+        uint8_t reg = (modrm >> 3) & 7;
+        uint8_t rm = modrm & 7;
+        instruction->modrm = modrm;
+
+        // test r/m, imm is the only member of its group with an immediate
+        if (map == INSTRUCTION_MAP_PRIMARY && instruction->opcode == 0xF6 && reg < 2) operands |= I8;
+        if (map == INSTRUCTION_MAP_PRIMARY && instruction->opcode == 0xF7 && reg < 2) operands |= IZ;
+
+        if (map == INSTRUCTION_MAP_PRIMARY && instruction->opcode == 0xFF) {
+            if (reg == 2 || reg == 3) instruction->flags |= INSTRUCTION_FLAG_CALL;
+            if (reg == 4 || reg == 5) instruction->flags |= INSTRUCTION_FLAG_JUMP;
+        }
+
+        if (mod != 3) {
+            if (!is64Bit && addressOverride) {
+                // 16 bit addressing, no SIB
+                if (mod == 0 && rm == 6) i += 2;
+                else if (mod == 1) i += 1;
+                else if (mod == 2) i += 2;
+            }
+            else {
+                if (rm == 4) {
+                    if (i >= available) {
+                        return 0;
+                    }
+                    uint8_t sib = code[i++];
+                    if (mod == 0 && (sib & 7) == 5) i += 4;
+                }
+
+                if (mod == 0 && rm == 5) {
+                    if (is64Bit) {
+                        instruction->flags |= INSTRUCTION_FLAG_RIP_RELATIVE;
+                        instruction->dispOffset = (uint8_t)i;
+                    }
+                    i += 4;
+                }
+                else if (mod == 1) {
+                    i += 1;
+                }
+                else if (mod == 2) {
+                    i += 4;
+                }
+            }
+        }
+    }
+
+    if (operands & I8) {
+        i += 1;
+    }
+    if (operands & I16) {
+        i += 2;
+    }
+    if (operands & IZ) {
+        bool movImm64 = map == INSTRUCTION_MAP_PRIMARY && instruction->opcode >= 0xB8 && instruction->opcode <= 0xBF && rexW;
+        if (movImm64) i += 8;
+        else i += (operandSize16 && !rexW) ? 2 : 4;
+    }
+    if (operands & AM) {
+        if (is64Bit) i += addressOverride ? 4 : 8;
+        else i += addressOverride ? 2 : 4;
+    }
+    if (operands & R8) {
+        instruction->relOffset = (uint8_t)i;
+        instruction->flags |= INSTRUCTION_FLAG_REL8;
+        i += 1;
+    }
+    if (operands & RZ) {
+        // rel16 only exists in 32 bit code with a 66 prefix, we don't relocate those
+        if (!is64Bit && operandSize16) {
+            return 0;
+        }
+        instruction->relOffset = (uint8_t)i;
+        instruction->flags |= INSTRUCTION_FLAG_REL32;
+        i += 4;
+    }
+
+    if (map == INSTRUCTION_MAP_PRIMARY) {
+        uint8_t opcode = instruction->opcode;
+        if ((opcode >= 0x70 && opcode <= 0x7F) || (opcode >= 0xE0 && opcode <= 0xE3)) instruction->flags |= INSTRUCTION_FLAG_CONDITIONAL;
+        if (opcode == 0xEB || opcode == 0xE9) instruction->flags |= INSTRUCTION_FLAG_JUMP;
+        if (opcode == 0xE8) instruction->flags |= INSTRUCTION_FLAG_CALL;
+        if (opcode == 0xC2 || opcode == 0xC3 || opcode == 0xCA || opcode == 0xCB || opcode == 0xCF) instruction->flags |= INSTRUCTION_FLAG_RETURN;
+    }
+    else if (map == INSTRUCTION_MAP_0F && instruction->opcode >= 0x80 && instruction->opcode <= 0x8F) {
+        instruction->flags |= INSTRUCTION_FLAG_CONDITIONAL;
+    }
+
+    if (i > available) {
+        return 0;
+    }
+
+    instruction->length = (uint8_t)i;
+    return i;
+}
@@ -0,0 +1,44 @@
+// InstructionDecoder.h
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Longest legal x86 instruction
+#define INSTRUCTION_MAX_LENGTH 15
+
+// What the hook engine needs to know to move an instruction somewhere else
+#define INSTRUCTION_FLAG_REL8         0x01 // ends in an 8 bit relative branch target
+#define INSTRUCTION_FLAG_REL32        0x02 // ends in a 32 bit relative branch target
+#define INSTRUCTION_FLAG_RIP_RELATIVE 0x04 // has a [rip + disp32] memory operand
+#define INSTRUCTION_FLAG_CALL         0x08
+#define INSTRUCTION_FLAG_JUMP         0x10 // unconditional, control never falls through
+#define INSTRUCTION_FLAG_CONDITIONAL  0x20 // jcc, jcxz and loop
+#define INSTRUCTION_FLAG_RETURN       0x40
+
+// Opcode maps
+#define INSTRUCTION_MAP_PRIMARY 0
+#define INSTRUCTION_MAP_0F      1
+#define INSTRUCTION_MAP_0F38    2
+#define INSTRUCTION_MAP_0F3A    3
+
+struct DecodedInstruction {
+    uint8_t length;
+    uint8_t flags;
+    uint8_t opcode;         // opcode byte within its map
+    uint8_t opcodeMap;
+    uint8_t opcodeOffset;   // where the opcode byte sits, prefixes come before it
+    uint8_t dispOffset;     // where the rip-relative disp32 sits
+    uint8_t relOffset;      // where the relative branch target sits
+    uint8_t modrm;
+};
+
+// Table driven x86 / x86-64 length decoder. It only sizes instructions and
+// classifies the few that can't be copied byte for byte, it doesn't
+// disassemble. No Win32 in here, so it works on any buffer of code.
+class InstructionDecoder {
+public:
+    // Returns the instruction length, 0 for anything it can't size (EVEX,
+    // invalid encodings, 16 bit branches or running past `available`)
+    static size_t decode(const uint8_t* code, size_t available, bool is64Bit, DecodedInstruction* instruction);
+};
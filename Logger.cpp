@@ -0,0 +1,282 @@
+// Logger.cpp
+#include "pch.h"
+#include "Logger.h"
+#include <stdio.h>
+
+// Size of the flusher's text buffer, written out whenever it fills up
+#define LOG_WRITE_BUFFER_SIZE (64 * 1024)
+
+static const char* g_levelNames[] = { "TRACE", "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+Logger::Logger()
+    : m_enqueuePos(0)
+    , m_dequeuePos(0)
+    , m_dropped(0)
+    , m_minimumLevel(LOG_LEVEL_INFO)
+    , m_reportedDropped(0)
+    , m_startCounter(0)
+    , m_counterFrequency(1)
+    , m_startFileTime(0)
+    , m_file(INVALID_HANDLE_VALUE)
+    , m_fileSize(0)
+    , m_flushThread(nullptr)
+    , m_wakeEvent(nullptr)
+    , m_stopping(false)
+{
+    // Allocated up front, writing never allocates
+    m_slots.reset(new LogSlot[LOG_RING_CAPACITY]);
+    for (size_t i = 0; i < LOG_RING_CAPACITY; i++) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+
+    m_startCounter = counter.QuadPart;
+    m_counterFrequency = frequency.QuadPart;
+    m_startFileTime = ((ULONG64)now.dwHighDateTime << 32) | now.dwLowDateTime;
+
+    // Lives as long as we do: writers signal it without synchronizing with stop
+    m_wakeEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+}
+
+Logger::~Logger() {
+    stop();
+    if (m_wakeEvent) {
+        CloseHandle(m_wakeEvent);
+    }
+}
+
+bool Logger::start(const std::wstring& directory) {
+    if (m_flushThread) {
+        return true;
+    }
+    if (!m_wakeEvent) {
+        return false;
+    }
+
+    m_directory = directory;
+    if (!m_directory.empty() && m_directory.back() != L'\\' && m_directory.back() != L'/') {
+        m_directory += L"\\";
+    }
+    CreateDirectoryW(m_directory.c_str(), nullptr);
+    m_path = m_directory + L"injector-" + std::to_wstring(GetCurrentProcessId()) + L".log";
+
+    m_stopping = false;
+    m_flushThread = CreateThread(nullptr, 0, flushThreadProc, this, 0, nullptr);
+    return m_flushThread != nullptr;
+}
+
+void Logger::stop() {
+    if (!m_flushThread) {
+        return;
+    }
+
+    // Until it has really exited, a restart must not end up with two flushers on the same file
+    m_stopping = true;
+    SetEvent(m_wakeEvent);
+    WaitForSingleObject(m_flushThread, INFINITE);
+    CloseHandle(m_flushThread);
+    m_flushThread = nullptr;
+}
+
+bool Logger::write(int level, DWORD code, const char* message) {
+    return write(level, code, message, message ? strlen(message) : 0);
+}
+
+bool Logger::write(int level, DWORD code, const char* message, size_t length) {
+    if (level < m_minimumLevel) {
+        return false;
+    }
+
+    // Claim a slot: it's ours once its sequence matches our position
+    size_t position = m_enqueuePos.load(std::memory_order_relaxed);
+    LogSlot* slot;
+    for (;;) {
+        slot = &m_slots[position & (LOG_RING_CAPACITY - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (m_enqueuePos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            // Full, the flusher is behind: drop rather than wait
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else {
+            position = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    LogRecord& record = slot->record;
+    record.timestamp = counter.QuadPart;
+    record.threadId = GetCurrentThreadId();
+    record.level = (WORD)level;
+    record.code = code;
+    if (length > LOG_PAYLOAD_SIZE) {
+        length = LOG_PAYLOAD_SIZE;
+    }
+    record.length = (WORD)length;
+    if (length) {
+        memcpy(record.payload, message, length);
+    }
+
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    // Nudge the flusher every half ring instead of on every record
+    if ((position & (LOG_RING_CAPACITY / 2 - 1)) == 0) {
+        SetEvent(m_wakeEvent);
+    }
+    return true;
+}
+
+bool Logger::dequeue(LogRecord* record) {
+    LogSlot& slot = m_slots[m_dequeuePos & (LOG_RING_CAPACITY - 1)];
+    size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence != m_dequeuePos + 1) {
+        return false;
+    }
+
+    *record = slot.record;
+
+    // Hand the slot back to writers for the next lap
+    slot.sequence.store(m_dequeuePos + LOG_RING_CAPACITY, std::memory_order_release);
+    m_dequeuePos++;
+    return true;
+}
+
+size_t Logger::formatRecord(const LogRecord& record, char* buffer, size_t capacity) {
+    ULONG64 elapsed = (ULONG64)(record.timestamp - m_startCounter);
+    ULONG64 fileTime = m_startFileTime + elapsed / m_counterFrequency * 10000000ULL
+        + elapsed % m_counterFrequency * 10000000ULL / m_counterFrequency;
+
+    FILETIME utc;
+    utc.dwLowDateTime = (DWORD)fileTime;
+    utc.dwHighDateTime = (DWORD)(fileTime >> 32);
+    SYSTEMTIME utcTime;
+    SYSTEMTIME localTime;
+    FileTimeToSystemTime(&utc, &utcTime);
+    SystemTimeToTzSpecificLocalTime(nullptr, &utcTime, &localTime);
+
+    const char* level = record.level <= LOG_LEVEL_ERROR ? g_levelNames[record.level] : "?????";
+    int written = _snprintf_s(buffer, capacity, _TRUNCATE, "%04u-%02u-%02u %02u:%02u:%02u.%03u [%5lu] %s 0x%08lx %.*s\r\n",
+        localTime.wYear, localTime.wMonth, localTime.wDay,
+        localTime.wHour, localTime.wMinute, localTime.wSecond, localTime.wMilliseconds,
+        record.threadId, level, record.code, (int)record.length, record.payload);
+    return written > 0 ? (size_t)written : 0;
+}
+
+void Logger::openFile() {
+    m_file = CreateFileW(m_path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    m_fileSize = 0;
+    if (m_file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(m_file, &size)) {
+            m_fileSize = (ULONG64)size.QuadPart;
+        }
+    }
+}
+
+// injector-<pid>.log -> injector-<pid>.1.log -> ... oldest one falls off
+void Logger::rotateFiles() {
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+
+    std::wstring stem = m_path.substr(0, m_path.length() - 4);
+    for (int i = LOG_FILE_HISTORY; i >= 1; i--) {
+        std::wstring from = i == 1 ? m_path : stem + L"." + std::to_wstring(i - 1) + L".log";
+        std::wstring to = stem + L"." + std::to_wstring(i) + L".log";
+        MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING);
+    }
+
+    openFile();
+}
+
+void Logger::writeToFile(const char* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (m_file == INVALID_HANDLE_VALUE) {
+        openFile();
+        if (m_file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+    }
+    if (m_fileSize + length > LOG_FILE_MAX_SIZE) {
+        rotateFiles();
+        if (m_file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+    }
+
+    DWORD bytesWritten = 0;
+    WriteFile(m_file, data, (DWORD)length, &bytesWritten, nullptr);
+    m_fileSize += bytesWritten;
+}
+
+size_t Logger::drain() {
+    static char buffer[LOG_WRITE_BUFFER_SIZE];
+    size_t used = 0;
+    size_t count = 0;
+
+    // Anything dropped since the last flush gets a line of its own
+    ULONG64 dropped = m_dropped.load(std::memory_order_relaxed);
+    if (dropped != m_reportedDropped) {
+        int written = _snprintf_s(buffer, sizeof(buffer), _TRUNCATE, "-- %llu log records dropped, ring was full\r\n", dropped - m_reportedDropped);
+        used = written > 0 ? (size_t)written : 0;
+        m_reportedDropped = dropped;
+    }
+
+    LogRecord record;
+    while (dequeue(&record)) {
+        if (sizeof(buffer) - used < LOG_PAYLOAD_SIZE + 128) {
+            writeToFile(buffer, used);
+            used = 0;
+        }
+        used += formatRecord(record, buffer + used, sizeof(buffer) - used);
+        count++;
+    }
+
+    writeToFile(buffer, used);
+    return count;
+}
+
+DWORD WINAPI Logger::flushThreadProc(LPVOID param) {
+    ((Logger*)param)->flushLoop();
+    return 0;
+}
+
+void Logger::flushLoop() {
+    while (!m_stopping) {
+        WaitForSingleObject(m_wakeEvent, LOG_FLUSH_INTERVAL_MS);
+        drain();
+    }
+
+    // Whatever made it into the ring before stop
+    drain();
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) bool LogWrite(int level, int code, const char* message) {
+    return Logger::getInstance().write(level, (DWORD)code, message);
+}
+
+extern "C" __declspec(dllexport) void LogSetLevel(int level) {
+    Logger::getInstance().setMinimumLevel(level);
+}
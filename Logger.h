@@ -0,0 +1,118 @@
+// Logger.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <memory>
+#include <atomic>
+
+// Log levels, shared with managed code
+#define LOG_LEVEL_TRACE   0
+#define LOG_LEVEL_DEBUG   1
+#define LOG_LEVEL_INFO    2
+#define LOG_LEVEL_WARNING 3
+#define LOG_LEVEL_ERROR   4
+
+// Records the ring holds before writers start dropping, must be a power of two
+#define LOG_RING_CAPACITY 8192
+
+// Message bytes kept per record, longer messages are truncated
+#define LOG_PAYLOAD_SIZE 104
+
+// How often the flusher drains the ring when nobody wakes it
+#define LOG_FLUSH_INTERVAL_MS 250
+
+// Rotation: current file plus this many older ones, each up to the max size
+#define LOG_FILE_MAX_SIZE (8 * 1024 * 1024)
+#define LOG_FILE_HISTORY 3
+
+// One fixed size record, formatted to text only by the flusher
+struct LogRecord {
+    LONGLONG timestamp;     // QueryPerformanceCounter
+    DWORD threadId;
+    WORD level;
+    WORD length;
+    DWORD code;
+    char payload[LOG_PAYLOAD_SIZE];
+};
+
+// Structured logging for the injector and managed plugins.
+//
+// Writers claim a slot in a bounded multi-producer ring (Vyukov's sequence
+// per slot scheme) with a single compare-exchange, copy their record in and
+// publish it; there are no locks and no syscalls beyond the timestamp. When
+// the ring is full the record is dropped and counted rather than waiting.
+// A background thread drains the ring to a rotating text file.
+class Logger {
+public:
+    static Logger& getInstance() {
+        static Logger instance;
+        return instance;
+    }
+
+    bool start(const std::wstring& directory);
+    void stop();
+    bool isRunning() const { return m_flushThread != nullptr; }
+
+    void setMinimumLevel(int level) { m_minimumLevel = level; }
+
+    // Never blocks, returns false if the record was filtered or dropped
+    bool write(int level, DWORD code, const char* message, size_t length);
+    bool write(int level, DWORD code, const char* message);
+
+    ULONG64 getDroppedCount() const { return m_dropped; }
+
+private:
+    struct LogSlot {
+        std::atomic<size_t> sequence;
+        LogRecord record;
+    };
+
+    Logger();
+    ~Logger();
+
+    // No copy or move
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+    Logger(Logger&&) = delete;
+    Logger& operator=(Logger&&) = delete;
+
+    static DWORD WINAPI flushThreadProc(LPVOID param);
+    void flushLoop();
+
+    // Flusher thread only
+    bool dequeue(LogRecord* record);
+    size_t drain();
+    size_t formatRecord(const LogRecord& record, char* buffer, size_t capacity);
+    void writeToFile(const char* data, size_t length);
+    void openFile();
+    void rotateFiles();
+
+    std::unique_ptr<LogSlot[]> m_slots;
+
+    // Producers and the consumer hammer different cache lines
+    alignas(64) std::atomic<size_t> m_enqueuePos;
+    alignas(64) size_t m_dequeuePos;
+    alignas(64) std::atomic<ULONG64> m_dropped;
+
+    volatile int m_minimumLevel;
+    ULONG64 m_reportedDropped;
+
+    // Wall clock at start, so QPC timestamps can be turned into times of day
+    LONGLONG m_startCounter;
+    LONGLONG m_counterFrequency;
+    ULONG64 m_startFileTime;
+
+    std::wstring m_directory;
+    std::wstring m_path;
+    HANDLE m_file;
+    ULONG64 m_fileSize;
+
+    HANDLE m_flushThread;
+    HANDLE m_wakeEvent;     // Created once, survives stop/start
+    volatile bool m_stopping;
+};
+
+// Exports for managed code
+extern "C" __declspec(dllexport) bool LogWrite(int level, int code, const char* message);
+extern "C" __declspec(dllexport) void LogSetLevel(int level);
@@ -0,0 +1,204 @@
+// MemoryMap.cpp
+#include "pch.h"
+#include "MemoryMap.h"
+#include <algorithm>
+
+MemoryMap::MemoryMap() {
+}
+
+MemoryMap::~MemoryMap() {
+}
+
+void MemoryMap::queryRange(ULONG_PTR begin, ULONG_PTR end, std::vector<MemoryRegion>* regions, ULONG_PTR* queriedEnd) {
+    ULONG_PTR address = begin;
+    while (address < end) {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (!VirtualQuery((LPCVOID)address, &mbi, sizeof(mbi)) || mbi.RegionSize == 0) {
+            break;
+        }
+
+        MemoryRegion region = {};
+        region.base = (ULONG64)(ULONG_PTR)mbi.BaseAddress;
+        region.size = mbi.RegionSize;
+        region.allocationBase = (ULONG64)(ULONG_PTR)mbi.AllocationBase;
+        region.moduleBase = mbi.Type == MEM_IMAGE ? region.allocationBase : 0;
+        region.state = mbi.State;
+        region.protect = mbi.Protect;
+        region.type = mbi.Type;
+        regions->push_back(region);
+
+        ULONG_PTR next = (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize;
+        if (next <= address) {
+            break;
+        }
+        address = next;
+    }
+
+    if (queriedEnd) {
+        *queriedEnd = address;
+    }
+}
+
+size_t MemoryMap::findIndex(ULONG_PTR address) {
+    // Last region starting at or below the address, or the first one above it
+    auto it = std::upper_bound(m_regions.begin(), m_regions.end(), (ULONG64)address,
+        [](ULONG64 value, const MemoryRegion& region) { return value < region.base; });
+    if (it != m_regions.begin()) {
+        auto previous = it - 1;
+        if ((ULONG64)address - previous->base < previous->size) {
+            return previous - m_regions.begin();
+        }
+    }
+    return it - m_regions.begin();
+}
+
+void MemoryMap::snapshotLocked() {
+    std::vector<MemoryRegion> regions;
+    regions.reserve(m_regions.size() ? m_regions.size() + 64 : 1024);
+    queryRange(0, (ULONG_PTR)-1, &regions, nullptr);
+    m_regions.swap(regions);
+}
+
+size_t MemoryMap::snapshot() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    snapshotLocked();
+    return m_regions.size();
+}
+
+size_t MemoryMap::refresh(ULONG_PTR address, SIZE_T size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_regions.empty()) {
+        snapshotLocked();
+        return m_regions.size();
+    }
+
+    // Whole allocations, a protection change can split or merge regions anywhere inside one
+    MEMORY_BASIC_INFORMATION mbi;
+    if (!VirtualQuery((LPCVOID)address, &mbi, sizeof(mbi))) {
+        return m_regions.size();
+    }
+    ULONG_PTR begin = mbi.State == MEM_FREE ? (ULONG_PTR)mbi.BaseAddress : (ULONG_PTR)mbi.AllocationBase;
+    ULONG_PTR end = address + (size ? size : 1);
+    if (end < address) {
+        end = (ULONG_PTR)-1;
+    }
+
+    std::vector<MemoryRegion> fresh;
+    ULONG_PTR queriedEnd = begin;
+    queryRange(begin, end, &fresh, &queriedEnd);
+    if (fresh.empty()) {
+        return m_regions.size();
+    }
+
+    // Replace [begin, queriedEnd), keeping whatever sticks out on either side
+    size_t first = findIndex(begin);
+    size_t last = first;
+    while (last < m_regions.size() && m_regions[last].base < (ULONG64)queriedEnd) {
+        last++;
+    }
+
+    std::vector<MemoryRegion> replacement;
+    replacement.reserve(fresh.size() + 2);
+    if (first < m_regions.size() && m_regions[first].base < (ULONG64)begin) {
+        MemoryRegion head = m_regions[first];
+        head.size = (ULONG64)begin - head.base;
+        replacement.push_back(head);
+    }
+    replacement.insert(replacement.end(), fresh.begin(), fresh.end());
+    if (last > first) {
+        const MemoryRegion& previous = m_regions[last - 1];
+        if (previous.base + previous.size > (ULONG64)queriedEnd) {
+            MemoryRegion tail = previous;
+            tail.base = (ULONG64)queriedEnd;
+            tail.size = previous.base + previous.size - (ULONG64)queriedEnd;
+            replacement.push_back(tail);
+        }
+    }
+
+    m_regions.erase(m_regions.begin() + first, m_regions.begin() + last);
+    m_regions.insert(m_regions.begin() + first, replacement.begin(), replacement.end());
+    return m_regions.size();
+}
+
+bool MemoryMap::query(ULONG_PTR address, MemoryRegion* region) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_regions.empty()) {
+        snapshotLocked();
+    }
+
+    size_t index = findIndex(address);
+    if (index >= m_regions.size() || (ULONG64)address - m_regions[index].base >= m_regions[index].size) {
+        return false;
+    }
+    if (region) {
+        *region = m_regions[index];
+    }
+    return true;
+}
+
+bool MemoryMap::isReadable(const MemoryRegion& region) {
+    return region.state == MEM_COMMIT && region.protect != 0
+        && !(region.protect & (PAGE_NOACCESS | PAGE_GUARD));
+}
+
+bool MemoryMap::isExecutable(const MemoryRegion& region) {
+    const DWORD executable = PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+    return region.state == MEM_COMMIT && (region.protect & executable) && !(region.protect & PAGE_GUARD);
+}
+
+ULONG_PTR MemoryMap::findFree(ULONG_PTR origin, SIZE_T size, ULONG_PTR minAddress, ULONG_PTR maxAddress) {
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    ULONG64 granularity = systemInfo.dwAllocationGranularity;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_regions.empty()) {
+        snapshotLocked();
+    }
+
+    ULONG64 best = 0;
+    ULONG64 bestDistance = (ULONG64)-1;
+    for (size_t i = findIndex(minAddress); i < m_regions.size() && m_regions[i].base < (ULONG64)maxAddress; i++) {
+        const MemoryRegion& region = m_regions[i];
+        if (region.state != MEM_FREE) {
+            continue;
+        }
+
+        ULONG64 low = (std::max)(region.base, (ULONG64)minAddress);
+        ULONG64 high = (std::min)(region.base + region.size, (ULONG64)maxAddress);
+        low = (low + granularity - 1) / granularity * granularity;
+        if (high < low || high - low < size) {
+            continue;
+        }
+
+        // Aligned start inside [low, high - size] closest to origin
+        ULONG64 candidate = (ULONG64)origin / granularity * granularity;
+        ULONG64 lastStart = (high - size) / granularity * granularity;
+        if (candidate < low) candidate = low;
+        if (candidate > lastStart) candidate = lastStart;
+        if (candidate < low) {
+            continue;
+        }
+
+        ULONG64 distance = candidate > origin ? candidate - origin : origin - candidate;
+        if (distance < bestDistance) {
+            best = candidate;
+            bestDistance = distance;
+        }
+    }
+
+    return (ULONG_PTR)best;
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) int MemoryMapSnapshot() {
+    return (int)MemoryMap::getInstance().snapshot();
+}
+
+extern "C" __declspec(dllexport) int MemoryMapRefresh(const void* address, size_t size) {
+    return (int)MemoryMap::getInstance().refresh((ULONG_PTR)address, size);
+}
+
+extern "C" __declspec(dllexport) bool MemoryMapQuery(const void* address, MemoryRegion* region) {
+    return MemoryMap::getInstance().query((ULONG_PTR)address, region);
+}
@@ -0,0 +1,91 @@
+// MemoryMap.h
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+#include <mutex>
+
+// One run of pages with the same state, protection and type. Fixed layout,
+// it's handed to managed code as is.
+struct MemoryRegion {
+    ULONG64 base;
+    ULONG64 size;
+    ULONG64 allocationBase;
+    ULONG64 moduleBase;     // image the region belongs to, 0 outside images
+    DWORD state;            // MEM_COMMIT, MEM_RESERVE or MEM_FREE
+    DWORD protect;
+    DWORD type;             // MEM_IMAGE, MEM_MAPPED or MEM_PRIVATE
+    DWORD reserved;
+};
+
+// Snapshot of the whole address space as sorted, non-overlapping regions,
+// free ranges included, so every address falls in exactly one of them and a
+// lookup is a binary search. Refreshing a range only re-queries the
+// allocations it touches and splices them in.
+class MemoryMap {
+public:
+    static MemoryMap& getInstance() {
+        static MemoryMap instance;
+        return instance;
+    }
+
+    // Rebuilds the whole map, returns the region count
+    size_t snapshot();
+
+    // Re-queries the allocations overlapping [address, address + size)
+    size_t refresh(ULONG_PTR address, SIZE_T size);
+
+    // O(log n), takes a snapshot first if there isn't one
+    bool query(ULONG_PTR address, MemoryRegion* region);
+
+    // Committed, accessible and not a guard page
+    static bool isReadable(const MemoryRegion& region);
+    static bool isExecutable(const MemoryRegion& region);
+
+    // Calls back for every region overlapping [address, address + size), stops when it returns false
+    template <typename Callback>
+    void forEachRegion(ULONG_PTR address, SIZE_T size, Callback callback) {
+        std::vector<MemoryRegion> regions;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_regions.empty()) {
+                snapshotLocked();
+            }
+            for (size_t i = findIndex(address); i < m_regions.size() && m_regions[i].base < (ULONG64)address + size; i++) {
+                regions.push_back(m_regions[i]);
+            }
+        }
+        for (const auto& region : regions) {
+            if (!callback(region)) {
+                break;
+            }
+        }
+    }
+
+    // Free, allocation-granularity aligned range of `size` bytes inside
+    // [minAddress, maxAddress), as close to `origin` as possible. 0 if none.
+    ULONG_PTR findFree(ULONG_PTR origin, SIZE_T size, ULONG_PTR minAddress, ULONG_PTR maxAddress);
+
+private:
+    MemoryMap();
+    ~MemoryMap();
+
+    // No copy or move
+    MemoryMap(const MemoryMap&) = delete;
+    MemoryMap& operator=(const MemoryMap&) = delete;
+    MemoryMap(MemoryMap&&) = delete;
+    MemoryMap& operator=(MemoryMap&&) = delete;
+
+    // All expect m_mutex to be held
+    void snapshotLocked();
+    size_t findIndex(ULONG_PTR address);
+    static void queryRange(ULONG_PTR begin, ULONG_PTR end, std::vector<MemoryRegion>* regions, ULONG_PTR* queriedEnd);
+
+    std::vector<MemoryRegion> m_regions;
+    std::mutex m_mutex;
+};
+
+// Exports for managed code
+extern "C" __declspec(dllexport) int MemoryMapSnapshot();
+extern "C" __declspec(dllexport) int MemoryMapRefresh(const void* address, size_t size);
+extern "C" __declspec(dllexport) bool MemoryMapQuery(const void* address, MemoryRegion* region);
@@ -0,0 +1,281 @@
+// ModuleTracker.cpp
+#include "pch.h"
+#include "ModuleTracker.h"
+#include <DbgHelp.h>
+#include <winternl.h>
+#include <algorithm>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#pragma comment(lib, "Dbghelp.lib")
+
+// Loader notification types, these live in ntdll and aren't in the SDK headers
+#define LDR_DLL_NOTIFICATION_REASON_LOADED 1
+#define LDR_DLL_NOTIFICATION_REASON_UNLOADED 2
+
+struct LdrDllNotificationData {
+    ULONG flags;
+    const UNICODE_STRING* fullDllName;
+    const UNICODE_STRING* baseDllName;
+    PVOID dllBase;
+    ULONG sizeOfImage;
+};
+
+typedef VOID(CALLBACK* LdrDllNotificationFunc)(ULONG reason, const void* data, PVOID context);
+typedef NTSTATUS(NTAPI* LdrRegisterDllNotificationFunc)(ULONG flags, LdrDllNotificationFunc callback, PVOID context, PVOID* cookie);
+typedef NTSTATUS(NTAPI* LdrUnregisterDllNotificationFunc)(PVOID cookie);
+
+ModuleTracker::ModuleTracker()
+    : m_cookie(nullptr)
+    , m_hasPending(false)
+    , m_symbolProcess(nullptr)
+{
+}
+
+ModuleTracker::~ModuleTracker() {
+    stop();
+}
+
+bool ModuleTracker::start() {
+    if (m_cookie) {
+        return true;
+    }
+
+    HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+    LdrRegisterDllNotificationFunc registerNotification = ntdll
+        ? (LdrRegisterDllNotificationFunc)GetProcAddress(ntdll, "LdrRegisterDllNotification")
+        : nullptr;
+    if (!registerNotification) {
+        return false;
+    }
+
+    // Register first so nothing loaded while we enumerate slips through,
+    // insertModule ignores anything we already know about
+    if (registerNotification(0, onDllNotification, this, &m_cookie) != 0) {
+        m_cookie = nullptr;
+        return false;
+    }
+
+    HMODULE modules[1024];
+    DWORD bytesNeeded = 0;
+    if (!EnumProcessModules(GetCurrentProcess(), modules, sizeof(modules), &bytesNeeded)) {
+        return true;
+    }
+
+    DWORD moduleCount = bytesNeeded / sizeof(HMODULE);
+    if (moduleCount > sizeof(modules) / sizeof(HMODULE)) {
+        moduleCount = sizeof(modules) / sizeof(HMODULE);
+    }
+
+    for (DWORD i = 0; i < moduleCount; i++) {
+        MODULEINFO modInfo;
+        wchar_t path[MAX_PATH] = { 0 };
+        if (!GetModuleInformation(GetCurrentProcess(), modules[i], &modInfo, sizeof(MODULEINFO))) {
+            continue;
+        }
+        DWORD pathLength = GetModuleFileNameW(modules[i], path, MAX_PATH);
+
+        TrackedModule module;
+        if (fillModule((DWORD64)(ULONG_PTR)modInfo.lpBaseOfDll, modInfo.SizeOfImage, path, pathLength, &module)) {
+            std::lock_guard<std::mutex> lock(m_modulesMutex);
+            insertModule(module);
+        }
+    }
+
+    return true;
+}
+
+void ModuleTracker::stop() {
+    if (!m_cookie) {
+        return;
+    }
+
+    HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+    LdrUnregisterDllNotificationFunc unregisterNotification = ntdll
+        ? (LdrUnregisterDllNotificationFunc)GetProcAddress(ntdll, "LdrUnregisterDllNotification")
+        : nullptr;
+    if (unregisterNotification) {
+        unregisterNotification(m_cookie);
+    }
+    m_cookie = nullptr;
+
+    std::lock_guard<std::mutex> lock(m_modulesMutex);
+    m_modules.clear();
+}
+
+bool ModuleTracker::fillModule(DWORD64 base, DWORD size, const wchar_t* path, size_t pathLength, TrackedModule* module) {
+    if (!base || !size || !path || pathLength == 0 || pathLength >= MAX_PATH) {
+        return false;
+    }
+
+    module->base = base;
+    module->size = size;
+    wmemcpy(module->path, path, pathLength);
+    module->path[pathLength] = L'\0';
+
+    const wchar_t* name = wcsrchr(module->path, L'\\');
+    module->nameOffset = (WORD)(name ? name + 1 - module->path : 0);
+    return true;
+}
+
+VOID CALLBACK ModuleTracker::onDllNotification(ULONG reason, const void* data, PVOID context) {
+    ModuleTracker* tracker = (ModuleTracker*)context;
+    const LdrDllNotificationData* notification = (const LdrDllNotificationData*)data;
+    if (!tracker || !notification) {
+        return;
+    }
+
+    // Loader lock is held here: update our own tables and get out
+    if (reason == LDR_DLL_NOTIFICATION_REASON_LOADED) {
+        const UNICODE_STRING* fullName = notification->fullDllName;
+        TrackedModule module;
+        if (fullName && fillModule((DWORD64)(ULONG_PTR)notification->dllBase, notification->sizeOfImage,
+            fullName->Buffer, fullName->Length / sizeof(wchar_t), &module)) {
+            tracker->onModuleLoaded(module);
+        }
+    }
+    else if (reason == LDR_DLL_NOTIFICATION_REASON_UNLOADED) {
+        tracker->onModuleUnloaded((DWORD64)(ULONG_PTR)notification->dllBase);
+    }
+}
+
+void ModuleTracker::onModuleLoaded(const TrackedModule& module) {
+    std::lock_guard<std::mutex> pendingLock(m_pendingMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_modulesMutex);
+        insertModule(module);
+    }
+
+    if (m_symbolProcess) {
+        ModuleChange change;
+        change.loaded = true;
+        change.module = module;
+        m_pending.push_back(change);
+        m_hasPending = true;
+    }
+}
+
+void ModuleTracker::onModuleUnloaded(DWORD64 base) {
+    std::lock_guard<std::mutex> pendingLock(m_pendingMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_modulesMutex);
+        removeModule(base);
+    }
+
+    if (m_symbolProcess) {
+        ModuleChange change = {};
+        change.loaded = false;
+        change.module.base = base;
+        m_pending.push_back(change);
+        m_hasPending = true;
+    }
+}
+
+void ModuleTracker::insertModule(const TrackedModule& module) {
+    auto it = std::lower_bound(m_modules.begin(), m_modules.end(), module.base,
+        [](const TrackedModule& entry, DWORD64 base) { return entry.base < base; });
+    if (it != m_modules.end() && it->base == module.base) {
+        return;
+    }
+    m_modules.insert(it, module);
+}
+
+void ModuleTracker::removeModule(DWORD64 base) {
+    auto it = std::lower_bound(m_modules.begin(), m_modules.end(), base,
+        [](const TrackedModule& entry, DWORD64 value) { return entry.base < value; });
+    if (it != m_modules.end() && it->base == base) {
+        m_modules.erase(it);
+    }
+}
+
+bool ModuleTracker::findModule(DWORD64 address, TrackedModule* module) {
+    std::lock_guard<std::mutex> lock(m_modulesMutex);
+    return findModuleLocked(address, module);
+}
+
+bool ModuleTracker::tryFindModule(DWORD64 address, TrackedModule* module) {
+    std::unique_lock<std::mutex> lock(m_modulesMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return false;
+    }
+    return findModuleLocked(address, module);
+}
+
+bool ModuleTracker::findModuleLocked(DWORD64 address, TrackedModule* module) {
+    // Last module starting at or below the address
+    auto it = std::upper_bound(m_modules.begin(), m_modules.end(), address,
+        [](DWORD64 value, const TrackedModule& entry) { return value < entry.base; });
+    if (it == m_modules.begin()) {
+        return false;
+    }
+    --it;
+
+    if (address - it->base >= it->size) {
+        return false;
+    }
+    if (module) {
+        *module = *it;
+    }
+    return true;
+}
+
+size_t ModuleTracker::getModuleCount() {
+    std::lock_guard<std::mutex> lock(m_modulesMutex);
+    return m_modules.size();
+}
+
+void ModuleTracker::attachSymbols(HANDLE hProcess) {
+    std::lock_guard<std::mutex> symbolsLock(m_symbolsMutex);
+
+    // Everything loaded up to this point is in the snapshot, anything after it is queued
+    std::vector<TrackedModule> modules;
+    {
+        std::lock_guard<std::mutex> pendingLock(m_pendingMutex);
+        std::lock_guard<std::mutex> lock(m_modulesMutex);
+        modules = m_modules;
+        m_pending.clear();
+        m_hasPending = false;
+        m_symbolProcess = hProcess;
+    }
+
+    for (const auto& module : modules) {
+        SymLoadModuleExW(hProcess, nullptr, module.path, nullptr, module.base, module.size, nullptr, 0);
+    }
+}
+
+void ModuleTracker::detachSymbols() {
+    std::lock_guard<std::mutex> symbolsLock(m_symbolsMutex);
+    std::lock_guard<std::mutex> pendingLock(m_pendingMutex);
+    m_pending.clear();
+    m_hasPending = false;
+    m_symbolProcess = nullptr;
+}
+
+void ModuleTracker::syncSymbols() {
+    if (!m_hasPending) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> symbolsLock(m_symbolsMutex);
+
+    std::vector<ModuleChange> changes;
+    HANDLE hProcess = nullptr;
+    {
+        std::lock_guard<std::mutex> pendingLock(m_pendingMutex);
+        changes.swap(m_pending);
+        m_hasPending = false;
+        hProcess = m_symbolProcess;
+    }
+    if (!hProcess) {
+        return;
+    }
+
+    // In order, an image unloaded and reloaded at the same base must end up loaded
+    for (const auto& change : changes) {
+        if (change.loaded) {
+            SymLoadModuleExW(hProcess, nullptr, change.module.path, nullptr, change.module.base, change.module.size, nullptr, 0);
+        }
+        else {
+            SymUnloadModule64(hProcess, change.module.base);
+        }
+    }
+}
@@ -0,0 +1,95 @@
+// ModuleTracker.h
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// A loaded image. Fixed size so lookups at crash time never allocate.
+struct TrackedModule {
+    DWORD64 base;
+    DWORD size;
+    WORD nameOffset;            // start of the file name within path
+    wchar_t path[MAX_PATH];
+
+    const wchar_t* name() const { return path + nameOffset; }
+};
+
+// Keeps a sorted, non-overlapping table of the loaded images up to date from
+// the loader's DLL notifications, and mirrors every change into dbghelp.
+//
+// The notification runs under the loader lock, where calling into dbghelp is
+// not safe, so it only updates the range table and queues the change. The
+// queue is applied to the symbol engine the next time anybody resolves a
+// symbol, one SymLoadModuleExW / SymUnloadModule64 per change instead of a
+// full re-enumeration.
+class ModuleTracker {
+public:
+    static ModuleTracker& getInstance() {
+        static ModuleTracker instance;
+        return instance;
+    }
+
+    // Registers for notifications and takes the initial snapshot
+    bool start();
+    void stop();
+    bool isRunning() const { return m_cookie != nullptr; }
+
+    // O(log n) lookup in the range table, copies the entry out
+    bool findModule(DWORD64 address, TrackedModule* module);
+
+    // Same lookup for crash time: returns false instead of waiting when the
+    // table is locked, the crashing thread may be the one holding it
+    bool tryFindModule(DWORD64 address, TrackedModule* module);
+    size_t getModuleCount();
+
+    // Loads every tracked module into dbghelp for hProcess, later changes are
+    // queued until syncSymbols. The caller owns SymInitialize/SymCleanup.
+    void attachSymbols(HANDLE hProcess);
+    void detachSymbols();
+
+    // Applies queued loads/unloads to dbghelp, cheap when nothing changed
+    void syncSymbols();
+
+private:
+    struct ModuleChange {
+        bool loaded;
+        TrackedModule module;
+    };
+
+    ModuleTracker();
+    ~ModuleTracker();
+
+    // No copy or move
+    ModuleTracker(const ModuleTracker&) = delete;
+    ModuleTracker& operator=(const ModuleTracker&) = delete;
+    ModuleTracker(ModuleTracker&&) = delete;
+    ModuleTracker& operator=(ModuleTracker&&) = delete;
+
+    static VOID CALLBACK onDllNotification(ULONG reason, const void* data, PVOID context);
+    void onModuleLoaded(const TrackedModule& module);
+    void onModuleUnloaded(DWORD64 base);
+
+    // All expect m_modulesMutex to be held
+    void insertModule(const TrackedModule& module);
+    void removeModule(DWORD64 base);
+    bool findModuleLocked(DWORD64 address, TrackedModule* module);
+
+    static bool fillModule(DWORD64 base, DWORD size, const wchar_t* path, size_t pathLength, TrackedModule* module);
+
+    PVOID m_cookie;
+
+    // Sorted by base
+    std::vector<TrackedModule> m_modules;
+    std::mutex m_modulesMutex;
+
+    // Changes waiting for the symbol engine, only queued while attached
+    std::vector<ModuleChange> m_pending;
+    std::mutex m_pendingMutex;
+    std::atomic<bool> m_hasPending;
+
+    // Serializes everything that talks to dbghelp on our behalf
+    std::mutex m_symbolsMutex;
+    HANDLE m_symbolProcess;
+};
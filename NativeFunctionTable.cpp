@@ -0,0 +1,52 @@
+// NativeFunctionTable.cpp
+#include "pch.h"
+#include "NativeFunctionTable.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "HangWatchdog.h"
+#include "SignatureScanner.h"
+#include "HookEngine.h"
+#include "Telemetry.h"
+
+// Constant initialized, so it's filled in before any code runs
+static const NativeFunctionTable g_nativeFunctionTable = {
+    NATIVE_FUNCTION_TABLE_VERSION,
+    sizeof(NativeFunctionTable),
+
+    LogWrite,
+    LogSetLevel,
+
+    TraceBegin,
+    TraceEnd,
+    TraceCounter,
+    TraceRegisterName,
+
+    Heartbeat,
+    ReportManagedException,
+    RegisterManagedSymbolResolver,
+    RegisterManagedExtraInfoResolver,
+    RegisterManagedBatchSymbolResolver,
+    RegisterManagedStackCapture,
+
+    MemoryMapSnapshot,
+    MemoryMapRefresh,
+    MemoryMapQuery,
+    ScanModulePatterns,
+    ScanMemoryPatterns,
+
+    HookBeginTransaction,
+    HookCommitTransaction,
+    HookAbortTransaction,
+    HookCreate,
+    HookRemove,
+
+    TelemetrySetCounter,
+    TelemetryAddCounter,
+    TelemetryReportGc,
+    TelemetryPush,
+};
+
+// Exports for managed code
+extern "C" __declspec(dllexport) const NativeFunctionTable* GetNativeFunctions() {
+    return &g_nativeFunctionTable;
+}
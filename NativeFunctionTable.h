@@ -0,0 +1,61 @@
+// NativeFunctionTable.h
+#pragma once
+
+#include <Windows.h>
+#include "CrashHandler.h"
+#include "MemoryMap.h"
+
+#define NATIVE_FUNCTION_TABLE_VERSION 2
+
+// Native entry points handed to managed Init through InitParameters,
+// so managed code calls them through `delegate* unmanaged[Cdecl]` instead of
+// resolving each export with a DllImport lookup and a marshalling stub.
+// Every pointer is the export of the same name.
+//
+// Only ever appended to: managed code checks `size` before reading an entry,
+// and `version` bumps when entries are added.
+struct NativeFunctionTable {
+    DWORD version;
+    DWORD size;
+
+    // Logging
+    bool (*logWrite)(int level, int code, const char* message);
+    void (*logSetLevel)(int level);
+
+    // Tracing
+    void (*traceBegin)(unsigned int id);
+    void (*traceEnd)(unsigned int id);
+    void (*traceCounter)(unsigned int id, long long value);
+    void (*traceRegisterName)(unsigned int id, const char* name);
+
+    // Crash handling
+    void (*heartbeat)();
+    void (*reportManagedException)(const char* description);
+    void (*registerManagedSymbolResolver)(const char* (*resolverFunc)(DWORD64));
+    void (*registerManagedExtraInfoResolver)(const char* (*resolverFunc)());
+    void (*registerManagedBatchSymbolResolver)(int (*resolverFunc)(const DWORD64*, int, char*, int, int*));
+    void (*registerManagedStackCapture)(int (*captureFunc)(ManagedStackFrame*, int));
+
+    // Memory
+    int (*memoryMapSnapshot)();
+    int (*memoryMapRefresh)(const void* address, size_t size);
+    bool (*memoryMapQuery)(const void* address, MemoryRegion* region);
+    int (*scanModulePatterns)(const wchar_t* moduleName, const char** patterns, int count, ULONG_PTR* results);
+    int (*scanMemoryPatterns)(const void* begin, size_t length, const char** patterns, int count, ULONG_PTR* results);
+
+    // Hooks
+    int (*hookBeginTransaction)();
+    int (*hookCommitTransaction)();
+    void (*hookAbortTransaction)();
+    int (*hookCreate)(void* target, void* detour, void** original);
+    int (*hookRemove)(void* target);
+
+    // Telemetry, added in version 2
+    bool (*telemetrySetCounter)(int id, long long value);
+    bool (*telemetryAddCounter)(int id, long long delta);
+    void (*telemetryReportGc)(long long gen0, long long gen1, long long gen2);
+    bool (*telemetryPush)(unsigned int id, long long value, const char* payload, int length);
+};
+
+// Exports for managed code. Static, valid for the life of the process.
+extern "C" __declspec(dllexport) const NativeFunctionTable* GetNativeFunctions();
@@ -0,0 +1,214 @@
+// PluginManifest.cpp
+#include "pch.h"
+#include "PluginManifest.h"
+#include "Utf.h"
+#include <algorithm>
+
+PluginManifest::PluginManifest()
+    : m_file(INVALID_HANDLE_VALUE)
+    , m_mapping(nullptr)
+    , m_view(nullptr)
+    , m_viewSize(0)
+    , m_strings(nullptr)
+    , m_stringsSize(0)
+    , m_preloadNext(0)
+    , m_cancelPreload(false)
+{
+}
+
+PluginManifest::~PluginManifest() {
+    stopPreload();
+    close();
+}
+
+bool PluginManifest::open(const std::wstring& path) {
+    close();
+
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(PluginManifestHeader) || fileSize.QuadPart > MAXDWORD) {
+        close();
+        return false;
+    }
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping) {
+        m_view = (const BYTE*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!m_view) {
+        close();
+        return false;
+    }
+    m_viewSize = (size_t)fileSize.QuadPart;
+
+    const PluginManifestHeader* header = (const PluginManifestHeader*)m_view;
+    size_t entriesEnd = sizeof(PluginManifestHeader) + (size_t)header->entryCount * sizeof(PluginManifestEntry);
+    if (header->magic != PLUGIN_MANIFEST_MAGIC || header->version != PLUGIN_MANIFEST_VERSION
+        || entriesEnd > m_viewSize || header->stringsOffset < entriesEnd
+        || header->stringsOffset > m_viewSize || header->stringsSize > m_viewSize - header->stringsOffset) {
+        close();
+        return false;
+    }
+    m_strings = (const char*)m_view + header->stringsOffset;
+    m_stringsSize = header->stringsSize;
+
+    size_t separator = path.find_last_of(L"\\/");
+    m_directory = separator == std::wstring::npos ? std::wstring() : path.substr(0, separator + 1);
+
+    // Bad entries fail the whole manifest, half a boot order is worse than the default one
+    const PluginManifestEntry* entries = (const PluginManifestEntry*)(m_view + sizeof(PluginManifestHeader));
+    m_entries.reserve(header->entryCount);
+    for (WORD i = 0; i < header->entryCount; i++) {
+        PluginEntry entry;
+        entry.flags = entries[i].flags;
+        entry.group = entries[i].group;
+        if (!readString(entries[i].assemblyPath, &entry.assemblyPath) || entry.assemblyPath.empty()
+            || !readString(entries[i].typeName, &entry.typeName)
+            || !readString(entries[i].methodName, &entry.methodName)) {
+            close();
+            return false;
+        }
+        if ((entry.flags & PLUGIN_ENTRY_FLAG_ENTRY_POINT) && (entry.typeName.empty() || entry.methodName.empty())) {
+            close();
+            return false;
+        }
+
+        // Relative to the manifest unless rooted
+        bool rooted = entry.assemblyPath[0] == L'\\' || entry.assemblyPath[0] == L'/'
+            || (entry.assemblyPath.length() > 1 && entry.assemblyPath[1] == L':');
+        if (!rooted) {
+            entry.assemblyPath = m_directory + entry.assemblyPath;
+        }
+        m_entries.push_back(entry);
+    }
+    return true;
+}
+
+void PluginManifest::close() {
+    m_entries.clear();
+    m_strings = nullptr;
+    m_stringsSize = 0;
+    if (m_view) {
+        UnmapViewOfFile(m_view);
+        m_view = nullptr;
+    }
+    m_viewSize = 0;
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool PluginManifest::readString(DWORD offset, std::wstring* value) {
+    value->clear();
+    if (offset == PLUGIN_MANIFEST_NO_STRING) {
+        return true;
+    }
+    if (offset >= m_stringsSize) {
+        return false;
+    }
+
+    const char* start = m_strings + offset;
+    const char* end = (const char*)memchr(start, '\0', m_stringsSize - offset);
+    if (!end) {
+        return false;
+    }
+
+    size_t length = end - start;
+    value->resize(Utf::utf16Length(start, length) + 1);
+    int written = Utf::toUtf16(start, length, &(*value)[0], value->size());
+    if (written < 0) {
+        return false;
+    }
+    value->resize(written);
+    return true;
+}
+
+bool PluginManifest::startPreload() {
+    if (!m_preloadThreads.empty() || m_entries.empty()) {
+        return false;
+    }
+
+    // Lower groups are needed first; within a group keep the manifest order
+    std::vector<size_t> order(m_entries.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [this](size_t a, size_t b) { return m_entries[a].group < m_entries[b].group; });
+
+    m_preloadPaths.clear();
+    for (size_t index : order) {
+        m_preloadPaths.push_back(m_entries[index].assemblyPath);
+    }
+    m_preloadNext = 0;
+    m_cancelPreload = false;
+
+    size_t threadCount = (std::min)((size_t)PLUGIN_PRELOAD_THREADS, m_preloadPaths.size());
+    for (size_t i = 0; i < threadCount; i++) {
+        HANDLE thread = CreateThread(nullptr, 0, preloadThreadProc, this, 0, nullptr);
+        if (thread) {
+            m_preloadThreads.push_back(thread);
+        }
+    }
+    return !m_preloadThreads.empty();
+}
+
+void PluginManifest::stopPreload() {
+    if (m_preloadThreads.empty()) {
+        return;
+    }
+
+    // Workers check for cancellation between chunks, and they read
+    // m_preloadPaths, so they have to be gone before anything is released
+    m_cancelPreload = true;
+    WaitForMultipleObjects((DWORD)m_preloadThreads.size(), m_preloadThreads.data(), TRUE, INFINITE);
+    for (HANDLE thread : m_preloadThreads) {
+        CloseHandle(thread);
+    }
+    m_preloadThreads.clear();
+}
+
+DWORD WINAPI PluginManifest::preloadThreadProc(LPVOID param) {
+    ((PluginManifest*)param)->preloadLoop();
+    return 0;
+}
+
+void PluginManifest::preloadLoop() {
+    // The data is thrown away, what we're after is the file cache
+    BYTE* buffer = (BYTE*)VirtualAlloc(nullptr, PLUGIN_PRELOAD_CHUNK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!buffer) {
+        return;
+    }
+
+    while (!m_cancelPreload) {
+        size_t index = m_preloadNext.fetch_add(1);
+        if (index >= m_preloadPaths.size()) {
+            break;
+        }
+        preloadFile(m_preloadPaths[index], buffer);
+    }
+
+    VirtualFree(buffer, 0, MEM_RELEASE);
+}
+
+void PluginManifest::preloadFile(const std::wstring& path, BYTE* buffer) {
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    DWORD bytesRead = 0;
+    while (!m_cancelPreload && ReadFile(hFile, buffer, PLUGIN_PRELOAD_CHUNK_SIZE, &bytesRead, nullptr) && bytesRead > 0) {
+    }
+    CloseHandle(hFile);
+}
@@ -0,0 +1,117 @@
+// PluginManifest.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <atomic>
+
+// Manifest file name, kept next to the injector
+#define PLUGIN_MANIFEST_FILE_NAME L"Chorizite.Injector.manifest"
+
+#define PLUGIN_MANIFEST_MAGIC 0x464D5043 // "CPMF"
+#define PLUGIN_MANIFEST_VERSION 1
+
+// String offset meaning "not set"
+#define PLUGIN_MANIFEST_NO_STRING 0xFFFFFFFF
+
+// Entry flags
+#define PLUGIN_ENTRY_FLAG_ENTRY_POINT 0x0001 // call typeName.methodName once loaded, otherwise preload only
+#define PLUGIN_ENTRY_FLAG_OPTIONAL    0x0002 // a failure is logged and skipped rather than aborting the boot
+
+// Workers reading assemblies ahead of the runtime, and the chunk each reads at a time
+#define PLUGIN_PRELOAD_THREADS 4
+#define PLUGIN_PRELOAD_CHUNK_SIZE (1024 * 1024)
+
+// The file is a header, `entryCount` entries in load order, then the string
+// table: NUL terminated UTF-8, addressed by offset from its start.
+struct PluginManifestHeader {
+    DWORD magic;
+    WORD version;
+    WORD entryCount;
+    DWORD stringsOffset;
+    DWORD stringsSize;
+};
+
+struct PluginManifestEntry {
+    DWORD assemblyPath;     // relative paths are relative to the manifest
+    DWORD typeName;         // assembly qualified
+    DWORD methodName;
+    WORD flags;
+    WORD group;             // lower groups load and initialize first
+};
+
+// One entry with its strings resolved
+struct PluginEntry {
+    std::wstring assemblyPath;
+    std::wstring typeName;
+    std::wstring methodName;
+    WORD flags;
+    WORD group;
+};
+
+// Boot manifest listing the assemblies Bootstrap loads and the entry points
+// it calls, replacing the single hard-coded bootstrapper. The file is mapped
+// rather than parsed into a tree; entries are only validated and decoded.
+//
+// Entries are independent components. Each entry point is resolved through
+// load_assembly_and_get_function_pointer, which gives every assembly its own
+// isolated AssemblyLoadContext, so entries don't share type identity: the
+// order only decides who initializes first. Assemblies that need each
+// other's types belong behind one entry point that loads them itself.
+//
+// While the runtime initializes, a few workers read every listed assembly
+// end to end, lowest groups first, so by the time the loader asks for them
+// they come out of the file cache instead of a serial cold read each.
+class PluginManifest {
+public:
+    static PluginManifest& getInstance() {
+        static PluginManifest instance;
+        return instance;
+    }
+
+    // Maps and validates the manifest, false if missing or malformed
+    bool open(const std::wstring& path);
+    void close();
+    bool isOpen() const { return m_view != nullptr; }
+
+    size_t getEntryCount() const { return m_entries.size(); }
+    const PluginEntry& getEntry(size_t index) const { return m_entries[index]; }
+
+    // Starts reading every entry's assembly in the background
+    bool startPreload();
+    void stopPreload();
+
+private:
+    PluginManifest();
+    ~PluginManifest();
+
+    // No copy or move
+    PluginManifest(const PluginManifest&) = delete;
+    PluginManifest& operator=(const PluginManifest&) = delete;
+    PluginManifest(PluginManifest&&) = delete;
+    PluginManifest& operator=(PluginManifest&&) = delete;
+
+    // String at `offset` in the table, false if it runs off the end
+    bool readString(DWORD offset, std::wstring* value);
+
+    static DWORD WINAPI preloadThreadProc(LPVOID param);
+    void preloadLoop();
+    void preloadFile(const std::wstring& path, BYTE* buffer);
+
+    HANDLE m_file;
+    HANDLE m_mapping;
+    const BYTE* m_view;
+    size_t m_viewSize;
+    const char* m_strings;
+    size_t m_stringsSize;
+    std::wstring m_directory;
+
+    std::vector<PluginEntry> m_entries;
+
+    // Paths in preload order, workers take the next one
+    std::vector<std::wstring> m_preloadPaths;
+    std::atomic<size_t> m_preloadNext;
+    volatile bool m_cancelPreload;
+    std::vector<HANDLE> m_preloadThreads;
+};
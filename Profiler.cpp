@@ -0,0 +1,235 @@
+// Profiler.cpp
+#include "pch.h"
+#include "Profiler.h"
+#include "FrameWalker.h"
+#include "CrashHandler.h"
+#include "Threads.h"
+#include "Hash.h"
+#include <fstream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <timeapi.h>
+
+#pragma comment(lib, "winmm.lib")
+
+Profiler::Profiler()
+    : m_totalSamples(0)
+    , m_droppedSamples(0)
+    , m_thread(nullptr)
+    , m_stopEvent(nullptr)
+    , m_threadId(0)
+    , m_intervalMs(10)
+{
+}
+
+Profiler::~Profiler() {
+    stop();
+}
+
+bool Profiler::start(DWORD intervalMs) {
+    if (m_thread) {
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_tableMutex);
+        if (!m_buckets) {
+            m_buckets.reset(new StackBucket[PROFILER_TABLE_SIZE]);
+            memset(m_buckets.get(), 0, sizeof(StackBucket) * PROFILER_TABLE_SIZE);
+        }
+    }
+
+    m_intervalMs = intervalMs > 0 ? intervalMs : 1;
+    m_stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!m_stopEvent) {
+        return false;
+    }
+
+    // Default timer resolution is ~15ms, anything finer needs the system timer bumped
+    if (m_intervalMs < 16) {
+        timeBeginPeriod(1);
+    }
+
+    m_thread = CreateThread(nullptr, 0, samplerThreadProc, this, 0, &m_threadId);
+    if (!m_thread) {
+        if (m_intervalMs < 16) {
+            timeEndPeriod(1);
+        }
+        CloseHandle(m_stopEvent);
+        m_stopEvent = nullptr;
+        return false;
+    }
+
+    SetThreadPriority(m_thread, THREAD_PRIORITY_TIME_CRITICAL);
+    return true;
+}
+
+void Profiler::stop() {
+    if (!m_thread) {
+        return;
+    }
+
+    SetEvent(m_stopEvent);
+    WaitForSingleObject(m_thread, INFINITE);
+    CloseHandle(m_thread);
+    CloseHandle(m_stopEvent);
+    m_thread = nullptr;
+    m_stopEvent = nullptr;
+    m_threadId = 0;
+
+    if (m_intervalMs < 16) {
+        timeEndPeriod(1);
+    }
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(m_tableMutex);
+    if (m_buckets) {
+        memset(m_buckets.get(), 0, sizeof(StackBucket) * PROFILER_TABLE_SIZE);
+    }
+    m_totalSamples = 0;
+    m_droppedSamples = 0;
+}
+
+DWORD WINAPI Profiler::samplerThreadProc(LPVOID param) {
+    Profiler* profiler = (Profiler*)param;
+
+    while (WaitForSingleObject(profiler->m_stopEvent, profiler->m_intervalMs) == WAIT_TIMEOUT) {
+        profiler->sampleAllThreads();
+    }
+
+    return 0;
+}
+
+void Profiler::sampleAllThreads() {
+    // Collect the thread list before suspending anything. We run on the sampler thread, so it's left out.
+    DWORD threadIds[PROFILER_MAX_THREADS];
+    size_t threadCount = 0;
+    Threads::forEachOther([&](DWORD threadId) {
+        threadIds[threadCount++] = threadId;
+        return threadCount < PROFILER_MAX_THREADS;
+    });
+
+    DWORD64 pcs[PROFILER_MAX_DEPTH];
+    for (size_t i = 0; i < threadCount; i++) {
+        HANDLE hThread = Threads::suspend(threadIds[i], THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION);
+        if (!hThread) {
+            continue;
+        }
+
+        // Nothing that could take a lock happens while the thread is stopped,
+        // the walk only reads its stack and the images' unwind tables
+        size_t depth = FrameWalker::walkThread(hThread, pcs, nullptr, PROFILER_MAX_DEPTH);
+        Threads::resume(hThread);
+
+        if (depth > 0) {
+            recordSample(pcs, depth);
+        }
+    }
+}
+
+void Profiler::recordSample(const DWORD64* pcs, size_t depth) {
+    // FNV-1a over the raw pcs
+    DWORD64 hash = Hash::fnv1a(pcs, depth * sizeof(DWORD64));
+    if (hash == 0) {
+        hash = 1;
+    }
+
+    std::lock_guard<std::mutex> lock(m_tableMutex);
+    m_totalSamples++;
+
+    // Open addressing with linear probing, a zero hash marks an empty bucket
+    size_t mask = PROFILER_TABLE_SIZE - 1;
+    for (size_t probe = 0; probe < PROFILER_TABLE_SIZE; probe++) {
+        StackBucket& bucket = m_buckets[(hash + probe) & mask];
+
+        if (bucket.hash == 0) {
+            bucket.hash = hash;
+            bucket.count = 1;
+            bucket.depth = (DWORD)depth;
+            memcpy(bucket.pcs, pcs, depth * sizeof(DWORD64));
+            return;
+        }
+
+        if (bucket.hash == hash && bucket.depth == depth && memcmp(bucket.pcs, pcs, depth * sizeof(DWORD64)) == 0) {
+            bucket.count++;
+            return;
+        }
+    }
+
+    m_droppedSamples++;
+}
+
+bool Profiler::exportFolded(const std::wstring& path) {
+    // Copy the table out so sampling carries on while we symbolize
+    std::vector<StackBucket> stacks;
+    {
+        std::lock_guard<std::mutex> lock(m_tableMutex);
+        if (!m_buckets) {
+            return false;
+        }
+        for (size_t i = 0; i < PROFILER_TABLE_SIZE; i++) {
+            if (m_buckets[i].hash != 0) {
+                stacks.push_back(m_buckets[i]);
+            }
+        }
+    }
+
+    // Resolve every distinct pc once, in a single batch
+    std::vector<DWORD64> addresses;
+    for (const auto& stack : stacks) {
+        addresses.insert(addresses.end(), stack.pcs, stack.pcs + stack.depth);
+    }
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+    CrashHandler& crashHandler = CrashHandler::getInstance();
+    if (!crashHandler.ensureSymbols()) {
+        return false;
+    }
+    std::vector<std::string> symbols = crashHandler.resolveSymbols(addresses);
+    std::unordered_map<DWORD64, std::string> names;
+    for (size_t i = 0; i < addresses.size(); i++) {
+        std::string name = symbols[i];
+        // ';' separates frames in the folded format
+        std::replace(name.begin(), name.end(), ';', ':');
+        names[addresses[i]] = name;
+    }
+
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+
+    for (const auto& stack : stacks) {
+        // Folded stacks run from the root to the leaf
+        for (DWORD i = stack.depth; i > 0; i--) {
+            out << names[stack.pcs[i - 1]];
+            if (i > 1) {
+                out << ";";
+            }
+        }
+        out << " " << stack.count << "\n";
+    }
+
+    return true;
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) bool StartProfiler(int intervalMs) {
+    return Profiler::getInstance().start(intervalMs > 0 ? (DWORD)intervalMs : 1);
+}
+
+extern "C" __declspec(dllexport) void StopProfiler() {
+    Profiler::getInstance().stop();
+}
+
+extern "C" __declspec(dllexport) void ResetProfile() {
+    Profiler::getInstance().reset();
+}
+
+extern "C" __declspec(dllexport) bool ExportProfile(const wchar_t* path) {
+    if (!path) return false;
+    return Profiler::getInstance().exportFolded(path);
+}
@@ -0,0 +1,74 @@
+// Profiler.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <memory>
+#include <mutex>
+
+// Deepest stack kept per sample, deeper frames are cut off at the root end
+#define PROFILER_MAX_DEPTH 64
+
+// Distinct stacks the folded table holds, must be a power of two
+#define PROFILER_TABLE_SIZE 8192
+
+// Most threads suspended per sampling pass
+#define PROFILER_MAX_THREADS 512
+
+// In-process sampling profiler. A background thread periodically suspends
+// every other thread, walks its stack with FrameWalker and folds the raw pcs
+// into a fixed size hash table. Symbols are only resolved on export, through
+// CrashHandler, so managed frames come out with managed names.
+class Profiler {
+public:
+    static Profiler& getInstance() {
+        static Profiler instance;
+        return instance;
+    }
+
+    bool start(DWORD intervalMs);
+    void stop();
+    bool isRunning() const { return m_thread != nullptr; }
+
+    // Drops all collected samples
+    void reset();
+
+    // Writes one "root;...;leaf count" line per distinct stack
+    bool exportFolded(const std::wstring& path);
+
+private:
+    struct StackBucket {
+        DWORD64 hash;
+        DWORD count;
+        DWORD depth;
+        DWORD64 pcs[PROFILER_MAX_DEPTH];
+    };
+
+    Profiler();
+    ~Profiler();
+
+    // No copy or move
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+    Profiler(Profiler&&) = delete;
+    Profiler& operator=(Profiler&&) = delete;
+
+    static DWORD WINAPI samplerThreadProc(LPVOID param);
+    void sampleAllThreads();
+    void recordSample(const DWORD64* pcs, size_t depth);
+
+    std::unique_ptr<StackBucket[]> m_buckets;
+    DWORD m_totalSamples;
+    DWORD m_droppedSamples;
+    std::mutex m_tableMutex;
+
+    HANDLE m_thread;
+    HANDLE m_stopEvent;
+    DWORD m_threadId;
+    DWORD m_intervalMs;
+};
+
+extern "C" __declspec(dllexport) bool StartProfiler(int intervalMs);
+extern "C" __declspec(dllexport) void StopProfiler();
+extern "C" __declspec(dllexport) void ResetProfile();
+extern "C" __declspec(dllexport) bool ExportProfile(const wchar_t* path);
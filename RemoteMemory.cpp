@@ -0,0 +1,316 @@
+// RemoteMemory.cpp
+#include "pch.h"
+#include "RemoteMemory.h"
+#include <algorithm>
+
+RemoteMemory::RemoteMemory() {
+}
+
+RemoteMemory::~RemoteMemory() {
+    for (auto& process : m_processes) {
+        CloseHandle(process.second.handle);
+    }
+    for (auto& process : m_closing) {
+        CloseHandle(process.handle);
+    }
+}
+
+HANDLE RemoteMemory::acquireProcess(DWORD processId) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_processes.find(processId);
+    if (it != m_processes.end()) {
+        it->second.users++;
+        return it->second.handle;
+    }
+
+    // Holding the handle also keeps the pid from being reused under us
+    HANDLE hProcess = OpenProcess(PROCESS_VM_READ | PROCESS_VM_WRITE | PROCESS_VM_OPERATION | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+    if (hProcess) {
+        CachedProcess process = { hProcess, 1 };
+        m_processes[processId] = process;
+    }
+    return hProcess;
+}
+
+void RemoteMemory::releaseProcess(DWORD processId, HANDLE hProcess) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_processes.find(processId);
+    if (it != m_processes.end() && it->second.handle == hProcess) {
+        it->second.users--;
+        return;
+    }
+
+    // Closed while we were using it, the last one out closes the handle
+    for (auto closing = m_closing.begin(); closing != m_closing.end(); ++closing) {
+        if (closing->handle == hProcess) {
+            if (--closing->users == 0) {
+                CloseHandle(closing->handle);
+                m_closing.erase(closing);
+            }
+            return;
+        }
+    }
+}
+
+void RemoteMemory::closeProcess(DWORD processId) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_processes.find(processId);
+    if (it != m_processes.end()) {
+        if (it->second.users == 0) {
+            CloseHandle(it->second.handle);
+        }
+        else {
+            m_closing.push_back(it->second);
+        }
+        m_processes.erase(it);
+    }
+}
+
+size_t RemoteMemory::getPointerSize(HANDLE hProcess) {
+#ifdef _WIN64
+    BOOL wow64 = FALSE;
+    return IsWow64Process(hProcess, &wow64) && wow64 ? 4 : 8;
+#else
+    // We can't read a 64-bit process from here anyway
+    return 4;
+#endif
+}
+
+void RemoteMemory::readTransfers(HANDLE hProcess, std::vector<Transfer>& transfers) {
+    std::sort(transfers.begin(), transfers.end(),
+        [](const Transfer& a, const Transfer& b) { return a.address < b.address; });
+
+    std::vector<BYTE> scratch;
+    size_t first = 0;
+    while (first < transfers.size()) {
+        // Grow the span while the next transfer is close enough and it stays bounded
+        ULONG64 spanStart = transfers[first].address;
+        ULONG64 spanEnd = spanStart + transfers[first].length;
+        size_t last = first + 1;
+        while (last < transfers.size()) {
+            ULONG64 nextEnd = (std::max)(spanEnd, transfers[last].address + transfers[last].length);
+            if (transfers[last].address > spanEnd + REMOTE_MEMORY_COALESCE_GAP || nextEnd - spanStart > REMOTE_MEMORY_MAX_SPAN) {
+                break;
+            }
+            spanEnd = nextEnd;
+            last++;
+        }
+
+        bool merged = false;
+        if (last - first > 1) {
+            scratch.resize((size_t)(spanEnd - spanStart));
+            SIZE_T bytesRead = 0;
+            if (ReadProcessMemory(hProcess, (LPCVOID)(ULONG_PTR)spanStart, scratch.data(), scratch.size(), &bytesRead) && bytesRead == scratch.size()) {
+                for (size_t i = first; i < last; i++) {
+                    memcpy(transfers[i].buffer, scratch.data() + (transfers[i].address - spanStart), transfers[i].length);
+                    *transfers[i].status = ERROR_SUCCESS;
+                }
+                merged = true;
+            }
+        }
+
+        // Single transfers, or a span that hit something unreadable
+        if (!merged) {
+            for (size_t i = first; i < last; i++) {
+                SIZE_T bytesRead = 0;
+                if (ReadProcessMemory(hProcess, (LPCVOID)(ULONG_PTR)transfers[i].address, transfers[i].buffer, transfers[i].length, &bytesRead) && bytesRead == transfers[i].length) {
+                    *transfers[i].status = ERROR_SUCCESS;
+                }
+                else {
+                    DWORD error = GetLastError();
+                    *transfers[i].status = error ? error : ERROR_PARTIAL_COPY;
+                }
+            }
+        }
+
+        first = last;
+    }
+}
+
+void RemoteMemory::writeOne(HANDLE hProcess, const Transfer& transfer) {
+    SIZE_T bytesWritten = 0;
+    if (WriteProcessMemory(hProcess, (LPVOID)(ULONG_PTR)transfer.address, transfer.buffer, transfer.length, &bytesWritten) && bytesWritten == transfer.length) {
+        *transfer.status = ERROR_SUCCESS;
+    }
+    else {
+        DWORD error = GetLastError();
+        *transfer.status = error ? error : ERROR_PARTIAL_COPY;
+    }
+}
+
+void RemoteMemory::writeTransfers(HANDLE hProcess, std::vector<Transfer>& transfers) {
+    std::sort(transfers.begin(), transfers.end(),
+        [](const Transfer& a, const Transfer& b) { return a.address < b.address; });
+
+    // Sorted by start, so a transfer overlapping any later one overlaps the next
+    auto overlapsNext = [&transfers](size_t i) {
+        return i + 1 < transfers.size() && transfers[i + 1].address < transfers[i].address + transfers[i].length;
+    };
+
+    std::vector<BYTE> scratch;
+    size_t first = 0;
+    while (first < transfers.size()) {
+        // Overlapping writes go out one by one in request order, so the later request wins
+        if (overlapsNext(first)) {
+            ULONG64 clusterEnd = transfers[first].address + transfers[first].length;
+            size_t last = first + 1;
+            while (last < transfers.size() && transfers[last].address < clusterEnd) {
+                clusterEnd = (std::max)(clusterEnd, transfers[last].address + transfers[last].length);
+                last++;
+            }
+            std::sort(transfers.begin() + first, transfers.begin() + last,
+                [](const Transfer& a, const Transfer& b) { return a.order < b.order; });
+            for (size_t i = first; i < last; i++) {
+                writeOne(hProcess, transfers[i]);
+            }
+            first = last;
+            continue;
+        }
+
+        // Only back to back writes merge, a gap would write bytes nobody asked for
+        ULONG64 spanStart = transfers[first].address;
+        ULONG64 spanEnd = spanStart + transfers[first].length;
+        size_t last = first + 1;
+        while (last < transfers.size() && transfers[last].address == spanEnd && !overlapsNext(last)
+            && spanEnd + transfers[last].length - spanStart <= REMOTE_MEMORY_MAX_SPAN) {
+            spanEnd += transfers[last].length;
+            last++;
+        }
+
+        bool merged = false;
+        if (last - first > 1) {
+            scratch.resize((size_t)(spanEnd - spanStart));
+            for (size_t i = first; i < last; i++) {
+                memcpy(scratch.data() + (transfers[i].address - spanStart), transfers[i].buffer, transfers[i].length);
+            }
+            SIZE_T bytesWritten = 0;
+            if (WriteProcessMemory(hProcess, (LPVOID)(ULONG_PTR)spanStart, scratch.data(), scratch.size(), &bytesWritten) && bytesWritten == scratch.size()) {
+                for (size_t i = first; i < last; i++) {
+                    *transfers[i].status = ERROR_SUCCESS;
+                }
+                merged = true;
+            }
+        }
+
+        if (!merged) {
+            for (size_t i = first; i < last; i++) {
+                writeOne(hProcess, transfers[i]);
+            }
+        }
+
+        first = last;
+    }
+}
+
+void RemoteMemory::resolveChains(HANDLE hProcess, RemoteMemoryRequest* requests, int count) {
+    size_t pointerSize = getPointerSize(hProcess);
+    DWORD deepest = 0;
+    for (int i = 0; i < count; i++) {
+        requests[i].resolvedAddress = requests[i].address;
+        requests[i].status = ERROR_SUCCESS;
+        if (requests[i].offsetCount > REMOTE_MEMORY_MAX_CHAIN) {
+            requests[i].status = ERROR_INVALID_PARAMETER;
+            continue;
+        }
+        deepest = (std::max)(deepest, requests[i].offsetCount);
+    }
+
+    // One batch per level, every chain still going takes its next step together
+    std::vector<ULONG64> pointers(count);
+    std::vector<Transfer> transfers;
+    for (DWORD level = 0; level < deepest; level++) {
+        transfers.clear();
+        for (int i = 0; i < count; i++) {
+            if (requests[i].status != ERROR_SUCCESS || requests[i].offsetCount <= level) {
+                continue;
+            }
+            pointers[i] = 0;
+            Transfer transfer = { requests[i].resolvedAddress, (BYTE*)&pointers[i], (DWORD)pointerSize, &requests[i].status, i };
+            transfers.push_back(transfer);
+        }
+        readTransfers(hProcess, transfers);
+
+        for (int i = 0; i < count; i++) {
+            if (requests[i].status != ERROR_SUCCESS || requests[i].offsetCount <= level) {
+                continue;
+            }
+            if (pointers[i] == 0) {
+                requests[i].status = ERROR_INVALID_ADDRESS;
+                continue;
+            }
+            requests[i].resolvedAddress = pointers[i] + (LONGLONG)requests[i].offsets[level];
+        }
+    }
+}
+
+void RemoteMemory::collectTransfers(RemoteMemoryRequest* requests, int count, std::vector<Transfer>* transfers) {
+    transfers->reserve(count);
+    for (int i = 0; i < count; i++) {
+        if (requests[i].status != ERROR_SUCCESS || requests[i].length == 0) {
+            continue;
+        }
+        if (!requests[i].buffer) {
+            requests[i].status = ERROR_INVALID_PARAMETER;
+            continue;
+        }
+        Transfer transfer = { requests[i].resolvedAddress, (BYTE*)requests[i].buffer, requests[i].length, &requests[i].status, i };
+        transfers->push_back(transfer);
+    }
+}
+
+int RemoteMemory::countSucceeded(const RemoteMemoryRequest* requests, int count) {
+    int succeeded = 0;
+    for (int i = 0; i < count; i++) {
+        if (requests[i].status == ERROR_SUCCESS) {
+            succeeded++;
+        }
+    }
+    return succeeded;
+}
+
+int RemoteMemory::read(HANDLE hProcess, RemoteMemoryRequest* requests, int count) {
+    if (!hProcess || !requests || count <= 0) {
+        return 0;
+    }
+    resolveChains(hProcess, requests, count);
+
+    std::vector<Transfer> transfers;
+    collectTransfers(requests, count, &transfers);
+    readTransfers(hProcess, transfers);
+    return countSucceeded(requests, count);
+}
+
+int RemoteMemory::write(HANDLE hProcess, RemoteMemoryRequest* requests, int count) {
+    if (!hProcess || !requests || count <= 0) {
+        return 0;
+    }
+    resolveChains(hProcess, requests, count);
+
+    std::vector<Transfer> transfers;
+    collectTransfers(requests, count, &transfers);
+    writeTransfers(hProcess, transfers);
+    return countSucceeded(requests, count);
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) int RemoteReadBatch(DWORD processId, RemoteMemoryRequest* requests, int count) {
+    RemoteMemory& remoteMemory = RemoteMemory::getInstance();
+    HANDLE hProcess = remoteMemory.acquireProcess(processId);
+    if (!hProcess) return 0;
+    int succeeded = RemoteMemory::read(hProcess, requests, count);
+    remoteMemory.releaseProcess(processId, hProcess);
+    return succeeded;
+}
+
+extern "C" __declspec(dllexport) int RemoteWriteBatch(DWORD processId, RemoteMemoryRequest* requests, int count) {
+    RemoteMemory& remoteMemory = RemoteMemory::getInstance();
+    HANDLE hProcess = remoteMemory.acquireProcess(processId);
+    if (!hProcess) return 0;
+    int succeeded = RemoteMemory::write(hProcess, requests, count);
+    remoteMemory.releaseProcess(processId, hProcess);
+    return succeeded;
+}
+
+extern "C" __declspec(dllexport) void RemoteMemoryRelease(DWORD processId) {
+    RemoteMemory::getInstance().closeProcess(processId);
+}
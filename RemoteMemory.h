@@ -0,0 +1,110 @@
+// RemoteMemory.h
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+#include <map>
+#include <mutex>
+
+// Deepest pointer chain a request can follow
+#define REMOTE_MEMORY_MAX_CHAIN 8
+
+// Unrequested bytes worth reading between two requests to save a call
+#define REMOTE_MEMORY_COALESCE_GAP 512
+
+// Largest single coalesced read
+#define REMOTE_MEMORY_MAX_SPAN (64 * 1024)
+
+// One field to read or write. Fixed layout, it's filled in by managed code.
+//
+// With a chain, `address` is dereferenced once per offset and the offset is
+// added after each read: for offsets {a, b} the data lives at
+// *( *(address) + a ) + b. Pointers are the target's size.
+struct RemoteMemoryRequest {
+    ULONG64 address;
+    void* buffer;               // destination for reads, source for writes
+    DWORD length;
+    DWORD offsetCount;
+    LONG offsets[REMOTE_MEMORY_MAX_CHAIN];
+    ULONG64 resolvedAddress;    // out: where the data was, after the chain
+    DWORD status;               // out: ERROR_SUCCESS or why this one failed
+    DWORD reserved;
+};
+
+// Scatter/gather access to another process's memory. A batch sorts its
+// requests by address and merges neighbours into a few large
+// ReadProcessMemory calls, scattering the results back, so reading hundreds
+// of fields per tick costs a handful of calls per client instead of one
+// each. Pointer chains are resolved level by level, each level as one
+// coalesced batch of its own.
+//
+// If a merged read fails, say one page in the span isn't mapped, its
+// requests are retried one by one so a bad field only fails itself.
+// Writes that overlap each other are never merged, they land one by one in
+// request order so the later request wins.
+class RemoteMemory {
+public:
+    static RemoteMemory& getInstance() {
+        static RemoteMemory instance;
+        return instance;
+    }
+
+    // Both return how many requests succeeded
+    static int read(HANDLE hProcess, RemoteMemoryRequest* requests, int count);
+    static int write(HANDLE hProcess, RemoteMemoryRequest* requests, int count);
+
+    // Handles kept per pid so a batch doesn't open the process every tick.
+    // Every acquire is paired with a release; closing a pid while batches
+    // still use its handle defers the CloseHandle to the last release.
+    HANDLE acquireProcess(DWORD processId);
+    void releaseProcess(DWORD processId, HANDLE hProcess);
+    void closeProcess(DWORD processId);
+
+private:
+    // A contiguous run of bytes to move, possibly part of a merged call
+    struct Transfer {
+        ULONG64 address;
+        BYTE* buffer;
+        DWORD length;
+        DWORD* status;
+        int order;          // index of the request it came from
+    };
+
+    struct CachedProcess {
+        HANDLE handle;
+        LONG users;         // batches in flight
+    };
+
+    RemoteMemory();
+    ~RemoteMemory();
+
+    // No copy or move
+    RemoteMemory(const RemoteMemory&) = delete;
+    RemoteMemory& operator=(const RemoteMemory&) = delete;
+    RemoteMemory(RemoteMemory&&) = delete;
+    RemoteMemory& operator=(RemoteMemory&&) = delete;
+
+    static size_t getPointerSize(HANDLE hProcess);
+
+    // Follows every request's chain, filling resolvedAddress; failed ones get a status
+    static void resolveChains(HANDLE hProcess, RemoteMemoryRequest* requests, int count);
+
+    // Transfers for every request that resolved and has somewhere to go
+    static void collectTransfers(RemoteMemoryRequest* requests, int count, std::vector<Transfer>* transfers);
+    static int countSucceeded(const RemoteMemoryRequest* requests, int count);
+
+    static void readTransfers(HANDLE hProcess, std::vector<Transfer>& transfers);
+    static void writeTransfers(HANDLE hProcess, std::vector<Transfer>& transfers);
+    static void writeOne(HANDLE hProcess, const Transfer& transfer);
+
+    std::map<DWORD, CachedProcess> m_processes;
+
+    // Closed by pid while still in use, freed by their last release
+    std::vector<CachedProcess> m_closing;
+    std::mutex m_mutex;
+};
+
+// Exports for managed code
+extern "C" __declspec(dllexport) int RemoteReadBatch(DWORD processId, RemoteMemoryRequest* requests, int count);
+extern "C" __declspec(dllexport) int RemoteWriteBatch(DWORD processId, RemoteMemoryRequest* requests, int count);
+extern "C" __declspec(dllexport) void RemoteMemoryRelease(DWORD processId);
@@ -0,0 +1,342 @@
+// RuntimePropertyCache.cpp
+#include "pch.h"
+#include "RuntimePropertyCache.h"
+#include "Utf.h"
+#include <algorithm>
+
+// Never cached: points into hostpolicy's memory in the process that resolved it
+static const wchar_t* g_processSpecificProperties[] = { L"HOST_RUNTIME_CONTRACT" };
+
+namespace {
+    void appendBytes(std::vector<char>& out, const void* data, size_t size) {
+        const char* bytes = (const char*)data;
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    void appendDword(std::vector<char>& out, DWORD value) {
+        appendBytes(out, &value, sizeof(value));
+    }
+
+    // Bounds checked reads over the loaded file
+    struct CacheReader {
+        const char* data;
+        size_t size;
+        size_t offset;
+
+        bool read(void* destination, size_t length) {
+            if (length > size - offset) {
+                return false;
+            }
+            memcpy(destination, data + offset, length);
+            offset += length;
+            return true;
+        }
+
+        const char* take(size_t length) {
+            if (length > size - offset) {
+                return nullptr;
+            }
+            const char* start = data + offset;
+            offset += length;
+            return start;
+        }
+    };
+
+    // Which runtimeconfig and overrides the cache was resolved for, profiles can share a directory
+    std::wstring getCacheKey(const std::wstring& runtimeConfigPath, const std::wstring& overridesPath) {
+        return runtimeConfigPath + L"|" + overridesPath;
+    }
+
+    const wchar_t* findProperty(size_t count, const wchar_t** keys, const wchar_t** values, const wchar_t* name) {
+        for (size_t i = 0; i < count; i++) {
+            if (keys[i] && values[i] && wcscmp(keys[i], name) == 0) {
+                return values[i];
+            }
+        }
+        return nullptr;
+    }
+}
+
+RuntimePropertyCache::RuntimePropertyCache() {
+}
+
+RuntimePropertyCache::~RuntimePropertyCache() {
+}
+
+std::wstring RuntimePropertyCache::getDirectory(const std::wstring& path) {
+    size_t end = path.length();
+    while (end > 0 && (path[end - 1] == L'\\' || path[end - 1] == L'/')) {
+        end--;
+    }
+    size_t separator = path.find_last_of(L"\\/", end ? end - 1 : 0);
+    return separator == std::wstring::npos ? std::wstring() : path.substr(0, separator + 1);
+}
+
+std::wstring RuntimePropertyCache::getCachePath(const std::wstring& runtimeConfigPath) {
+    return getDirectory(runtimeConfigPath) + RUNTIME_PROPERTY_CACHE_FILE_NAME;
+}
+
+ULONG64 RuntimePropertyCache::getLastWriteTime(const std::wstring& path) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &attributes)) {
+        return 0;
+    }
+    return ((ULONG64)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+}
+
+bool RuntimePropertyCache::collectWatchedPaths(const std::wstring& runtimeConfigPath, const std::wstring& overridesPath,
+    const std::wstring& coreClrPath, const std::wstring& appDirectory, const std::wstring& depsFiles,
+    std::vector<WatchedPath>* watched) {
+    std::vector<std::wstring> paths;
+    paths.push_back(coreClrPath);
+    paths.push_back(runtimeConfigPath);
+
+    // Probing paths can come from the dev config, which may show up later
+    const std::wstring configSuffix = L".json";
+    if (runtimeConfigPath.length() > configSuffix.length()) {
+        paths.push_back(runtimeConfigPath.substr(0, runtimeConfigPath.length() - configSuffix.length()) + L".dev.json");
+    }
+    if (!overridesPath.empty()) {
+        paths.push_back(overridesPath);
+    }
+
+    // Without an app deps file the app's assemblies come from a directory
+    // listing, and that directory is also where the cache and logs live
+    bool appDeps = false;
+    size_t start = 0;
+    while (start < depsFiles.length()) {
+        size_t end = depsFiles.find(L';', start);
+        if (end == std::wstring::npos) {
+            end = depsFiles.length();
+        }
+        std::wstring depsFile = depsFiles.substr(start, end - start);
+        start = end + 1;
+        if (depsFile.empty()) {
+            continue;
+        }
+
+        paths.push_back(depsFile);
+        std::wstring directory = getDirectory(depsFile);
+        if (_wcsicmp(directory.c_str(), appDirectory.c_str()) == 0) {
+            appDeps = true;
+        }
+        else {
+            // A framework: its version directory and the list of installed versions
+            paths.push_back(directory);
+            paths.push_back(getDirectory(directory));
+        }
+    }
+    if (!appDeps) {
+        return false;
+    }
+
+    watched->clear();
+    for (const auto& path : paths) {
+        WatchedPath entry;
+        entry.path = path;
+        entry.lastWriteTime = getLastWriteTime(path);
+        watched->push_back(entry);
+    }
+    return true;
+}
+
+bool RuntimePropertyCache::load(const std::wstring& runtimeConfigPath, const std::wstring& overridesPath) {
+    m_path = getCachePath(runtimeConfigPath);
+    m_coreClrPath.clear();
+    m_strings.clear();
+    m_keys.clear();
+    m_values.clear();
+
+    wchar_t setting[8];
+    DWORD settingLength = GetEnvironmentVariableW(RUNTIME_PROPERTY_CACHE_ENV, setting, 8);
+    if (settingLength > 0 && settingLength < 8 && wcscmp(setting, L"0") == 0) {
+        return false;
+    }
+
+    HANDLE hFile = CreateFileW(m_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    std::vector<char> data;
+    LARGE_INTEGER fileSize;
+    DWORD bytesRead = 0;
+    bool read = GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0 && fileSize.QuadPart <= RUNTIME_PROPERTY_CACHE_MAX_SIZE;
+    if (read) {
+        data.resize((size_t)fileSize.QuadPart);
+        read = ReadFile(hFile, data.data(), (DWORD)data.size(), &bytesRead, nullptr) && bytesRead == data.size();
+    }
+    CloseHandle(hFile);
+    if (!read) {
+        return false;
+    }
+
+    CacheReader reader = { data.data(), data.size(), 0 };
+    RuntimePropertyCacheHeader header;
+    if (!reader.read(&header, sizeof(header)) || header.magic != RUNTIME_PROPERTY_CACHE_MAGIC
+        || header.version != RUNTIME_PROPERTY_CACHE_VERSION || header.watchCount == 0) {
+        return false;
+    }
+
+    DWORD keyLength;
+    if (!reader.read(&keyLength, sizeof(keyLength))) {
+        return false;
+    }
+    const char* keyChars = reader.take((size_t)keyLength * sizeof(wchar_t));
+    std::wstring key = getCacheKey(runtimeConfigPath, overridesPath);
+    if (!keyChars || keyLength != key.length() || _wcsnicmp((const wchar_t*)keyChars, key.c_str(), keyLength) != 0) {
+        return false;
+    }
+
+    // Stale as soon as anything it was resolved from changed
+    for (DWORD i = 0; i < header.watchCount; i++) {
+        ULONG64 lastWriteTime;
+        DWORD length;
+        if (!reader.read(&lastWriteTime, sizeof(lastWriteTime)) || !reader.read(&length, sizeof(length))) {
+            return false;
+        }
+        const char* chars = reader.take((size_t)length * sizeof(wchar_t));
+        if (!chars) {
+            return false;
+        }
+
+        std::wstring path((const wchar_t*)chars, length);
+        if (getLastWriteTime(path) != lastWriteTime) {
+            return false;
+        }
+        if (i == 0) {
+            m_coreClrPath = path;
+        }
+    }
+
+    // Copy the strings out terminated, then point at them once the buffer stops moving
+    std::vector<size_t> offsets;
+    for (DWORD i = 0; i < header.propertyCount; i++) {
+        DWORD lengths[2];
+        if (!reader.read(lengths, sizeof(lengths))) {
+            return false;
+        }
+        for (int part = 0; part < 2; part++) {
+            const char* bytes = reader.take(lengths[part]);
+            if (!bytes) {
+                return false;
+            }
+            offsets.push_back(m_strings.size());
+            m_strings.insert(m_strings.end(), bytes, bytes + lengths[part]);
+            m_strings.push_back('\0');
+        }
+    }
+
+    for (size_t i = 0; i + 1 < offsets.size(); i += 2) {
+        m_keys.push_back(m_strings.data() + offsets[i]);
+        m_values.push_back(m_strings.data() + offsets[i + 1]);
+    }
+    return !m_keys.empty();
+}
+
+bool RuntimePropertyCache::save(const std::wstring& runtimeConfigPath, const std::wstring& overridesPath,
+    size_t count, const wchar_t** keys, const wchar_t** values) {
+    m_path = getCachePath(runtimeConfigPath);
+
+    // coreclr.dll sits next to System.Private.CoreLib in the framework directory
+    const wchar_t* tpa = findProperty(count, keys, values, L"TRUSTED_PLATFORM_ASSEMBLIES");
+    const wchar_t* appDirectory = findProperty(count, keys, values, L"APP_CONTEXT_BASE_DIRECTORY");
+    const wchar_t* depsFiles = findProperty(count, keys, values, L"APP_CONTEXT_DEPS_FILES");
+    if (!tpa || !appDirectory || !depsFiles) {
+        return false;
+    }
+
+    std::wstring assemblies = tpa;
+    const std::wstring coreLib = L"\\System.Private.CoreLib.dll";
+    size_t coreLibPosition = assemblies.find(coreLib);
+    if (coreLibPosition == std::wstring::npos) {
+        return false;
+    }
+    size_t coreLibStart = assemblies.rfind(L';', coreLibPosition);
+    coreLibStart = coreLibStart == std::wstring::npos ? 0 : coreLibStart + 1;
+    std::wstring coreClrPath = assemblies.substr(coreLibStart, coreLibPosition - coreLibStart) + L"\\coreclr.dll";
+    if (getLastWriteTime(coreClrPath) == 0) {
+        return false;
+    }
+
+    std::vector<WatchedPath> watched;
+    if (!collectWatchedPaths(runtimeConfigPath, overridesPath, coreClrPath, appDirectory, depsFiles, &watched)) {
+        return false;
+    }
+
+    std::vector<char> data;
+    data.resize(sizeof(RuntimePropertyCacheHeader));
+
+    std::wstring key = getCacheKey(runtimeConfigPath, overridesPath);
+    appendDword(data, (DWORD)key.length());
+    appendBytes(data, key.data(), key.length() * sizeof(wchar_t));
+
+    for (const auto& entry : watched) {
+        appendBytes(data, &entry.lastWriteTime, sizeof(entry.lastWriteTime));
+        appendDword(data, (DWORD)entry.path.length());
+        appendBytes(data, entry.path.data(), entry.path.length() * sizeof(wchar_t));
+    }
+
+    DWORD propertyCount = 0;
+    std::vector<char> utf8;
+    for (size_t i = 0; i < count; i++) {
+        if (!keys[i] || !values[i]) {
+            continue;
+        }
+
+        bool processSpecific = false;
+        for (const wchar_t* name : g_processSpecificProperties) {
+            if (wcscmp(keys[i], name) == 0) {
+                processSpecific = true;
+                break;
+            }
+        }
+        if (processSpecific) {
+            continue;
+        }
+
+        size_t keyLength = wcslen(keys[i]);
+        size_t valueLength = wcslen(values[i]);
+        size_t keyBytes = Utf::utf8Length(keys[i], keyLength);
+        size_t valueBytes = Utf::utf8Length(values[i], valueLength);
+        appendDword(data, (DWORD)keyBytes);
+        appendDword(data, (DWORD)valueBytes);
+
+        utf8.resize((std::max)(keyBytes, valueBytes) + 1);
+        Utf::toUtf8(keys[i], keyLength, utf8.data(), utf8.size());
+        appendBytes(data, utf8.data(), keyBytes);
+        Utf::toUtf8(values[i], valueLength, utf8.data(), utf8.size());
+        appendBytes(data, utf8.data(), valueBytes);
+        propertyCount++;
+    }
+
+    RuntimePropertyCacheHeader header = {};
+    header.magic = RUNTIME_PROPERTY_CACHE_MAGIC;
+    header.version = RUNTIME_PROPERTY_CACHE_VERSION;
+    header.watchCount = (DWORD)watched.size();
+    header.propertyCount = propertyCount;
+    memcpy(data.data(), &header, sizeof(header));
+
+    // Write beside the cache and swap it in, clients may be starting at the same time
+    std::wstring tempPath = m_path + L"." + std::to_wstring(GetCurrentProcessId()) + L".tmp";
+    HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    DWORD bytesWritten = 0;
+    bool written = WriteFile(hFile, data.data(), (DWORD)data.size(), &bytesWritten, nullptr) && bytesWritten == data.size();
+    CloseHandle(hFile);
+
+    if (!written || !MoveFileExW(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void RuntimePropertyCache::invalidate() {
+    if (!m_path.empty()) {
+        DeleteFileW(m_path.c_str());
+    }
+}
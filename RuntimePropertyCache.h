@@ -0,0 +1,94 @@
+// RuntimePropertyCache.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+// Cache file name, kept next to the runtimeconfig it was built from
+#define RUNTIME_PROPERTY_CACHE_FILE_NAME L"Chorizite.Injector.runtime.cache"
+
+#define RUNTIME_PROPERTY_CACHE_MAGIC 0x50525443 // "CTRP"
+#define RUNTIME_PROPERTY_CACHE_VERSION 1
+
+// Anything bigger isn't a cache we wrote
+#define RUNTIME_PROPERTY_CACHE_MAX_SIZE (4 * 1024 * 1024)
+
+// Set to 0 to always go through hostfxr
+#define RUNTIME_PROPERTY_CACHE_ENV L"CHORIZITE_RUNTIME_CACHE"
+
+struct RuntimePropertyCacheHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD watchCount;
+    DWORD propertyCount;
+};
+
+// The runtime properties hostfxr and hostpolicy resolved for a runtimeconfig
+// (TRUSTED_PLATFORM_ASSEMBLIES, probing paths, app context...), saved so the
+// next launch can hand them straight to coreclr_initialize instead of
+// resolving the framework and scanning its directories again.
+//
+// The file is the header, the runtimeconfig and overrides paths it is for,
+// the watched paths, then the properties as UTF-8 key/value pairs.
+//
+// Alongside the properties the cache records the last write time of every
+// file and directory the resolution depended on: coreclr.dll, the
+// runtimeconfig and its .dev.json, the overrides file, every deps file, and
+// for each framework its directory (whose path is the framework version) and
+// the directory of installed versions, so installing or updating a framework
+// invalidates it.
+class RuntimePropertyCache {
+public:
+    RuntimePropertyCache();
+    ~RuntimePropertyCache();
+
+    // Loads the cache for this runtimeconfig, false if missing or stale
+    bool load(const std::wstring& runtimeConfigPath, const std::wstring& overridesPath);
+
+    // Records a freshly resolved property set
+    bool save(const std::wstring& runtimeConfigPath, const std::wstring& overridesPath,
+        size_t count, const wchar_t** keys, const wchar_t** values);
+
+    // Deletes the file, for when starting from it failed
+    void invalidate();
+
+    // Loaded properties, UTF-8 as coreclr_initialize takes them
+    int getCount() const { return (int)m_keys.size(); }
+    const char** getKeys() { return m_keys.data(); }
+    const char** getValues() { return m_values.data(); }
+
+    // coreclr.dll of the resolved framework
+    const std::wstring& getCoreClrPath() const { return m_coreClrPath; }
+
+private:
+    struct WatchedPath {
+        std::wstring path;
+        ULONG64 lastWriteTime;
+    };
+
+    // No copy or move
+    RuntimePropertyCache(const RuntimePropertyCache&) = delete;
+    RuntimePropertyCache& operator=(const RuntimePropertyCache&) = delete;
+    RuntimePropertyCache(RuntimePropertyCache&&) = delete;
+    RuntimePropertyCache& operator=(RuntimePropertyCache&&) = delete;
+
+    static std::wstring getCachePath(const std::wstring& runtimeConfigPath);
+    static std::wstring getDirectory(const std::wstring& path);
+
+    // 0 if the path doesn't exist
+    static ULONG64 getLastWriteTime(const std::wstring& path);
+
+    // Everything the resolved properties depend on, coreclr.dll first. False if they can't be cached.
+    static bool collectWatchedPaths(const std::wstring& runtimeConfigPath, const std::wstring& overridesPath,
+        const std::wstring& coreClrPath, const std::wstring& appDirectory, const std::wstring& depsFiles,
+        std::vector<WatchedPath>* watched);
+
+    std::wstring m_path;
+    std::wstring m_coreClrPath;
+
+    // Property strings back to back, the pointer arrays point into it
+    std::vector<char> m_strings;
+    std::vector<const char*> m_keys;
+    std::vector<const char*> m_values;
+};
@@ -0,0 +1,251 @@
+// SignatureCache.cpp
+#include "pch.h"
+#include "SignatureCache.h"
+#include "Hash.h"
+
+SignatureCache::SignatureCache()
+    : m_loaded(false)
+{
+}
+
+SignatureCache::~SignatureCache() {
+}
+
+void SignatureCache::setPath(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_path = path;
+    m_entries.clear();
+    m_loaded = false;
+}
+
+bool SignatureCache::getModuleKey(HMODULE module, DWORD64* key) {
+    BYTE* base = (BYTE*)module;
+    IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)base;
+    if (!base || dosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
+        return false;
+    }
+    IMAGE_NT_HEADERS* ntHeaders = (IMAGE_NT_HEADERS*)(base + dosHeader->e_lfanew);
+    if (ntHeaders->Signature != IMAGE_NT_SIGNATURE) {
+        return false;
+    }
+
+    // Only the file name, the same build installed elsewhere still hits
+    wchar_t modulePath[MAX_PATH] = { 0 };
+    GetModuleFileNameW(module, modulePath, MAX_PATH);
+    const wchar_t* moduleName = wcsrchr(modulePath, L'\\');
+    moduleName = moduleName ? moduleName + 1 : modulePath;
+
+    DWORD64 hash = HASH_FNV1A_OFFSET_BASIS;
+    for (const wchar_t* c = moduleName; *c; c++) {
+        wchar_t lower = towlower(*c);
+        hash = Hash::fnv1a(hash, &lower, sizeof(lower));
+    }
+
+    DWORD timeDateStamp = ntHeaders->FileHeader.TimeDateStamp;
+    DWORD sizeOfImage = ntHeaders->OptionalHeader.SizeOfImage;
+    DWORD checkSum = ntHeaders->OptionalHeader.CheckSum;
+    hash = Hash::fnv1a(hash, &timeDateStamp, sizeof(timeDateStamp));
+    hash = Hash::fnv1a(hash, &sizeOfImage, sizeof(sizeOfImage));
+    hash = Hash::fnv1a(hash, &checkSum, sizeof(checkSum));
+
+    *key = hash;
+    return true;
+}
+
+bool SignatureCache::isExecutableRange(HMODULE module, DWORD rva, size_t length) {
+    BYTE* base = (BYTE*)module;
+    IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)base;
+    IMAGE_NT_HEADERS* ntHeaders = (IMAGE_NT_HEADERS*)(base + dosHeader->e_lfanew);
+
+    ULONG64 end = (ULONG64)rva + length;
+    if (end > ntHeaders->OptionalHeader.SizeOfImage) {
+        return false;
+    }
+
+    // Same sections SignatureScanner::scanModule looks at
+    IMAGE_SECTION_HEADER* section = IMAGE_FIRST_SECTION(ntHeaders);
+    for (WORD i = 0; i < ntHeaders->FileHeader.NumberOfSections; i++, section++) {
+        if (!(section->Characteristics & IMAGE_SCN_MEM_EXECUTE)) {
+            continue;
+        }
+
+        DWORD sectionSize = section->Misc.VirtualSize ? section->Misc.VirtualSize : section->SizeOfRawData;
+        if (rva >= section->VirtualAddress && end <= (ULONG64)section->VirtualAddress + sectionSize) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hashes the parsed bytes and mask, so spacing and "?" vs "??" don't matter
+DWORD64 SignatureCache::getPatternKey(const SignaturePattern& pattern) {
+    DWORD64 hash = HASH_FNV1A_OFFSET_BASIS;
+    for (size_t i = 0; i < pattern.bytes.size(); i++) {
+        BYTE value = pattern.mask[i] ? pattern.bytes[i] : 0;
+        hash = Hash::fnv1a(hash, &value, sizeof(value));
+        hash = Hash::fnv1a(hash, &pattern.mask[i], sizeof(BYTE));
+    }
+    return hash;
+}
+
+void SignatureCache::load() {
+    m_loaded = true;
+
+    if (m_path.empty()) {
+        // Default to the injector's own directory, the singleton lives in its image
+        HMODULE self = nullptr;
+        wchar_t selfPath[MAX_PATH] = { 0 };
+        if (GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+            (LPCWSTR)this, &self)) {
+            GetModuleFileNameW(self, selfPath, MAX_PATH);
+        }
+        std::wstring directory = selfPath;
+        m_path = directory.substr(0, directory.find_last_of(L"\\/") + 1) + SIGNATURE_CACHE_FILE_NAME;
+    }
+
+    HANDLE hFile = CreateFileW(m_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    SignatureCacheHeader header = {};
+    DWORD bytesRead = 0;
+    if (ReadFile(hFile, &header, sizeof(header), &bytesRead, nullptr) && bytesRead == sizeof(header)
+        && header.magic == SIGNATURE_CACHE_MAGIC && header.version == SIGNATURE_CACHE_VERSION
+        && header.count <= SIGNATURE_CACHE_MAX_ENTRIES * 2) {
+        std::vector<SignatureCacheEntry> entries(header.count);
+        DWORD size = (DWORD)(entries.size() * sizeof(SignatureCacheEntry));
+        if (size == 0 || (ReadFile(hFile, entries.data(), size, &bytesRead, nullptr) && bytesRead == size)) {
+            for (const auto& entry : entries) {
+                m_entries[std::make_pair(entry.moduleKey, entry.patternKey)] = entry.rva;
+            }
+        }
+    }
+
+    CloseHandle(hFile);
+}
+
+void SignatureCache::save() {
+    // Forget builds nobody has asked about this session once the file gets big
+    if (m_entries.size() > SIGNATURE_CACHE_MAX_ENTRIES) {
+        for (auto it = m_entries.begin(); it != m_entries.end();) {
+            if (m_sessionModules.find(it->first.first) == m_sessionModules.end()) {
+                it = m_entries.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    std::vector<SignatureCacheEntry> entries;
+    entries.reserve(m_entries.size());
+    for (const auto& entry : m_entries) {
+        SignatureCacheEntry record = {};
+        record.moduleKey = entry.first.first;
+        record.patternKey = entry.first.second;
+        record.rva = entry.second;
+        entries.push_back(record);
+    }
+
+    SignatureCacheHeader header = {};
+    header.magic = SIGNATURE_CACHE_MAGIC;
+    header.version = SIGNATURE_CACHE_VERSION;
+    header.count = (DWORD)entries.size();
+
+    // Write beside the cache and swap it in, so other clients never read half a file
+    std::wstring tempPath = m_path + L"." + std::to_wstring(GetCurrentProcessId()) + L".tmp";
+    HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    DWORD bytesWritten = 0;
+    DWORD size = (DWORD)(entries.size() * sizeof(SignatureCacheEntry));
+    bool written = WriteFile(hFile, &header, sizeof(header), &bytesWritten, nullptr) && bytesWritten == sizeof(header)
+        && (size == 0 || (WriteFile(hFile, entries.data(), size, &bytesWritten, nullptr) && bytesWritten == size));
+    CloseHandle(hFile);
+
+    if (!written || !MoveFileExW(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(tempPath.c_str());
+    }
+}
+
+size_t SignatureCache::scanModule(HMODULE module, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results) {
+    DWORD64 moduleKey = 0;
+    if (!getModuleKey(module, &moduleKey)) {
+        return SignatureScanner::scanModule(module, patterns, results);
+    }
+
+    BYTE* base = (BYTE*)module;
+    size_t found = 0;
+
+    // Misses keep their pattern, hits are left empty so the scanner skips them
+    std::vector<SignaturePattern> misses(patterns.size());
+    std::vector<DWORD64> patternKeys(patterns.size());
+    size_t missCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_loaded) {
+            load();
+        }
+        m_sessionModules.insert(moduleKey);
+
+        for (size_t i = 0; i < patterns.size(); i++) {
+            results[i] = 0;
+            if (patterns[i].bytes.empty()) {
+                continue;
+            }
+
+            patternKeys[i] = getPatternKey(patterns[i]);
+            auto it = m_entries.find(std::make_pair(moduleKey, patternKeys[i]));
+            if (it == m_entries.end()) {
+                misses[i] = patterns[i];
+                missCount++;
+                continue;
+            }
+
+            if (it->second == SIGNATURE_CACHE_NOT_FOUND) {
+                continue;
+            }
+
+            // A corrupt or colliding cache file can point anywhere, only trust
+            // offsets inside the code. Same build, but somebody may have
+            // patched the bytes since.
+            if (isExecutableRange(module, it->second, patterns[i].bytes.size())
+                && SignatureScanner::matchAt(base + it->second, patterns[i])) {
+                results[i] = (ULONG_PTR)(base + it->second);
+                found++;
+            }
+            else {
+                misses[i] = patterns[i];
+                missCount++;
+            }
+        }
+    }
+
+    if (missCount == 0) {
+        return found;
+    }
+
+    std::vector<ULONG_PTR> scanned(patterns.size(), 0);
+    found += SignatureScanner::scanModule(module, misses, scanned.data());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < patterns.size(); i++) {
+        if (misses[i].bytes.empty()) {
+            continue;
+        }
+        results[i] = scanned[i];
+        DWORD rva = scanned[i] ? (DWORD)(scanned[i] - (ULONG_PTR)base) : SIGNATURE_CACHE_NOT_FOUND;
+        m_entries[std::make_pair(moduleKey, patternKeys[i])] = rva;
+    }
+    save();
+
+    return found;
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) void SetSignatureCachePath(const wchar_t* path) {
+    SignatureCache::getInstance().setPath(path ? path : L"");
+}
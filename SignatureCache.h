@@ -0,0 +1,84 @@
+// SignatureCache.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include "SignatureScanner.h"
+
+// Cache file name, kept next to the injector unless a path is set
+#define SIGNATURE_CACHE_FILE_NAME L"signatures.cache"
+
+#define SIGNATURE_CACHE_MAGIC 0x47495343 // "CSIG"
+#define SIGNATURE_CACHE_VERSION 1
+
+// Entries kept before results for module builds we haven't seen this session are dropped
+#define SIGNATURE_CACHE_MAX_ENTRIES 16384
+
+// Cached "pattern wasn't in this module build"
+#define SIGNATURE_CACHE_NOT_FOUND 0xFFFFFFFF
+
+// On-disk record, the file is a header followed by `count` of these
+struct SignatureCacheEntry {
+    DWORD64 moduleKey;
+    DWORD64 patternKey;
+    DWORD rva;
+    DWORD reserved;
+};
+
+struct SignatureCacheHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD count;
+    DWORD reserved;
+};
+
+// Persistent (module build, pattern) -> RVA cache. A module build is
+// identified by its file name plus the PE TimeDateStamp, SizeOfImage and
+// CheckSum, so an unchanged client resolves a launch's whole pattern set from
+// the cache and only new or changed patterns are scanned.
+class SignatureCache {
+public:
+    static SignatureCache& getInstance() {
+        static SignatureCache instance;
+        return instance;
+    }
+
+    void setPath(const std::wstring& path);
+
+    // Like SignatureScanner::scanModule, going through the cache
+    size_t scanModule(HMODULE module, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results);
+
+    static bool getModuleKey(HMODULE module, DWORD64* key);
+    static DWORD64 getPatternKey(const SignaturePattern& pattern);
+
+    // Whether [rva, rva + length) lies inside one of the module's executable sections
+    static bool isExecutableRange(HMODULE module, DWORD rva, size_t length);
+
+private:
+    SignatureCache();
+    ~SignatureCache();
+
+    // No copy or move
+    SignatureCache(const SignatureCache&) = delete;
+    SignatureCache& operator=(const SignatureCache&) = delete;
+    SignatureCache(SignatureCache&&) = delete;
+    SignatureCache& operator=(SignatureCache&&) = delete;
+
+    // Both expect m_mutex to be held
+    void load();
+    void save();
+
+    std::wstring m_path;
+    bool m_loaded;
+    std::map<std::pair<DWORD64, DWORD64>, DWORD> m_entries;
+
+    // Module builds looked up this session, these survive pruning
+    std::set<DWORD64> m_sessionModules;
+    std::mutex m_mutex;
+};
+
+extern "C" __declspec(dllexport) void SetSignatureCachePath(const wchar_t* path);
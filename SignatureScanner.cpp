@@ -0,0 +1,369 @@
+// SignatureScanner.cpp
+#include "pch.h"
+#include "SignatureScanner.h"
+#include "SignatureCache.h"
+#include "MemoryMap.h"
+#include <algorithm>
+#include <intrin.h>
+#include <immintrin.h>
+#include <string.h>
+
+// Rough rank of how often a byte shows up in x86/x64 code, lower is rarer.
+// Anchoring on a rare byte keeps the number of full compares down.
+static int byteCommonness(BYTE value) {
+    switch (value) {
+    case 0x00: case 0xFF: case 0xCC: return 4;
+    case 0x8B: case 0x89: case 0x48: case 0xE8: case 0x90: return 3;
+    case 0x0F: case 0x83: case 0x85: case 0x24: case 0x4C: case 0xC3:
+    case 0x74: case 0x75: case 0x01: case 0x45: case 0x44: case 0x8D: return 2;
+    default: return 1;
+    }
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool SignatureScanner::parsePattern(const char* text, SignaturePattern* pattern) {
+    if (!text || !pattern) {
+        return false;
+    }
+
+    pattern->bytes.clear();
+    pattern->mask.clear();
+
+    const char* c = text;
+    while (*c) {
+        if (*c == ' ' || *c == '\t') {
+            c++;
+            continue;
+        }
+
+        if (*c == '?') {
+            c++;
+            if (*c == '?') c++;
+            pattern->bytes.push_back(0);
+            pattern->mask.push_back(0);
+        }
+        else {
+            int high = hexValue(c[0]);
+            int low = high >= 0 ? hexValue(c[1]) : -1;
+            if (low < 0) {
+                pattern->bytes.clear();
+                pattern->mask.clear();
+                return false;
+            }
+            c += 2;
+            pattern->bytes.push_back((BYTE)(high << 4 | low));
+            pattern->mask.push_back(1);
+        }
+
+        if (pattern->bytes.size() > SIGNATURE_MAX_LENGTH) {
+            pattern->bytes.clear();
+            pattern->mask.clear();
+            return false;
+        }
+    }
+
+    // Rarest fixed byte first, then the rarest other one
+    size_t first = SIZE_MAX;
+    size_t second = SIZE_MAX;
+    for (size_t i = 0; i < pattern->bytes.size(); i++) {
+        if (!pattern->mask[i]) {
+            continue;
+        }
+        if (first == SIZE_MAX || byteCommonness(pattern->bytes[i]) < byteCommonness(pattern->bytes[first])) {
+            second = first;
+            first = i;
+        }
+        else if (second == SIZE_MAX || byteCommonness(pattern->bytes[i]) < byteCommonness(pattern->bytes[second])) {
+            second = i;
+        }
+    }
+
+    // Nothing but wildcards would match everywhere
+    if (first == SIZE_MAX) {
+        pattern->bytes.clear();
+        pattern->mask.clear();
+        return false;
+    }
+
+    pattern->firstAnchor = first;
+    pattern->secondAnchor = second == SIZE_MAX ? first : second;
+    return true;
+}
+
+bool SignatureScanner::matchAt(const BYTE* data, const SignaturePattern& pattern) {
+    const BYTE* bytes = pattern.bytes.data();
+    const BYTE* mask = pattern.mask.data();
+    size_t length = pattern.bytes.size();
+    for (size_t i = 0; i < length; i++) {
+        if (mask[i] && data[i] != bytes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const BYTE* SignatureScanner::findScalar(const BYTE* begin, const BYTE* end, const SignaturePattern& pattern) {
+    size_t length = pattern.bytes.size();
+    if ((size_t)(end - begin) < length) {
+        return nullptr;
+    }
+
+    // Last position a match can start at
+    const BYTE* last = end - length;
+    size_t anchor = pattern.firstAnchor;
+    BYTE anchorByte = pattern.bytes[anchor];
+
+    const BYTE* p = begin;
+    while (p <= last) {
+        const BYTE* hit = (const BYTE*)memchr(p + anchor, anchorByte, (size_t)(last - p) + 1);
+        if (!hit) {
+            return nullptr;
+        }
+        p = hit - anchor;
+        if (matchAt(p, pattern)) {
+            return p;
+        }
+        p++;
+    }
+    return nullptr;
+}
+
+const BYTE* SignatureScanner::findSse2(const BYTE* begin, const BYTE* end, const SignaturePattern& pattern) {
+    size_t length = pattern.bytes.size();
+    if ((size_t)(end - begin) < length) {
+        return nullptr;
+    }
+
+    const BYTE* last = end - length;
+    size_t firstAnchor = pattern.firstAnchor;
+    size_t secondAnchor = pattern.secondAnchor;
+    __m128i first = _mm_set1_epi8((char)pattern.bytes[firstAnchor]);
+    __m128i second = _mm_set1_epi8((char)pattern.bytes[secondAnchor]);
+
+    // 16 candidate positions at a time, both anchor loads stay inside [begin, end)
+    const BYTE* p = begin;
+    while ((size_t)(last - p) >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(p + firstAnchor));
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + secondAnchor));
+        unsigned int candidates = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, second)));
+
+        while (candidates) {
+            unsigned long bit;
+            _BitScanForward(&bit, candidates);
+            if (matchAt(p + bit, pattern)) {
+                return p + bit;
+            }
+            candidates &= candidates - 1;
+        }
+        p += 16;
+    }
+
+    return findScalar(p, end, pattern);
+}
+
+const BYTE* SignatureScanner::findAvx2(const BYTE* begin, const BYTE* end, const SignaturePattern& pattern) {
+    size_t length = pattern.bytes.size();
+    if ((size_t)(end - begin) < length) {
+        return nullptr;
+    }
+
+    const BYTE* last = end - length;
+    size_t firstAnchor = pattern.firstAnchor;
+    size_t secondAnchor = pattern.secondAnchor;
+    __m256i first = _mm256_set1_epi8((char)pattern.bytes[firstAnchor]);
+    __m256i second = _mm256_set1_epi8((char)pattern.bytes[secondAnchor]);
+
+    const BYTE* p = begin;
+    while ((size_t)(last - p) >= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + firstAnchor));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + secondAnchor));
+        unsigned int candidates = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, second)));
+
+        while (candidates) {
+            unsigned long bit;
+            _BitScanForward(&bit, candidates);
+            if (matchAt(p + bit, pattern)) {
+                return p + bit;
+            }
+            candidates &= candidates - 1;
+        }
+        p += 32;
+    }
+
+    return findSse2(p, end, pattern);
+}
+
+SignatureScanner::FindFunc SignatureScanner::getFindFunc() {
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    // AVX2 also needs the OS to save the ymm registers
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            return findAvx2;
+        }
+    }
+
+    return sse2 ? findSse2 : findScalar;
+}
+
+size_t SignatureScanner::scan(const BYTE* begin, size_t length, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results) {
+    for (size_t i = 0; i < patterns.size(); i++) {
+        results[i] = 0;
+    }
+    return scanRange(begin, length, patterns, results);
+}
+
+size_t SignatureScanner::scanRange(const BYTE* begin, size_t length, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results) {
+    static FindFunc find = getFindFunc();
+
+    size_t remaining = 0;
+    for (size_t i = 0; i < patterns.size(); i++) {
+        if (!results[i] && !patterns[i].bytes.empty()) {
+            remaining++;
+        }
+    }
+
+    size_t found = 0;
+    const BYTE* rangeEnd = begin + length;
+    for (const BYTE* block = begin; block < rangeEnd && remaining > 0; block += SIGNATURE_BLOCK_SIZE) {
+        size_t blockLength = (size_t)(rangeEnd - block) < SIGNATURE_BLOCK_SIZE ? (size_t)(rangeEnd - block) : SIGNATURE_BLOCK_SIZE;
+
+        for (size_t i = 0; i < patterns.size(); i++) {
+            const SignaturePattern& pattern = patterns[i];
+            if (results[i] || pattern.bytes.empty()) {
+                continue;
+            }
+
+            // Matches start inside the block but may run past its end
+            size_t searchLength = blockLength + pattern.bytes.size() - 1;
+            if (searchLength > (size_t)(rangeEnd - block)) {
+                searchLength = (size_t)(rangeEnd - block);
+            }
+
+            const BYTE* match = find(block, block + searchLength, pattern);
+            if (match) {
+                results[i] = (ULONG_PTR)match;
+                remaining--;
+                found++;
+            }
+        }
+    }
+
+    return found;
+}
+
+size_t SignatureScanner::scanMemory(const BYTE* begin, size_t length, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results) {
+    for (size_t i = 0; i < patterns.size(); i++) {
+        results[i] = 0;
+    }
+
+    // Scan each run of readable regions as one range, so matches can cross region boundaries
+    ULONG_PTR rangeBegin = (ULONG_PTR)begin;
+    ULONG_PTR rangeEnd = rangeBegin + length;
+    ULONG_PTR runBegin = 0;
+    ULONG_PTR runEnd = 0;
+    size_t found = 0;
+
+    // The map only snapshots once, pages in the range may have been freed or
+    // re-protected since; re-query them so we don't walk onto one
+    MemoryMap::getInstance().refresh(rangeBegin, length);
+    MemoryMap::getInstance().forEachRegion(rangeBegin, length, [&](const MemoryRegion& region) {
+        ULONG_PTR regionBegin = (std::max)((ULONG_PTR)region.base, rangeBegin);
+        ULONG_PTR regionEnd = (std::min)((ULONG_PTR)(region.base + region.size), rangeEnd);
+
+        if (MemoryMap::isReadable(region)) {
+            if (runEnd != regionBegin) {
+                if (runEnd > runBegin) {
+                    found += scanRange((const BYTE*)runBegin, runEnd - runBegin, patterns, results);
+                }
+                runBegin = regionBegin;
+            }
+            runEnd = regionEnd;
+        }
+        return true;
+    });
+
+    if (runEnd > runBegin) {
+        found += scanRange((const BYTE*)runBegin, runEnd - runBegin, patterns, results);
+    }
+    return found;
+}
+
+size_t SignatureScanner::scanModule(HMODULE module, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results) {
+    for (size_t i = 0; i < patterns.size(); i++) {
+        results[i] = 0;
+    }
+
+    BYTE* base = (BYTE*)module;
+    IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)base;
+    if (!base || dosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
+        return 0;
+    }
+    IMAGE_NT_HEADERS* ntHeaders = (IMAGE_NT_HEADERS*)(base + dosHeader->e_lfanew);
+    if (ntHeaders->Signature != IMAGE_NT_SIGNATURE) {
+        return 0;
+    }
+
+    size_t found = 0;
+    IMAGE_SECTION_HEADER* section = IMAGE_FIRST_SECTION(ntHeaders);
+    for (WORD i = 0; i < ntHeaders->FileHeader.NumberOfSections; i++, section++) {
+        if (!(section->Characteristics & IMAGE_SCN_MEM_EXECUTE)) {
+            continue;
+        }
+
+        DWORD sectionSize = section->Misc.VirtualSize ? section->Misc.VirtualSize : section->SizeOfRawData;
+        found += scanRange(base + section->VirtualAddress, sectionSize, patterns, results);
+    }
+
+    return found;
+}
+
+// Exports for managed code
+static std::vector<SignaturePattern> parsePatterns(const char** patterns, int count) {
+    std::vector<SignaturePattern> parsed(count > 0 ? count : 0);
+    for (int i = 0; i < count; i++) {
+        // A pattern that doesn't parse stays empty and is reported as not found
+        SignatureScanner::parsePattern(patterns[i], &parsed[i]);
+    }
+    return parsed;
+}
+
+extern "C" __declspec(dllexport) int ScanModulePatterns(const wchar_t* moduleName, const char** patterns, int count, ULONG_PTR* results) {
+    if (!patterns || !results || count <= 0) {
+        return 0;
+    }
+
+    HMODULE module = GetModuleHandleW(moduleName);
+    if (!module) {
+        for (int i = 0; i < count; i++) {
+            results[i] = 0;
+        }
+        return -1;
+    }
+
+    return (int)SignatureCache::getInstance().scanModule(module, parsePatterns(patterns, count), results);
+}
+
+extern "C" __declspec(dllexport) int ScanMemoryPatterns(const void* begin, size_t length, const char** patterns, int count, ULONG_PTR* results) {
+    if (!begin || !patterns || !results || count <= 0) {
+        return 0;
+    }
+
+    return (int)SignatureScanner::scanMemory((const BYTE*)begin, length, parsePatterns(patterns, count), results);
+}
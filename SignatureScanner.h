@@ -0,0 +1,62 @@
+// SignatureScanner.h
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+
+// Longest pattern we accept, in bytes
+#define SIGNATURE_MAX_LENGTH 256
+
+// Bytes scanned per pattern before moving on to the next one. Every pattern
+// sweeps the same block while it is still in cache, so many patterns cost
+// roughly one pass over the image.
+#define SIGNATURE_BLOCK_SIZE (64 * 1024)
+
+// A parsed byte pattern, e.g. "48 8B ?? 05 ? E8". Matching starts from the
+// two rarest fixed bytes (the anchors), candidates are then checked in full.
+struct SignaturePattern {
+    std::vector<BYTE> bytes;
+    std::vector<BYTE> mask;     // 1 for a fixed byte, 0 for a wildcard
+    size_t firstAnchor;
+    size_t secondAnchor;
+};
+
+class SignatureScanner {
+public:
+    // Hex bytes separated by spaces, "?" or "??" for a wildcard
+    static bool parsePattern(const char* text, SignaturePattern* pattern);
+
+    // First match of each pattern in [begin, begin + length), results[i] is 0
+    // when pattern i wasn't found (an empty, unparsed pattern never matches).
+    // Returns how many patterns matched.
+    static size_t scan(const BYTE* begin, size_t length, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results);
+
+    // Like scan over an arbitrary range, skipping pages that can't be read
+    static size_t scanMemory(const BYTE* begin, size_t length, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results);
+
+    // Same, but only over the module's executable sections
+    static size_t scanModule(HMODULE module, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results);
+
+    // Full compare of a pattern at one address
+    static bool matchAt(const BYTE* data, const SignaturePattern& pattern);
+
+private:
+    // Like scan, but leaves patterns that already have a result alone
+    static size_t scanRange(const BYTE* begin, size_t length, const std::vector<SignaturePattern>& patterns, ULONG_PTR* results);
+
+    typedef const BYTE* (*FindFunc)(const BYTE* begin, const BYTE* end, const SignaturePattern& pattern);
+
+    // Picked once from cpuid: AVX2, SSE2 or plain C
+    static FindFunc getFindFunc();
+
+    static const BYTE* findScalar(const BYTE* begin, const BYTE* end, const SignaturePattern& pattern);
+    static const BYTE* findSse2(const BYTE* begin, const BYTE* end, const SignaturePattern& pattern);
+    static const BYTE* findAvx2(const BYTE* begin, const BYTE* end, const SignaturePattern& pattern);
+};
+
+// Exports for managed code. Patterns are scanned in one batch; results
+// receives one address per pattern (0 if not found). Returns the number of
+// patterns found, or -1 if the module isn't loaded. A null module name scans
+// the client executable. Module scans go through the on-disk SignatureCache.
+extern "C" __declspec(dllexport) int ScanModulePatterns(const wchar_t* moduleName, const char** patterns, int count, ULONG_PTR* results);
+extern "C" __declspec(dllexport) int ScanMemoryPatterns(const void* begin, size_t length, const char** patterns, int count, ULONG_PTR* results);
@@ -0,0 +1,201 @@
+// SymbolStore.cpp
+#include "pch.h"
+#include "SymbolStore.h"
+#include "Utf.h"
+#include <DbgHelp.h>
+#include <vector>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+// How long stopPrefetch waits for a download in flight. The thread keeps its
+// handle past that, a new prefetch can't start until it has really exited.
+#define SYMBOL_PREFETCH_STOP_TIMEOUT_MS 5000
+
+SymbolStore::SymbolStore()
+    : m_offline(false)
+    , m_cancelPrefetch(false)
+    , m_prefetchThread(nullptr)
+{
+}
+
+SymbolStore::~SymbolStore() {
+    stopPrefetch();
+}
+
+void SymbolStore::setRoot(const std::wstring& root) {
+    std::lock_guard<std::mutex> lock(m_rootMutex);
+    m_root = root;
+    if (!m_root.empty() && m_root.back() != L'\\' && m_root.back() != L'/') {
+        m_root += L"\\";
+    }
+    CreateDirectoryW(m_root.c_str(), nullptr);
+}
+
+std::wstring SymbolStore::getRoot() {
+    std::lock_guard<std::mutex> lock(m_rootMutex);
+    return m_root;
+}
+
+std::wstring SymbolStore::localSearchPath() {
+    std::wstring root = getRoot();
+    if (root.empty()) {
+        return std::wstring();
+    }
+    return L"srv*" + root;
+}
+
+void SymbolStore::setOffline(bool offline) {
+    m_offline = offline;
+    if (offline) {
+        stopPrefetch();
+    }
+}
+
+bool SymbolStore::startPrefetch() {
+    if (m_offline || getRoot().empty()) {
+        return false;
+    }
+
+    // Still running, or a cancelled one still finishing its download
+    if (m_prefetchThread) {
+        if (WaitForSingleObject(m_prefetchThread, 0) != WAIT_OBJECT_0) {
+            return false;
+        }
+        CloseHandle(m_prefetchThread);
+        m_prefetchThread = nullptr;
+    }
+
+    m_cancelPrefetch = false;
+    m_prefetchThread = CreateThread(nullptr, 0, prefetchThreadProc, this, 0, nullptr);
+    return m_prefetchThread != nullptr;
+}
+
+void SymbolStore::stopPrefetch() {
+    if (!m_prefetchThread) {
+        return;
+    }
+
+    m_cancelPrefetch = true;
+    if (WaitForSingleObject(m_prefetchThread, SYMBOL_PREFETCH_STOP_TIMEOUT_MS) != WAIT_OBJECT_0) {
+        return;
+    }
+    CloseHandle(m_prefetchThread);
+    m_prefetchThread = nullptr;
+}
+
+DWORD WINAPI SymbolStore::prefetchThreadProc(LPVOID param) {
+    // Stay out of the client's way, both for cpu and disk
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+    ((SymbolStore*)param)->prefetchLoadedModules();
+    return 0;
+}
+
+void SymbolStore::prefetchLoadedModules() {
+    HMODULE modules[1024];
+    DWORD bytesNeeded = 0;
+    if (!EnumProcessModules(GetCurrentProcess(), modules, sizeof(modules), &bytesNeeded)) {
+        return;
+    }
+
+    DWORD moduleCount = bytesNeeded / sizeof(HMODULE);
+    if (moduleCount > sizeof(modules) / sizeof(HMODULE)) {
+        moduleCount = sizeof(modules) / sizeof(HMODULE);
+    }
+
+    for (DWORD i = 0; i < moduleCount && !m_cancelPrefetch && !m_offline; i++) {
+        // Pinned while we read its headers, it may have been unloaded since the enumeration
+        HMODULE pinned = nullptr;
+        if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCWSTR)modules[i], &pinned)) {
+            continue;
+        }
+        prefetchModule(pinned);
+        FreeLibrary(pinned);
+    }
+}
+
+bool SymbolStore::prefetchModule(HMODULE module) {
+    // Find the module's build id in its CodeView record
+    BYTE* base = (BYTE*)module;
+    IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)base;
+    if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE) {
+        return false;
+    }
+    IMAGE_NT_HEADERS* ntHeaders = (IMAGE_NT_HEADERS*)(base + dosHeader->e_lfanew);
+    if (ntHeaders->Signature != IMAGE_NT_SIGNATURE) {
+        return false;
+    }
+
+    IMAGE_DATA_DIRECTORY debugDirectory = ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG];
+    if (debugDirectory.VirtualAddress == 0 || debugDirectory.Size == 0) {
+        return false;
+    }
+
+    IMAGE_DEBUG_DIRECTORY* entries = (IMAGE_DEBUG_DIRECTORY*)(base + debugDirectory.VirtualAddress);
+    size_t entryCount = debugDirectory.Size / sizeof(IMAGE_DEBUG_DIRECTORY);
+
+    const CodeViewPdb70* codeView = nullptr;
+    for (size_t i = 0; i < entryCount; i++) {
+        if (entries[i].Type == IMAGE_DEBUG_TYPE_CODEVIEW && entries[i].AddressOfRawData != 0) {
+            const CodeViewPdb70* candidate = (const CodeViewPdb70*)(base + entries[i].AddressOfRawData);
+            if (candidate->signature == 0x53445352 /* RSDS */) {
+                codeView = candidate;
+                break;
+            }
+        }
+    }
+    if (!codeView) {
+        return false;
+    }
+
+    // Only the file name goes into the store layout
+    const char* pdbName = strrchr(codeView->pdbFileName, '\\');
+    pdbName = pdbName ? pdbName + 1 : codeView->pdbFileName;
+
+    wchar_t pdbNameW[MAX_PATH] = { 0 };
+    if (Utf::toUtf16(pdbName, pdbNameW) <= 0) {
+        return false;
+    }
+
+    // Already in the store?
+    wchar_t buildId[64];
+    const GUID& guid = codeView->guid;
+    swprintf_s(buildId, L"%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X",
+        guid.Data1, guid.Data2, guid.Data3,
+        guid.Data4[0], guid.Data4[1], guid.Data4[2], guid.Data4[3],
+        guid.Data4[4], guid.Data4[5], guid.Data4[6], guid.Data4[7],
+        codeView->age);
+
+    std::wstring root = getRoot();
+    std::wstring localPath = root + pdbNameW + L"\\" + buildId + L"\\" + pdbNameW;
+    if (GetFileAttributesW(localPath.c_str()) != INVALID_FILE_ATTRIBUTES) {
+        return true;
+    }
+
+    // Talk to symsrv directly, so the download never holds dbghelp's lock
+    static HMODULE symsrv = LoadLibraryW(L"symsrv.dll");
+    if (!symsrv) {
+        return false;
+    }
+    PSYMBOLSERVERPROCW symbolServer = (PSYMBOLSERVERPROCW)GetProcAddress(symsrv, "SymbolServerW");
+    PSYMBOLSERVERSETOPTIONSPROC symbolServerSetOptions = (PSYMBOLSERVERSETOPTIONSPROC)GetProcAddress(symsrv, "SymbolServerSetOptions");
+    if (!symbolServer || !symbolServerSetOptions) {
+        return false;
+    }
+
+    symbolServerSetOptions(SSRVOPT_GUIDPTR, TRUE);
+    symbolServerSetOptions(SSRVOPT_UNATTENDED, TRUE);
+
+    // "<downstream>*<upstream>" copies into the local store as it downloads
+    std::wstring params = root.substr(0, root.length() - 1) + L"*" + SYMBOL_STORE_UPSTREAM;
+    wchar_t foundPath[MAX_PATH] = { 0 };
+    return symbolServer(params.c_str(), pdbNameW, (PVOID)&guid, codeView->age, 0, foundPath) == TRUE;
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) void SetSymbolOfflineMode(bool offline) {
+    SymbolStore::getInstance().setOffline(offline);
+}
+
+extern "C" __declspec(dllexport) bool StartSymbolPrefetch() {
+    return SymbolStore::getInstance().startPrefetch();
+}
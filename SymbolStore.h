@@ -0,0 +1,69 @@
+// SymbolStore.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <mutex>
+
+// Upstream server the prefetch copies from when we're allowed online
+#define SYMBOL_STORE_UPSTREAM L"https://msdl.microsoft.com/download/symbols"
+
+// Local, indexed symbol store. Uses the symsrv layout
+// (<root>\<pdb name>\<GUID><age>\<pdb name>), so the store is keyed by each
+// module's build id and dbghelp can read it with a plain "srv*<root>" entry.
+//
+// The crash handler's search path only ever points at this store, never at a
+// server, so resolving a crash can't block on the network. Filling the store
+// is the job of the background prefetch, which pulls the pdbs of every module
+// already loaded through symsrv, outside of dbghelp and its lock.
+class SymbolStore {
+public:
+    static SymbolStore& getInstance() {
+        static SymbolStore instance;
+        return instance;
+    }
+
+    void setRoot(const std::wstring& root);
+    std::wstring getRoot();
+
+    // dbghelp search path entry for the local store
+    std::wstring localSearchPath();
+
+    // Offline mode never talks to a server, it also stops a running prefetch
+    void setOffline(bool offline);
+    bool isOffline() const { return m_offline; }
+
+    bool startPrefetch();
+    void stopPrefetch();
+
+private:
+    // Layout of the RSDS CodeView record in a PE debug directory
+    struct CodeViewPdb70 {
+        DWORD signature;
+        GUID guid;
+        DWORD age;
+        char pdbFileName[1];
+    };
+
+    SymbolStore();
+    ~SymbolStore();
+
+    // No copy or move
+    SymbolStore(const SymbolStore&) = delete;
+    SymbolStore& operator=(const SymbolStore&) = delete;
+    SymbolStore(SymbolStore&&) = delete;
+    SymbolStore& operator=(SymbolStore&&) = delete;
+
+    static DWORD WINAPI prefetchThreadProc(LPVOID param);
+    void prefetchLoadedModules();
+    bool prefetchModule(HMODULE module);
+
+    std::wstring m_root;
+    std::mutex m_rootMutex;
+    volatile bool m_offline;
+    volatile bool m_cancelPrefetch;
+    HANDLE m_prefetchThread;
+};
+
+extern "C" __declspec(dllexport) void SetSymbolOfflineMode(bool offline);
+extern "C" __declspec(dllexport) bool StartSymbolPrefetch();
@@ -0,0 +1,323 @@
+// Telemetry.cpp
+#include "pch.h"
+#include "Telemetry.h"
+#include <psapi.h>
+#include <string.h>
+#pragma comment(lib, "psapi.lib")
+
+Telemetry::Telemetry()
+    : m_mapping(nullptr)
+    , m_block(nullptr)
+{
+}
+
+Telemetry::~Telemetry() {
+    stop();
+}
+
+bool Telemetry::start() {
+    if (m_block) {
+        m_block->state.store(TELEMETRY_STATE_RUNNING, std::memory_order_release);
+        return true;
+    }
+
+    DWORD processId = GetCurrentProcessId();
+    wchar_t name[128];
+    swprintf_s(name, TELEMETRY_MAPPING_NAME, processId);
+
+    m_mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(TelemetryBlock), name);
+    if (!m_mapping) {
+        return false;
+    }
+    bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+
+    TelemetryBlock* block = (TelemetryBlock*)MapViewOfFile(m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(TelemetryBlock));
+    if (!block) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+        return false;
+    }
+
+    // Left over from an earlier process with our pid that the launcher still has mapped
+    if (existed) {
+        block->magic = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        memset((BYTE*)block + sizeof(block->magic), 0, sizeof(TelemetryBlock) - sizeof(block->magic));
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    block->version = TELEMETRY_VERSION;
+    block->size = sizeof(TelemetryBlock);
+    block->processId = processId;
+    block->counterFrequency = frequency.QuadPart;
+    block->state.store(TELEMETRY_STATE_RUNNING, std::memory_order_relaxed);
+    for (ULONG i = 0; i < TELEMETRY_RING_CAPACITY; i++) {
+        block->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+    block->magic = TELEMETRY_MAGIC;
+
+    m_block = block;
+    sampleProcess();
+    return true;
+}
+
+void Telemetry::stop() {
+    if (!m_block) {
+        return;
+    }
+
+    // Only marked, the view stays mapped: managed code may still be calling in
+    // while we shut down, and the launcher keeps reading the block after we're gone
+    m_block->state.store(TELEMETRY_STATE_STOPPED, std::memory_order_release);
+}
+
+void Telemetry::frame() {
+    TelemetryBlock* block = m_block;
+    if (!block) {
+        return;
+    }
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    LONGLONG last = block->lastFrameTime.load(std::memory_order_relaxed);
+    if (last != 0) {
+        LONGLONG elapsed = counter.QuadPart - last;
+        block->frameTimeUs.store(elapsed / block->counterFrequency * 1000000
+            + elapsed % block->counterFrequency * 1000000 / block->counterFrequency, std::memory_order_relaxed);
+    }
+    block->lastFrameTime.store(counter.QuadPart, std::memory_order_relaxed);
+    block->frameCount.fetch_add(1, std::memory_order_release);
+}
+
+void Telemetry::sampleProcess() {
+    TelemetryBlock* block = m_block;
+    if (!block) {
+        return;
+    }
+
+    HANDLE hProcess = GetCurrentProcess();
+    PROCESS_MEMORY_COUNTERS_EX memoryCounters = {};
+    if (GetProcessMemoryInfo(hProcess, (PROCESS_MEMORY_COUNTERS*)&memoryCounters, sizeof(memoryCounters))) {
+        block->workingSet.store((LONGLONG)memoryCounters.WorkingSetSize, std::memory_order_relaxed);
+        block->privateBytes.store((LONGLONG)memoryCounters.PrivateUsage, std::memory_order_relaxed);
+    }
+
+    DWORD handleCount = 0;
+    if (GetProcessHandleCount(hProcess, &handleCount)) {
+        block->handleCount.store(handleCount, std::memory_order_relaxed);
+    }
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    block->sampleTime.store(counter.QuadPart, std::memory_order_release);
+}
+
+void Telemetry::reportGc(LONGLONG gen0, LONGLONG gen1, LONGLONG gen2) {
+    TelemetryBlock* block = m_block;
+    if (!block) {
+        return;
+    }
+
+    block->gcCount[0].store(gen0, std::memory_order_relaxed);
+    block->gcCount[1].store(gen1, std::memory_order_relaxed);
+    block->gcCount[2].store(gen2, std::memory_order_relaxed);
+}
+
+TelemetryCounter* Telemetry::findCounter(LONG id) {
+    TelemetryBlock* block = m_block;
+    if (!block || id == 0) {
+        return nullptr;
+    }
+
+    // Slots are claimed in order and never released, so the first free one ends the search
+    for (size_t i = 0; i < TELEMETRY_MAX_COUNTERS; i++) {
+        TelemetryCounter& counter = block->counters[i];
+        LONG current = counter.id.load(std::memory_order_acquire);
+        if (current == 0) {
+            if (counter.id.compare_exchange_strong(current, id, std::memory_order_acq_rel) || current == id) {
+                return &counter;
+            }
+        }
+        else if (current == id) {
+            return &counter;
+        }
+    }
+    return nullptr;
+}
+
+bool Telemetry::setCounter(LONG id, LONGLONG value) {
+    TelemetryCounter* counter = findCounter(id);
+    if (!counter) {
+        return false;
+    }
+    counter->value.store(value, std::memory_order_relaxed);
+    return true;
+}
+
+bool Telemetry::addCounter(LONG id, LONGLONG delta) {
+    TelemetryCounter* counter = findCounter(id);
+    if (!counter) {
+        return false;
+    }
+    counter->value.fetch_add(delta, std::memory_order_relaxed);
+    return true;
+}
+
+bool Telemetry::push(DWORD id, LONGLONG value, const void* payload, size_t length) {
+    TelemetryBlock* block = m_block;
+    if (!block) {
+        return false;
+    }
+
+    // Claim a slot: it's ours once its sequence matches our position
+    ULONG position = block->writeIndex.load(std::memory_order_relaxed);
+    TelemetrySlot* slot;
+    for (;;) {
+        slot = &block->slots[position & (TELEMETRY_RING_CAPACITY - 1)];
+        ULONG sequence = slot->sequence.load(std::memory_order_acquire);
+        LONG difference = (LONG)(sequence - position);
+        if (difference == 0) {
+            if (block->writeIndex.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            // Full, the launcher is behind or not reading: drop rather than wait
+            block->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else {
+            position = block->writeIndex.load(std::memory_order_relaxed);
+        }
+    }
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    TelemetryEvent& event = slot->event;
+    event.timestamp = counter.QuadPart;
+    event.id = id;
+    event.value = value;
+    if (length > TELEMETRY_EVENT_PAYLOAD_SIZE) {
+        length = TELEMETRY_EVENT_PAYLOAD_SIZE;
+    }
+    event.length = (DWORD)length;
+    if (length) {
+        memcpy(event.payload, payload, length);
+    }
+
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+TelemetryReader::TelemetryReader() {
+}
+
+TelemetryReader::~TelemetryReader() {
+    for (auto& client : m_clients) {
+        UnmapViewOfFile(client.second.block);
+        CloseHandle(client.second.hMapping);
+    }
+}
+
+const TelemetryBlock* TelemetryReader::open(DWORD processId) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_clients.find(processId);
+    if (it != m_clients.end()) {
+        return it->second.block;
+    }
+
+    wchar_t name[128];
+    swprintf_s(name, TELEMETRY_MAPPING_NAME, processId);
+
+    // Not there until the client has started up
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name);
+    if (!hMapping) {
+        return nullptr;
+    }
+
+    TelemetryBlock* block = (TelemetryBlock*)MapViewOfFile(hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(TelemetryBlock));
+    if (!block) {
+        CloseHandle(hMapping);
+        return nullptr;
+    }
+
+    // Still being filled in, or built by a different injector
+    DWORD magic = block->magic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (magic != TELEMETRY_MAGIC || block->version != TELEMETRY_VERSION || block->size != sizeof(TelemetryBlock)) {
+        UnmapViewOfFile(block);
+        CloseHandle(hMapping);
+        return nullptr;
+    }
+
+    MappedClient client = { hMapping, block };
+    m_clients[processId] = client;
+    return block;
+}
+
+void TelemetryReader::close(DWORD processId) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_clients.find(processId);
+    if (it != m_clients.end()) {
+        UnmapViewOfFile(it->second.block);
+        CloseHandle(it->second.hMapping);
+        m_clients.erase(it);
+    }
+}
+
+bool TelemetryReader::pop(const TelemetryBlock* block, TelemetryEvent* event) {
+    if (!block || !event) {
+        return false;
+    }
+
+    // The read index and the slot sequences are the only fields the launcher writes
+    TelemetryBlock* shared = const_cast<TelemetryBlock*>(block);
+    ULONG position = shared->readIndex.load(std::memory_order_relaxed);
+    TelemetrySlot& slot = shared->slots[position & (TELEMETRY_RING_CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+        return false;
+    }
+
+    *event = slot.event;
+
+    // Hand the slot back to writers for the next lap
+    slot.sequence.store(position + TELEMETRY_RING_CAPACITY, std::memory_order_release);
+    shared->readIndex.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) bool TelemetrySetCounter(int id, long long value) {
+    return Telemetry::getInstance().setCounter((LONG)id, value);
+}
+
+extern "C" __declspec(dllexport) bool TelemetryAddCounter(int id, long long delta) {
+    return Telemetry::getInstance().addCounter((LONG)id, delta);
+}
+
+extern "C" __declspec(dllexport) void TelemetryReportGc(long long gen0, long long gen1, long long gen2) {
+    Telemetry::getInstance().reportGc(gen0, gen1, gen2);
+}
+
+extern "C" __declspec(dllexport) bool TelemetryPush(unsigned int id, long long value, const char* payload, int length) {
+    return Telemetry::getInstance().push((DWORD)id, value, payload, payload && length > 0 ? (size_t)length : 0);
+}
+
+// Launcher exports
+extern "C" __declspec(dllexport) const TelemetryBlock* OpenClientTelemetry(DWORD processId) {
+    return TelemetryReader::getInstance().open(processId);
+}
+
+extern "C" __declspec(dllexport) void CloseClientTelemetry(DWORD processId) {
+    TelemetryReader::getInstance().close(processId);
+}
+
+extern "C" __declspec(dllexport) bool PopClientTelemetryEvent(const TelemetryBlock* block, TelemetryEvent* event) {
+    return TelemetryReader::pop(block, event);
+}
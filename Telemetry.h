@@ -0,0 +1,183 @@
+// Telemetry.h
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+
+// Per-client shared memory segment, formatted with the client's process id.
+// The client creates it while starting up, the launcher opens it by pid.
+#define TELEMETRY_MAPPING_NAME L"Local\\Chorizite.Telemetry.%lu"
+
+// 'CTLM', written last by the client so a reader never sees a half built block
+#define TELEMETRY_MAGIC 0x4d4c5443
+#define TELEMETRY_VERSION 2
+
+// Block state, so the launcher can tell a client that shut down from one that froze
+#define TELEMETRY_STATE_RUNNING 1
+#define TELEMETRY_STATE_STOPPED 2
+
+// Plugin defined counters, ids are picked by the plugins and 0 means unused
+#define TELEMETRY_MAX_COUNTERS 64
+
+// Events the ring holds before the client starts dropping, must be a power of two
+#define TELEMETRY_RING_CAPACITY 1024
+
+// Payload bytes kept per event, longer payloads are truncated
+#define TELEMETRY_EVENT_PAYLOAD_SIZE 40
+
+// Plugin defined counter slot
+struct TelemetryCounter {
+    std::atomic<LONG> id;
+    DWORD reserved;
+    std::atomic<LONGLONG> value;
+};
+
+// One fixed size event, 64 bytes
+struct TelemetryEvent {
+    LONGLONG timestamp;     // QueryPerformanceCounter in the client
+    DWORD id;
+    DWORD length;
+    LONGLONG value;
+    char payload[TELEMETRY_EVENT_PAYLOAD_SIZE];
+};
+
+// Ring entry. The sequence says whose turn the slot is: position when it's
+// free for the writer claiming that position, position + 1 once published.
+struct TelemetrySlot {
+    std::atomic<ULONG> sequence;
+    DWORD reserved;
+    TelemetryEvent event;
+};
+
+// Layout of the shared segment. Fixed size fields only, it's read by the
+// launcher and handed to managed code as is. The launcher reads any field with
+// a plain load and no syscall.
+struct TelemetryBlock {
+    DWORD magic;
+    DWORD version;
+    DWORD size;
+    DWORD processId;
+    LONGLONG counterFrequency;  // QueryPerformanceFrequency in the client
+    std::atomic<LONG> state;
+
+    // Written by the heartbeat thread
+    alignas(64) std::atomic<LONGLONG> lastFrameTime;  // QueryPerformanceCounter
+    std::atomic<LONGLONG> frameTimeUs;
+    std::atomic<LONGLONG> frameCount;
+
+    // Written by the watchdog thread
+    alignas(64) std::atomic<LONGLONG> sampleTime;     // QueryPerformanceCounter
+    std::atomic<LONGLONG> workingSet;
+    std::atomic<LONGLONG> privateBytes;
+    std::atomic<LONGLONG> handleCount;
+
+    // Reported by managed code
+    alignas(64) std::atomic<LONGLONG> gcCount[3];
+
+    alignas(64) TelemetryCounter counters[TELEMETRY_MAX_COUNTERS];
+
+    // Any client thread produces, the launcher consumes. Writers claim a
+    // position with a compare-exchange and publish through the slot's
+    // sequence (same scheme as the Logger's ring). The indices sit on
+    // separate cache lines so neither side bounces the other's.
+    alignas(64) std::atomic<ULONG> writeIndex;
+    std::atomic<ULONG> dropped;
+    alignas(64) std::atomic<ULONG> readIndex;
+    alignas(64) TelemetrySlot slots[TELEMETRY_RING_CAPACITY];
+};
+
+// Client side, lives inside the injected process. Owns this process's block
+// and keeps the fixed counters up to date; managed code adds its own
+// counters and events through the exports below.
+class Telemetry {
+public:
+    static Telemetry& getInstance() {
+        static Telemetry instance;
+        return instance;
+    }
+
+    bool start();
+    void stop();
+    bool isRunning() const { return m_block && m_block->state == TELEMETRY_STATE_RUNNING; }
+
+    // Heartbeat thread, once per frame
+    void frame();
+
+    // Memory and handle counts, from the watchdog thread
+    void sampleProcess();
+
+    void reportGc(LONGLONG gen0, LONGLONG gen1, LONGLONG gen2);
+
+    // Claims a slot for the id on first use, false once all slots are taken
+    bool setCounter(LONG id, LONGLONG value);
+    bool addCounter(LONG id, LONGLONG delta);
+
+    // Lock free, never blocks on the launcher or other writers. Returns
+    // false if the ring was full.
+    bool push(DWORD id, LONGLONG value, const void* payload, size_t length);
+
+private:
+    Telemetry();
+    ~Telemetry();
+
+    // No copy or move
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+    Telemetry(Telemetry&&) = delete;
+    Telemetry& operator=(Telemetry&&) = delete;
+
+    TelemetryCounter* findCounter(LONG id);
+
+    HANDLE m_mapping;
+    TelemetryBlock* m_block;
+};
+
+// Launcher side: maps the blocks of any number of clients. Opening is the
+// only syscall, after that the counters are read straight from the mapping.
+class TelemetryReader {
+public:
+    static TelemetryReader& getInstance() {
+        static TelemetryReader instance;
+        return instance;
+    }
+
+    // nullptr until the client has filled its block in, retry later
+    const TelemetryBlock* open(DWORD processId);
+    void close(DWORD processId);
+
+    // Consumer side of the ring, one caller per block at a time. A writer
+    // that dies between claiming a slot and publishing it stalls the ring
+    // there, which only happens when the client is going down anyway.
+    static bool pop(const TelemetryBlock* block, TelemetryEvent* event);
+
+private:
+    struct MappedClient {
+        HANDLE hMapping;
+        TelemetryBlock* block;
+    };
+
+    TelemetryReader();
+    ~TelemetryReader();
+
+    // No copy or move
+    TelemetryReader(const TelemetryReader&) = delete;
+    TelemetryReader& operator=(const TelemetryReader&) = delete;
+    TelemetryReader(TelemetryReader&&) = delete;
+    TelemetryReader& operator=(TelemetryReader&&) = delete;
+
+    std::map<DWORD, MappedClient> m_clients;
+    std::mutex m_mutex;
+};
+
+// Exports for managed code
+extern "C" __declspec(dllexport) bool TelemetrySetCounter(int id, long long value);
+extern "C" __declspec(dllexport) bool TelemetryAddCounter(int id, long long delta);
+extern "C" __declspec(dllexport) void TelemetryReportGc(long long gen0, long long gen1, long long gen2);
+extern "C" __declspec(dllexport) bool TelemetryPush(unsigned int id, long long value, const char* payload, int length);
+
+// Launcher exports
+extern "C" __declspec(dllexport) const TelemetryBlock* OpenClientTelemetry(DWORD processId);
+extern "C" __declspec(dllexport) void CloseClientTelemetry(DWORD processId);
+extern "C" __declspec(dllexport) bool PopClientTelemetryEvent(const TelemetryBlock* block, TelemetryEvent* event);
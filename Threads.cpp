@@ -0,0 +1,20 @@
+// Threads.cpp
+#include "pch.h"
+#include "Threads.h"
+
+HANDLE Threads::suspend(DWORD threadId, DWORD access) {
+    HANDLE hThread = OpenThread(access | THREAD_SUSPEND_RESUME, FALSE, threadId);
+    if (!hThread) {
+        return nullptr;
+    }
+    if (SuspendThread(hThread) == (DWORD)-1) {
+        CloseHandle(hThread);
+        return nullptr;
+    }
+    return hThread;
+}
+
+void Threads::resume(HANDLE hThread) {
+    ResumeThread(hThread);
+    CloseHandle(hThread);
+}
@@ -0,0 +1,41 @@
+// Threads.h
+#pragma once
+
+#include <Windows.h>
+#include <TlHelp32.h>
+
+// The other threads of this process, for everything that has to stop the
+// world: the sampling profiler, the crash handler and the hook engine.
+class Threads {
+public:
+    // Calls visit(threadId) for every thread of this process but the caller,
+    // until it returns false. Returns false if the thread list couldn't be taken.
+    template <typename Visitor>
+    static bool forEachOther(Visitor visit) {
+        HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+        if (snapshot == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        DWORD processId = GetCurrentProcessId();
+        DWORD currentThreadId = GetCurrentThreadId();
+        THREADENTRY32 entry;
+        entry.dwSize = sizeof(entry);
+        if (Thread32First(snapshot, &entry)) {
+            do {
+                if (entry.th32OwnerProcessID == processId && entry.th32ThreadID != currentThreadId && !visit(entry.th32ThreadID)) {
+                    break;
+                }
+            } while (entry.dwSize = sizeof(entry), Thread32Next(snapshot, &entry));
+        }
+        CloseHandle(snapshot);
+        return true;
+    }
+
+    // Opens the thread with `access` plus THREAD_SUSPEND_RESUME and suspends
+    // it, nullptr if either failed. Undo with resume.
+    static HANDLE suspend(DWORD threadId, DWORD access);
+
+    // Resumes and closes a handle from suspend
+    static void resume(HANDLE hThread);
+};
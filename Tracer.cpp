@@ -0,0 +1,305 @@
+// Tracer.cpp
+#include "pch.h"
+#include "Tracer.h"
+#include <intrin.h>
+#include <algorithm>
+#include <stdio.h>
+
+// Events at the old end of a wrapped buffer that may be getting overwritten while we copy
+#define TRACE_WRAP_MARGIN 256
+
+// Shortest span calibrate measures over, shorter ones give a noisy TSC rate
+#define TRACE_CALIBRATE_MIN_MS 20
+
+// Per thread, set on first use. The buffer outlives the thread so its events
+// still get dumped, until a new thread needs it and takes it over.
+static thread_local void* t_threadBuffer = nullptr;
+static thread_local bool t_untraced = false;
+
+namespace {
+    struct MergedEvent {
+        TraceEvent event;
+        DWORD threadId;
+    };
+
+    void appendEscaped(std::string& out, const char* text) {
+        for (; *text; text++) {
+            unsigned char c = (unsigned char)*text;
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += (char)c;
+            }
+            else if (c < 0x20) {
+                char escaped[8];
+                sprintf_s(escaped, "\\u%04x", c);
+                out += escaped;
+            }
+            else {
+                out += (char)c;
+            }
+        }
+    }
+}
+
+Tracer::Tracer()
+    : m_enabled(false)
+    , m_untracedThreads(0)
+    , m_startTsc(0)
+    , m_startCounter(0)
+    , m_counterFrequency(1)
+{
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    m_startTsc = __rdtsc();
+    m_startCounter = counter.QuadPart;
+    m_counterFrequency = frequency.QuadPart;
+}
+
+Tracer::~Tracer() {
+    for (auto& buffer : m_buffers) {
+        if (buffer->ownerThread) {
+            CloseHandle(buffer->ownerThread);
+        }
+    }
+}
+
+void Tracer::registerName(DWORD id, const char* name) {
+    if (!name) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_names[id] = name;
+}
+
+Tracer::ThreadBuffer* Tracer::findAbandonedBuffer() {
+    for (auto& buffer : m_buffers) {
+        if (buffer->ownerThread && WaitForSingleObject(buffer->ownerThread, 0) == WAIT_OBJECT_0) {
+            CloseHandle(buffer->ownerThread);
+            buffer->ownerThread = nullptr;
+            return buffer.get();
+        }
+    }
+    return nullptr;
+}
+
+Tracer::ThreadBuffer* Tracer::registerThread() {
+    // Without a handle we could never tell the thread has exited, so its buffer could never be reused
+    HANDLE ownerThread = OpenThread(SYNCHRONIZE, FALSE, GetCurrentThreadId());
+    if (!ownerThread) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_untracedThreads++;
+        t_untraced = true;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ThreadBuffer* buffer = nullptr;
+    if (m_buffers.size() < TRACE_MAX_THREADS) {
+        buffer = new (std::nothrow) ThreadBuffer;
+        if (buffer) {
+            m_buffers.emplace_back(buffer);
+        }
+    }
+    if (!buffer) {
+        // Churning thread pools would use up every slot, recycle the buffers of threads that are gone
+        buffer = findAbandonedBuffer();
+    }
+    if (!buffer) {
+        CloseHandle(ownerThread);
+        m_untracedThreads++;
+        t_untraced = true;
+        return nullptr;
+    }
+
+    // The old owner's events go with it. Dumps read the buffer under the same lock.
+    buffer->threadId = GetCurrentThreadId();
+    buffer->ownerThread = ownerThread;
+    buffer->count.store(0, std::memory_order_relaxed);
+    buffer->resetCount.store(0, std::memory_order_relaxed);
+
+    t_threadBuffer = buffer;
+    return buffer;
+}
+
+void Tracer::record(DWORD id, DWORD type, LONGLONG value) {
+    if (!m_enabled) {
+        return;
+    }
+
+    ThreadBuffer* buffer = (ThreadBuffer*)t_threadBuffer;
+    if (!buffer) {
+        if (t_untraced) {
+            return;
+        }
+        buffer = registerThread();
+        if (!buffer) {
+            return;
+        }
+    }
+
+    // Only this thread writes the count, the store just publishes the event to dump
+    ULONG64 count = buffer->count.load(std::memory_order_relaxed);
+    TraceEvent& event = buffer->events[count & (TRACE_BUFFER_CAPACITY - 1)];
+    event.tsc = __rdtsc();
+    event.value = value;
+    event.id = id;
+    event.type = type;
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+void Tracer::reset() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& buffer : m_buffers) {
+        buffer->resetCount.store(buffer->count.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+double Tracer::calibrate() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    LONGLONG elapsed = counter.QuadPart - m_startCounter;
+    if (elapsed * 1000 < m_counterFrequency * TRACE_CALIBRATE_MIN_MS) {
+        Sleep(TRACE_CALIBRATE_MIN_MS);
+        QueryPerformanceCounter(&counter);
+        elapsed = counter.QuadPart - m_startCounter;
+    }
+    ULONG64 tsc = __rdtsc();
+
+    double microseconds = (double)elapsed * 1000000.0 / (double)m_counterFrequency;
+    return microseconds > 0 ? (double)(tsc - m_startTsc) / microseconds : 1.0;
+}
+
+bool Tracer::dump(const std::wstring& path) {
+    double ticksPerMicrosecond = calibrate();
+
+    std::vector<MergedEvent> events;
+    std::unordered_map<DWORD, std::string> names;
+    DWORD untracedThreads = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        names = m_names;
+        untracedThreads = m_untracedThreads;
+
+        for (auto& buffer : m_buffers) {
+            ULONG64 count = buffer->count.load(std::memory_order_acquire);
+            ULONG64 first = buffer->resetCount.load(std::memory_order_relaxed);
+
+            // Wrapped: the writer keeps going while we copy, so skip the slots it's about to reuse
+            if (count - first > TRACE_BUFFER_CAPACITY - TRACE_WRAP_MARGIN) {
+                first = count - (TRACE_BUFFER_CAPACITY - TRACE_WRAP_MARGIN);
+            }
+
+            for (ULONG64 i = first; i < count; i++) {
+                MergedEvent merged;
+                merged.event = buffer->events[i & (TRACE_BUFFER_CAPACITY - 1)];
+                merged.threadId = buffer->threadId;
+                events.push_back(merged);
+            }
+        }
+    }
+
+    std::stable_sort(events.begin(), events.end(),
+        [](const MergedEvent& a, const MergedEvent& b) { return a.event.tsc < b.event.tsc; });
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    DWORD processId = GetCurrentProcessId();
+    std::string json;
+    json.reserve(events.size() * 96 + 64);
+    json += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    char line[128];
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& event = events[i].event;
+        double timestamp = event.tsc >= m_startTsc ? (double)(event.tsc - m_startTsc) / ticksPerMicrosecond : 0.0;
+
+        json += i ? ",\n{\"name\":\"" : "{\"name\":\"";
+        auto name = names.find(event.id);
+        if (name != names.end()) {
+            appendEscaped(json, name->second.c_str());
+        }
+        else {
+            json += std::to_string(event.id);
+        }
+
+        const char* phase = event.type == TRACE_EVENT_BEGIN ? "B" : event.type == TRACE_EVENT_END ? "E" : "C";
+        sprintf_s(line, "\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu", phase, timestamp, processId, events[i].threadId);
+        json += line;
+        if (event.type == TRACE_EVENT_COUNTER) {
+            sprintf_s(line, ",\"args\":{\"value\":%lld}", event.value);
+            json += line;
+        }
+        json += "}";
+    }
+    json += "\n],\"otherData\":{\"untracedThreads\":";
+    json += std::to_string(untracedThreads);
+    json += "}}\n";
+
+    DWORD bytesWritten = 0;
+    BOOL written = WriteFile(file, json.data(), (DWORD)json.size(), &bytesWritten, nullptr);
+    CloseHandle(file);
+    return written && bytesWritten == json.size();
+}
+
+void Tracer::dumpAtExit() {
+    std::wstring path;
+    path.swap(m_exitDumpPath);
+    if (path.empty()) {
+        return;
+    }
+
+    bool recorded = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& buffer : m_buffers) {
+            if (buffer->count.load(std::memory_order_acquire) != buffer->resetCount.load(std::memory_order_relaxed)) {
+                recorded = true;
+                break;
+            }
+        }
+    }
+    if (!recorded) {
+        return;
+    }
+
+    size_t separator = path.find_last_of(L"\\/");
+    if (separator != std::wstring::npos) {
+        CreateDirectoryW(path.substr(0, separator).c_str(), nullptr);
+    }
+    dump(path);
+}
+
+// Exports for managed code
+extern "C" __declspec(dllexport) void TraceBegin(unsigned int id) {
+    Tracer::getInstance().begin(id);
+}
+
+extern "C" __declspec(dllexport) void TraceEnd(unsigned int id) {
+    Tracer::getInstance().end(id);
+}
+
+extern "C" __declspec(dllexport) void TraceCounter(unsigned int id, long long value) {
+    Tracer::getInstance().counter(id, value);
+}
+
+extern "C" __declspec(dllexport) void TraceRegisterName(unsigned int id, const char* name) {
+    Tracer::getInstance().registerName(id, name);
+}
+
+extern "C" __declspec(dllexport) void TraceSetEnabled(bool enabled) {
+    Tracer::getInstance().setEnabled(enabled);
+}
+
+extern "C" __declspec(dllexport) void TraceReset() {
+    Tracer::getInstance().reset();
+}
+
+extern "C" __declspec(dllexport) bool TraceDump(const wchar_t* path) {
+    if (!path) return false;
+    return Tracer::getInstance().dump(path);
+}
@@ -0,0 +1,119 @@
+// Tracer.h
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+
+// Event types, also the Chrome trace phase they turn into
+#define TRACE_EVENT_BEGIN   0
+#define TRACE_EVENT_END     1
+#define TRACE_EVENT_COUNTER 2
+
+// Events kept per thread, must be a power of two. Older events are overwritten.
+#define TRACE_BUFFER_CAPACITY 16384
+
+// Buffers allocated at most. Past that a new thread takes over the buffer of
+// one that has exited, and goes untraced only if every owner is still alive.
+#define TRACE_MAX_THREADS 256
+
+struct TraceEvent {
+    ULONG64 tsc;
+    LONGLONG value;     // counters only
+    DWORD id;
+    DWORD type;
+};
+
+// Span and counter tracing for per-frame code, dumped as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev).
+//
+// Every thread that traces gets its own buffer on first use, so recording
+// is an rdtsc and a store into memory nobody else writes: no locks, no
+// atomics beyond publishing the count. Buffers are only merged, sorted and
+// converted to microseconds when a dump is asked for.
+class Tracer {
+public:
+    static Tracer& getInstance() {
+        static Tracer instance;
+        return instance;
+    }
+
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+    bool isEnabled() const { return m_enabled; }
+
+    // Display name for an id, ids without one are dumped as numbers
+    void registerName(DWORD id, const char* name);
+
+    void begin(DWORD id) { record(id, TRACE_EVENT_BEGIN, 0); }
+    void end(DWORD id) { record(id, TRACE_EVENT_END, 0); }
+    void counter(DWORD id, LONGLONG value) { record(id, TRACE_EVENT_COUNTER, value); }
+
+    // Drops everything recorded so far
+    void reset();
+
+    // Writes all buffers merged into one Chrome trace JSON file
+    bool dump(const std::wstring& path);
+
+    // Where CrashHandler::shutdown dumps to if anything was recorded. Only
+    // from that explicit shutdown: by the time static destructors run this
+    // object is gone.
+    void setExitDumpPath(const std::wstring& path) { m_exitDumpPath = path; }
+
+    // Once, later calls do nothing
+    void dumpAtExit();
+
+private:
+    struct ThreadBuffer {
+        DWORD threadId;
+        HANDLE ownerThread;             // signaled once the owner has exited
+        std::atomic<ULONG64> count;     // events ever written, the ring index is count % capacity
+        std::atomic<ULONG64> resetCount;    // count at the last reset, older events aren't dumped
+        TraceEvent events[TRACE_BUFFER_CAPACITY];
+    };
+
+    Tracer();
+    ~Tracer();
+
+    // No copy or move
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    Tracer(Tracer&&) = delete;
+    Tracer& operator=(Tracer&&) = delete;
+
+    void record(DWORD id, DWORD type, LONGLONG value);
+    ThreadBuffer* registerThread();
+
+    // A buffer whose owner has exited, nullptr if there is none. Holds m_mutex.
+    ThreadBuffer* findAbandonedBuffer();
+
+    // TSC ticks per microsecond, measured against QPC since construction
+    double calibrate();
+
+    volatile bool m_enabled;
+
+    std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+    std::unordered_map<DWORD, std::string> m_names;
+    std::mutex m_mutex;
+
+    // Threads that wanted to trace but got no buffer, reported in the dump
+    DWORD m_untracedThreads;
+
+    ULONG64 m_startTsc;
+    LONGLONG m_startCounter;
+    LONGLONG m_counterFrequency;
+
+    std::wstring m_exitDumpPath;
+};
+
+// Exports for managed code
+extern "C" __declspec(dllexport) void TraceBegin(unsigned int id);
+extern "C" __declspec(dllexport) void TraceEnd(unsigned int id);
+extern "C" __declspec(dllexport) void TraceCounter(unsigned int id, long long value);
+extern "C" __declspec(dllexport) void TraceRegisterName(unsigned int id, const char* name);
+extern "C" __declspec(dllexport) void TraceSetEnabled(bool enabled);
+extern "C" __declspec(dllexport) void TraceReset();
+extern "C" __declspec(dllexport) bool TraceDump(const wchar_t* path);
@@ -0,0 +1,249 @@
+// Utf.cpp
+#include "pch.h"
+#include "Utf.h"
+#include <string.h>
+#include <emmintrin.h>
+
+size_t Utf::asciiPrefix(const wchar_t* source, size_t length) {
+    size_t i = 0;
+    const __m128i nonAscii = _mm_set1_epi16((short)0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= length; i += 8) {
+        __m128i units = _mm_loadu_si128((const __m128i*)(source + i));
+        __m128i high = _mm_cmpeq_epi16(_mm_and_si128(units, nonAscii), zero);
+        if (_mm_movemask_epi8(high) != 0xFFFF) {
+            break;
+        }
+    }
+    while (i < length && source[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+size_t Utf::asciiPrefix(const char* source, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(source + i));
+        if (_mm_movemask_epi8(bytes) != 0) {
+            break;
+        }
+    }
+    while (i < length && (unsigned char)source[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+size_t Utf::decodeUtf16(const wchar_t* source, size_t length, unsigned int* codePoint) {
+    unsigned int unit = (unsigned short)source[0];
+    if (unit < 0xD800 || unit > 0xDFFF) {
+        *codePoint = unit;
+        return 1;
+    }
+    if (unit <= 0xDBFF && length >= 2) {
+        unsigned int low = (unsigned short)source[1];
+        if (low >= 0xDC00 && low <= 0xDFFF) {
+            *codePoint = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+            return 2;
+        }
+    }
+    *codePoint = UTF_REPLACEMENT_CHARACTER;
+    return 1;
+}
+
+size_t Utf::decodeUtf8(const unsigned char* source, size_t length, unsigned int* codePoint) {
+    unsigned int lead = source[0];
+    size_t count;
+    unsigned int value;
+    unsigned int minimum;
+    if (lead < 0x80) {
+        *codePoint = lead;
+        return 1;
+    }
+    else if (lead >= 0xC2 && lead <= 0xDF) {
+        count = 2; value = lead & 0x1F; minimum = 0x80;
+    }
+    else if (lead >= 0xE0 && lead <= 0xEF) {
+        count = 3; value = lead & 0x0F; minimum = 0x800;
+    }
+    else if (lead >= 0xF0 && lead <= 0xF4) {
+        count = 4; value = lead & 0x07; minimum = 0x10000;
+    }
+    else {
+        *codePoint = UTF_REPLACEMENT_CHARACTER;
+        return 1;
+    }
+
+    // A bad continuation byte ends the sequence there, and starts the next one
+    size_t i = 1;
+    for (; i < count; i++) {
+        if (i >= length || (source[i] & 0xC0) != 0x80) {
+            *codePoint = UTF_REPLACEMENT_CHARACTER;
+            return i;
+        }
+        value = (value << 6) | (source[i] & 0x3F);
+    }
+
+    // Overlong forms, surrogates and anything past U+10FFFF
+    if (value < minimum || (value >= 0xD800 && value <= 0xDFFF) || value > 0x10FFFF) {
+        value = UTF_REPLACEMENT_CHARACTER;
+    }
+    *codePoint = value;
+    return count;
+}
+
+size_t Utf::encodedUtf8Length(unsigned int codePoint) {
+    return codePoint < 0x80 ? 1 : codePoint < 0x800 ? 2 : codePoint < 0x10000 ? 3 : 4;
+}
+
+size_t Utf::utf8Length(const wchar_t* source, size_t length) {
+    size_t total = 0;
+    size_t i = 0;
+    while (i < length) {
+        size_t ascii = asciiPrefix(source + i, length - i);
+        total += ascii;
+        i += ascii;
+        if (i >= length) {
+            break;
+        }
+
+        unsigned int codePoint;
+        i += decodeUtf16(source + i, length - i, &codePoint);
+        total += encodedUtf8Length(codePoint);
+    }
+    return total;
+}
+
+size_t Utf::utf16Length(const char* source, size_t length) {
+    size_t total = 0;
+    size_t i = 0;
+    while (i < length) {
+        size_t ascii = asciiPrefix(source + i, length - i);
+        total += ascii;
+        i += ascii;
+        if (i >= length) {
+            break;
+        }
+
+        unsigned int codePoint;
+        i += decodeUtf8((const unsigned char*)source + i, length - i, &codePoint);
+        total += codePoint >= 0x10000 ? 2 : 1;
+    }
+    return total;
+}
+
+int Utf::toUtf8(const wchar_t* source, size_t length, char* destination, size_t capacity) {
+    if (capacity == 0) {
+        return -1;
+    }
+
+    // Leave room for the terminator throughout
+    size_t limit = capacity - 1;
+    size_t used = 0;
+    size_t i = 0;
+    const __m128i nonAscii = _mm_set1_epi16((short)0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+
+    while (i < length) {
+        // Eight ASCII units narrow to eight bytes with a single pack
+        while (i + 8 <= length && used + 8 <= limit) {
+            __m128i units = _mm_loadu_si128((const __m128i*)(source + i));
+            __m128i high = _mm_cmpeq_epi16(_mm_and_si128(units, nonAscii), zero);
+            if (_mm_movemask_epi8(high) != 0xFFFF) {
+                break;
+            }
+            _mm_storel_epi64((__m128i*)(destination + used), _mm_packus_epi16(units, units));
+            i += 8;
+            used += 8;
+        }
+        if (i >= length) {
+            break;
+        }
+
+        unsigned int codePoint;
+        size_t consumed = decodeUtf16(source + i, length - i, &codePoint);
+        size_t encoded = encodedUtf8Length(codePoint);
+        if (used + encoded > limit) {
+            destination[used] = '\0';
+            return -1;
+        }
+
+        unsigned char* out = (unsigned char*)destination + used;
+        switch (encoded) {
+        case 1:
+            out[0] = (unsigned char)codePoint;
+            break;
+        case 2:
+            out[0] = (unsigned char)(0xC0 | (codePoint >> 6));
+            out[1] = (unsigned char)(0x80 | (codePoint & 0x3F));
+            break;
+        case 3:
+            out[0] = (unsigned char)(0xE0 | (codePoint >> 12));
+            out[1] = (unsigned char)(0x80 | ((codePoint >> 6) & 0x3F));
+            out[2] = (unsigned char)(0x80 | (codePoint & 0x3F));
+            break;
+        default:
+            out[0] = (unsigned char)(0xF0 | (codePoint >> 18));
+            out[1] = (unsigned char)(0x80 | ((codePoint >> 12) & 0x3F));
+            out[2] = (unsigned char)(0x80 | ((codePoint >> 6) & 0x3F));
+            out[3] = (unsigned char)(0x80 | (codePoint & 0x3F));
+            break;
+        }
+        used += encoded;
+        i += consumed;
+    }
+
+    destination[used] = '\0';
+    return (int)used;
+}
+
+int Utf::toUtf16(const char* source, size_t length, wchar_t* destination, size_t capacity) {
+    if (capacity == 0) {
+        return -1;
+    }
+
+    size_t limit = capacity - 1;
+    size_t used = 0;
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+
+    while (i < length) {
+        // Sixteen ASCII bytes widen to sixteen units with two unpacks
+        while (i + 16 <= length && used + 16 <= limit) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(source + i));
+            if (_mm_movemask_epi8(bytes) != 0) {
+                break;
+            }
+            _mm_storeu_si128((__m128i*)(destination + used), _mm_unpacklo_epi8(bytes, zero));
+            _mm_storeu_si128((__m128i*)(destination + used + 8), _mm_unpackhi_epi8(bytes, zero));
+            i += 16;
+            used += 16;
+        }
+        if (i >= length) {
+            break;
+        }
+
+        unsigned int codePoint;
+        size_t consumed = decodeUtf8((const unsigned char*)source + i, length - i, &codePoint);
+        size_t units = codePoint >= 0x10000 ? 2 : 1;
+        if (used + units > limit) {
+            destination[used] = L'\0';
+            return -1;
+        }
+
+        if (units == 2) {
+            codePoint -= 0x10000;
+            destination[used] = (wchar_t)(0xD800 + (codePoint >> 10));
+            destination[used + 1] = (wchar_t)(0xDC00 + (codePoint & 0x3FF));
+        }
+        else {
+            destination[used] = (wchar_t)codePoint;
+        }
+        used += units;
+        i += consumed;
+    }
+
+    destination[used] = L'\0';
+    return (int)used;
+}
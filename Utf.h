@@ -0,0 +1,53 @@
+// Utf.h
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+#include <wchar.h>
+
+// Written in place of unpaired surrogates and malformed UTF-8
+#define UTF_REPLACEMENT_CHARACTER 0xFFFD
+
+// UTF-16 <-> UTF-8 transcoding into caller provided buffers. Nothing here
+// allocates, takes a lock or depends on the C locale, so it is safe in
+// exception handlers. Runs of ASCII, which is nearly everything we convert
+// (paths, export names, reports), go through SSE2 eight or sixteen units at
+// a time. Everything else falls back to a scalar loop.
+//
+// Conversions always NUL terminate when capacity is non-zero. If the output
+// doesn't fit, as much as fits is written without splitting a character,
+// and -1 is returned.
+class Utf {
+public:
+    // Bytes the UTF-8 form of `length` UTF-16 units takes, no terminator
+    static size_t utf8Length(const wchar_t* source, size_t length);
+
+    // UTF-16 units the UTF-16 form of `length` UTF-8 bytes takes, no terminator
+    static size_t utf16Length(const char* source, size_t length);
+
+    // Returns the bytes written without the terminator, or -1 if truncated
+    static int toUtf8(const wchar_t* source, size_t length, char* destination, size_t capacity);
+
+    // Returns the units written without the terminator, or -1 if truncated
+    static int toUtf16(const char* source, size_t length, wchar_t* destination, size_t capacity);
+
+    template <size_t N>
+    static int toUtf8(const wchar_t* source, char (&destination)[N]) {
+        return toUtf8(source, source ? wcslen(source) : 0, destination, N);
+    }
+
+    template <size_t N>
+    static int toUtf16(const char* source, wchar_t (&destination)[N]) {
+        return toUtf16(source, source ? strlen(source) : 0, destination, N);
+    }
+
+private:
+    // Length of the leading ASCII run, at most `length`
+    static size_t asciiPrefix(const wchar_t* source, size_t length);
+    static size_t asciiPrefix(const char* source, size_t length);
+
+    // Decodes one code point, returns the units or bytes consumed
+    static size_t decodeUtf16(const wchar_t* source, size_t length, unsigned int* codePoint);
+    static size_t decodeUtf8(const unsigned char* source, size_t length, unsigned int* codePoint);
+    static size_t encodedUtf8Length(unsigned int codePoint);
+};
@@ -6,24 +6,43 @@
 #include "Shlobj_core.h"
 #include "CoreCLR.hpp"
 
-#include <locale>
-#include <codecvt>
 #include <string>
+#include <vector>
 #include <shellapi.h>
 #include <sstream>
 #include "EntryPointParameter.h"
 #include "CrashHandler.h"
+#include "CrashMonitor.h"
+#include "Logger.h"
+#include "Utf.h"
+#include "PluginManifest.h"
+#include "Injection.h"
+#include "NativeFunctionTable.h"
+
+// NativeAOT build of the bootstrapper. When it sits next to the injector it's
+// called directly and the runtime, hostfxr and the runtimeconfig aren't needed.
+#define AOT_BOOTSTRAPPER_NAME L"Chorizite.NativeClientBootstrapper.Aot.dll"
+#define AOT_BOOTSTRAPPER_ENTRY_POINT "Init"
 
 // Global Variables
 CoreCLR* CLR = nullptr;
 HMODULE thisProcessModule = nullptr;
-EntryPointParameters entryPointParameters;
+InitParameters initParameters;
 string_t launcherPath;
 
+// Entry points prepare_bootstrap resolved, Bootstrap calls them in order.
+// It only ever runs once: a second attempt after a failed Prewarm would add
+// another exception handler and start the runtime on top of a half started one.
+bool bootstrapPrepared = false;
+bool bootstrapSucceeded = false;
+std::vector<component_entry_point_fn> bootstrapEntryPoints;
+
 // Function Prototypes
 string_t get_current_directory(HMODULE hModule);
-DWORD __fastcall InjectPayloadAndExecute(HANDLE hProcess, LPTHREAD_START_ROUTINE lpStartAddress, LPCVOID lpBuffer, SIZE_T dwSize);
-LPSTR ToLPCSTR(LPWSTR wstr);
+bool prepare_native_aot();
+bool prepare_from_manifest(PluginManifest& manifest);
+bool prepare_bootstrap();
+bool prepare_bootstrap_once();
 
 /* Entry point */
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved) {
@@ -48,128 +67,187 @@ string_t get_current_directory(HMODULE mHandle) {
     return root_path.substr(0, root_path.find_last_of(L'\\') + 1);
 }
 
-// Function to inject a payload and execute it remotely
-DWORD __fastcall InjectPayloadAndExecute(HANDLE hProcess, LPTHREAD_START_ROUTINE lpStartAddress, LPCVOID lpBuffer, SIZE_T dwSize) {
-    void* allocatedMemory = nullptr;
-    HANDLE remoteThread;
-    DWORD exitCode = 0;
+extern "C" __declspec(dllexport) void InitNativeCrashHandler() {
+    CrashHandler::getInstance().initialize(launcherPath);
+}
 
-    if (lpBuffer && dwSize) {
-        allocatedMemory = VirtualAllocEx(hProcess, nullptr, dwSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-        if (allocatedMemory) {
-            WriteProcessMemory(hProcess, allocatedMemory, lpBuffer, dwSize, nullptr);
-        }
-        else {
-            MessageBoxA(nullptr, "Failed to Inject Payload.", "Failed", MB_OK);
-            return GetLastError();
-        }
-    }
+// Called by managed code when the client is closing, while every thread and
+// singleton is still alive. Waiting for our threads isn't possible from DllMain.
+extern "C" __declspec(dllexport) void ShutdownNativeCrashHandler() {
+    CrashHandler::getInstance().shutdown();
+}
 
-    remoteThread = CreateRemoteThread(hProcess, nullptr, 0, lpStartAddress, allocatedMemory, 0, nullptr);
-    if (remoteThread) {
-        WaitForSingleObject(remoteThread, INFINITE);
-        GetExitCodeThread(remoteThread, &exitCode);
-    }
-    else {
-        MessageBoxA(nullptr, "Failed to create remote thread.", "Failed", MB_OK);
-        return GetLastError();
+// Resolves the NativeAOT bootstrapper's Init if there is one, false to fall back to CoreCLR
+bool prepare_native_aot() {
+    const string_t aot_path = launcherPath + AOT_BOOTSTRAPPER_NAME;
+    if (GetFileAttributesW(aot_path.c_str()) == INVALID_FILE_ATTRIBUTES) {
+        return false;
     }
 
-    if (allocatedMemory) {
-        VirtualFreeEx(hProcess, allocatedMemory, 0, MEM_RELEASE);
+    HMODULE aot_module = LoadLibraryW(aot_path.c_str());
+    if (!aot_module) {
+        Logger::getInstance().write(LOG_LEVEL_WARNING, GetLastError(), "Failed to load the NativeAOT bootstrapper, using CoreCLR");
+        return false;
     }
 
-    if (remoteThread) {
-        CloseHandle(remoteThread);
+    // Same signature the CoreCLR path gets back for StandaloneLoader.Init
+    component_entry_point_fn initialize = (component_entry_point_fn)GetProcAddress(aot_module, AOT_BOOTSTRAPPER_ENTRY_POINT);
+    if (!initialize) {
+        Logger::getInstance().write(LOG_LEVEL_WARNING, 0, "NativeAOT bootstrapper has no Init export, using CoreCLR");
+        FreeLibrary(aot_module);
+        return false;
     }
 
-    return exitCode;
+    // Stays loaded for the life of the process, like the runtime would
+    Logger::getInstance().write(LOG_LEVEL_INFO, 0, "Bootstrapping through the NativeAOT bootstrapper");
+    bootstrapEntryPoints.push_back(initialize);
+    return true;
 }
 
-// Convert wide string to C-style string
-LPSTR ToLPCSTR(LPWSTR wstr) {
-    std::wstring ws(wstr);
-    std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
-    std::string str = converter.to_bytes(ws);
-    return _strdup(str.c_str());
+// Resolves every manifest entry point in order, false if a required one failed
+bool prepare_from_manifest(PluginManifest& manifest) {
+    for (size_t i = 0; i < manifest.getEntryCount(); i++) {
+        const PluginEntry& entry = manifest.getEntry(i);
+        if (!(entry.flags & PLUGIN_ENTRY_FLAG_ENTRY_POINT)) {
+            continue;
+        }
+
+        component_entry_point_fn initialize = nullptr;
+        if (!CLR->load_assembly_and_get_function_pointer(entry.assemblyPath.c_str(), entry.typeName.c_str(), entry.methodName.c_str(), nullptr, nullptr, (void**)&initialize)) {
+            char name[256];
+            Utf::toUtf8(entry.typeName.c_str(), entry.typeName.length(), name, sizeof(name));
+            if (entry.flags & PLUGIN_ENTRY_FLAG_OPTIONAL) {
+                Logger::getInstance().write(LOG_LEVEL_WARNING, 0, name);
+                continue;
+            }
+
+            Logger::getInstance().write(LOG_LEVEL_ERROR, 0, name);
+            MessageBoxA(nullptr, "Failed to load .NET assembly.", "Failed", MB_OK);
+            return false;
+        }
+
+        bootstrapEntryPoints.push_back(initialize);
+    }
+    return true;
 }
 
-extern "C" __declspec(dllexport) void InitNativeCrashHandler() {
-    CrashHandler::getInstance().initialize(launcherPath);
+// Everything Bootstrap does short of calling Init: crash handler, runtime and
+// entry point lookup. Pooled clients run this ahead of time through Prewarm.
+// Later calls return the first call's outcome.
+bool prepare_bootstrap() {
+    if (bootstrapPrepared) {
+        return bootstrapSucceeded;
+    }
+
+    // Marked before running, a throw counts as a failure too
+    bootstrapPrepared = true;
+    bootstrapSucceeded = prepare_bootstrap_once();
+    return bootstrapSucceeded;
 }
 
-// Exported function to bootstrap the CoreCLR runtime and load the target .NET assembly
-extern "C" __declspec(dllexport) void Bootstrap() {
+bool prepare_bootstrap_once() {
     CrashHandler::getInstance().initialize(launcherPath);
 
+    initParameters.entry_point_parameters.dll_path = new wchar_t[MAX_PATH];
+    GetModuleFileNameW(thisProcessModule, initParameters.entry_point_parameters.dll_path, MAX_PATH);
+    initParameters.native_functions = GetNativeFunctions();
+
+    if (prepare_native_aot()) {
+        return true;
+    }
+
+    // Reading the manifest's assemblies overlaps with starting the runtime
+    PluginManifest& manifest = PluginManifest::getInstance();
+    if (manifest.open(launcherPath + PLUGIN_MANIFEST_FILE_NAME)) {
+        manifest.startPreload();
+    }
+
+    // Workers and mapping go away on every way out, failures and throws included
+    struct ManifestCloser {
+        PluginManifest& manifest;
+        ~ManifestCloser() {
+            manifest.stopPreload();
+            manifest.close();
+        }
+    } manifestCloser = { manifest };
+
     int success = 0;
     CLR = new CoreCLR(&success);
 
     if (!success) {
+        Logger::getInstance().write(LOG_LEVEL_ERROR, 0, "Failed to load hostfxr");
         MessageBoxA(nullptr, "Failed to load the `hostfxr` library. Did you copy nethost.dll?", "Failed", MB_OK);
-        return;
+        return false;
     }
 
-    if (!CLR->load_runtime(launcherPath + L"Chorizite.Launcher.runtimeconfig.json")) {
+    // Per client profiles point the variable at their own overrides
+    string_t overrides_path = launcherPath + RUNTIME_OVERRIDES_FILE;
+    wchar_t overrides_env[MAX_PATH];
+    DWORD overrides_env_length = GetEnvironmentVariableW(RUNTIME_OVERRIDES_ENV, overrides_env, MAX_PATH);
+    if (overrides_env_length > 0 && overrides_env_length < MAX_PATH) {
+        overrides_path = overrides_env;
+    }
+
+    if (!CLR->load_runtime(launcherPath + L"Chorizite.Launcher.runtimeconfig.json", overrides_path)) {
+        Logger::getInstance().write(LOG_LEVEL_ERROR, 0, "Failed to load the .NET runtime");
         MessageBoxA(nullptr, "Failed to load .NET Core Runtime", "Failed", MB_OK);
         throw std::exception("Failed to load .NET Core Runtime");
     }
 
+    if (manifest.isOpen()) {
+        return prepare_from_manifest(manifest);
+    }
+
+    // No manifest, just the bootstrapper
     const string_t assembly_path = launcherPath + L"Chorizite.NativeClientBootstrapper.dll";
     const string_t type_name = L"Chorizite.NativeClientBootstrapper.StandaloneLoader, Chorizite.NativeClientBootstrapper";
     const string_t method_name = L"Init";
     component_entry_point_fn initialize = nullptr;
 
     if (!CLR->load_assembly_and_get_function_pointer(assembly_path.c_str(), type_name.c_str(), method_name.c_str(), nullptr, nullptr, (void**)&initialize)) {
+        Logger::getInstance().write(LOG_LEVEL_ERROR, 0, "Failed to load Chorizite.NativeClientBootstrapper");
         MessageBoxA(nullptr, "Failed to load .NET assembly.", "Failed", MB_OK);
+        return false;
+    }
+
+    bootstrapEntryPoints.push_back(initialize);
+    return true;
+}
+
+// Optional injected entry point, called by the client pool while the client is still suspended
+extern "C" __declspec(dllexport) void Prewarm() {
+    prepare_bootstrap();
+}
+
+// Exported function to bootstrap the CoreCLR runtime and load the target .NET assembly
+extern "C" __declspec(dllexport) void Bootstrap() {
+    if (!prepare_bootstrap()) {
         return;
     }
 
-    entryPointParameters.dll_path = new wchar_t[MAX_PATH];
-    GetModuleFileNameW(thisProcessModule, entryPointParameters.dll_path, MAX_PATH);
-    initialize(&entryPointParameters, sizeof(EntryPointParameters));
+    for (component_entry_point_fn initialize : bootstrapEntryPoints) {
+        initialize(&initParameters, sizeof(InitParameters));
+    }
 }
 
 // Launch the injected payload and execute entry points in the target process
 extern "C" __declspec(dllexport) DWORD LaunchInjected(wchar_t* source, LPCWSTR lpCurrentDirectory, EntryPointParameters* entryPointParameters, int numParams) {
     if (!source || !lpCurrentDirectory) return 0;
 
-    STARTUPINFOW startupInfo = { sizeof(STARTUPINFOW) };
     PROCESS_INFORMATION processInfo = { 0 };
-
-    std::unique_ptr<wchar_t[]> cmdLine(new wchar_t[wcslen(source) + 1]);
-    wcscpy_s(cmdLine.get(), wcslen(source) + 1, source);
-
-    if (!CreateProcessW(nullptr, cmdLine.get(), nullptr, nullptr, FALSE, CREATE_SUSPENDED, nullptr, lpCurrentDirectory, &startupInfo, &processInfo)) {
+    if (!CreateSuspendedClient(source, lpCurrentDirectory, &processInfo)) {
         MessageBoxW(nullptr, L"Failed", L"Failed to create process", MB_OK);
         return 0;
     }
 
-    HMODULE kernelModule = GetModuleHandleW(L"kernel32.dll");
-
-    if (!kernelModule) {
-		MessageBoxW(nullptr, L"Failed", L"Failed to load kernel32.dll", MB_OK);
-		return 0;
-	}
-
-    auto loadLibraryW = reinterpret_cast<HMODULE(__stdcall*)(LPCWSTR)>(GetProcAddress(kernelModule, "LoadLibraryW"));
-
     for (int i = 0; i < numParams; i++) {
-        wchar_t* injectedLibName = entryPointParameters[i].dll_path;
-        InjectPayloadAndExecute(processInfo.hProcess, (LPTHREAD_START_ROUTINE)loadLibraryW, injectedLibName, 2 * wcslen(injectedLibName));
-        HMODULE loadedLibrary = ::LoadLibraryW(injectedLibName);
-
-        char procName[200] = { 0 };
-        sprintf_s(procName, "%S", entryPointParameters[i].entry_point);
-
-        if (!loadedLibrary) {
-			MessageBoxW(nullptr, L"Failed", L"Failed to load library", MB_OK);
-			return 0;
-		}
-
-        LPVOID procAddress = GetProcAddress(loadedLibrary, procName);
-        InjectPayloadAndExecute(processInfo.hProcess, (LPTHREAD_START_ROUTINE)procAddress, nullptr, 0);
-        FreeLibrary(loadedLibrary);
+        InjectedLibrary library;
+        const wchar_t* error = nullptr;
+        if (!InjectLibrary(processInfo.hProcess, entryPointParameters[i], &library, &error)) {
+            MessageBoxW(nullptr, L"Failed", error, MB_OK);
+            return 0;
+        }
+        InjectPayloadAndExecute(processInfo.hProcess, library.entryPoint, nullptr, 0);
     }
 
     ResumeThread(processInfo.hThread);
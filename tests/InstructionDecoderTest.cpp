@@ -0,0 +1,132 @@
+// InstructionDecoderTest.cpp
+//
+// Standalone check of the length decoder against synthetic code buffers. Not
+// part of the DLL project, build and run it on its own from this directory:
+//
+//   g++ -std=c++14 -I.. InstructionDecoderTest.cpp ../InstructionDecoder.cpp -o InstructionDecoderTest
+//   cl /EHsc /I.. InstructionDecoderTest.cpp ..\InstructionDecoder.cpp
+//
+// Exits with the number of failed cases.
+#include "InstructionDecoder.h"
+#include <stdio.h>
+
+#define X86 false
+#define X64 true
+
+struct DecoderCase {
+    const char* name;
+    bool is64Bit;
+    uint8_t code[INSTRUCTION_MAX_LENGTH];
+    size_t available;
+    size_t length;
+    uint8_t flags;
+    uint8_t dispOffset;     // where the disp32 or relative target sits,
+    uint8_t relOffset;      // 0 when the case doesn't check it
+};
+
+static const DecoderCase g_cases[] = {
+    // RIP-relative memory operands
+    { "mov rax, [rip+d32]",         X64, { 0x48, 0x8B, 0x05, 1, 2, 3, 4 }, 7, 7, INSTRUCTION_FLAG_RIP_RELATIVE, 3, 0 },
+    { "lea rcx, [rip+d32]",         X64, { 0x48, 0x8D, 0x0D, 1, 2, 3, 4 }, 7, 7, INSTRUCTION_FLAG_RIP_RELATIVE, 3, 0 },
+    { "mov dword [rip+d32], imm32", X64, { 0xC7, 0x05, 1, 2, 3, 4, 5, 6, 7, 8 }, 10, 10, INSTRUCTION_FLAG_RIP_RELATIVE, 2, 0 },
+    { "cmp byte [rip+d32], imm8",   X64, { 0x80, 0x3D, 1, 2, 3, 4, 5 }, 7, 7, INSTRUCTION_FLAG_RIP_RELATIVE, 2, 0 },
+    { "call [rip+d32]",             X64, { 0xFF, 0x15, 1, 2, 3, 4 }, 6, 6, INSTRUCTION_FLAG_RIP_RELATIVE | INSTRUCTION_FLAG_CALL, 2, 0 },
+    { "jmp [rip+d32]",              X64, { 0xFF, 0x25, 1, 2, 3, 4 }, 6, 6, INSTRUCTION_FLAG_RIP_RELATIVE | INSTRUCTION_FLAG_JUMP, 2, 0 },
+    { "mov eax, [d32] (x86)",       X86, { 0x8B, 0x05, 1, 2, 3, 4 }, 6, 6, 0, 0, 0 },
+    { "mov eax, [d32] via SIB",     X64, { 0x8B, 0x04, 0x25, 1, 2, 3, 4 }, 7, 7, 0, 0, 0 },
+
+    // Relative branches
+    { "jmp rel8",                   X64, { 0xEB, 0x10 }, 2, 2, INSTRUCTION_FLAG_REL8 | INSTRUCTION_FLAG_JUMP, 0, 1 },
+    { "jmp rel32",                  X64, { 0xE9, 1, 2, 3, 4 }, 5, 5, INSTRUCTION_FLAG_REL32 | INSTRUCTION_FLAG_JUMP, 0, 1 },
+    { "call rel32",                 X64, { 0xE8, 1, 2, 3, 4 }, 5, 5, INSTRUCTION_FLAG_REL32 | INSTRUCTION_FLAG_CALL, 0, 1 },
+    { "je rel8",                    X64, { 0x74, 0x05 }, 2, 2, INSTRUCTION_FLAG_REL8 | INSTRUCTION_FLAG_CONDITIONAL, 0, 1 },
+    { "je rel32",                   X64, { 0x0F, 0x84, 1, 2, 3, 4 }, 6, 6, INSTRUCTION_FLAG_REL32 | INSTRUCTION_FLAG_CONDITIONAL, 0, 2 },
+    { "jne rel32 (x86)",            X86, { 0x0F, 0x85, 1, 2, 3, 4 }, 6, 6, INSTRUCTION_FLAG_REL32 | INSTRUCTION_FLAG_CONDITIONAL, 0, 2 },
+    { "jrcxz rel8",                 X64, { 0xE3, 0x05 }, 2, 2, INSTRUCTION_FLAG_REL8 | INSTRUCTION_FLAG_CONDITIONAL, 0, 1 },
+    { "loop rel8",                  X64, { 0xE2, 0xFE }, 2, 2, INSTRUCTION_FLAG_REL8 | INSTRUCTION_FLAG_CONDITIONAL, 0, 1 },
+    { "jmp rel16 (x86)",            X86, { 0x66, 0xE9, 1, 2 }, 4, 0, 0, 0, 0 },
+    { "call ptr16:32 (x86)",        X86, { 0x9A, 1, 2, 3, 4, 5, 6 }, 7, 7, INSTRUCTION_FLAG_CALL, 0, 0 },
+    { "call ptr16:32 (x64)",        X64, { 0x9A, 1, 2, 3, 4, 5, 6 }, 7, 0, 0, 0, 0 },
+
+    // Returns
+    { "ret",                        X64, { 0xC3 }, 1, 1, INSTRUCTION_FLAG_RETURN, 0, 0 },
+    { "ret imm16",                  X64, { 0xC2, 0x08, 0x00 }, 3, 3, INSTRUCTION_FLAG_RETURN, 0, 0 },
+
+    // Immediates and operand size
+    { "mov eax, imm32",             X64, { 0xB8, 1, 2, 3, 4 }, 5, 5, 0, 0, 0 },
+    { "mov ax, imm16",              X64, { 0x66, 0xB8, 1, 2 }, 4, 4, 0, 0, 0 },
+    { "mov rax, imm64",             X64, { 0x48, 0xB8, 1, 2, 3, 4, 5, 6, 7, 8 }, 10, 10, 0, 0, 0 },
+    { "add ax, imm16",              X64, { 0x66, 0x05, 1, 2 }, 4, 4, 0, 0, 0 },
+    { "add ax, imm16 (x86)",        X86, { 0x66, 0x05, 1, 2 }, 4, 4, 0, 0, 0 },
+    { "add ax, imm16 via 81",       X64, { 0x66, 0x81, 0xC0, 1, 2 }, 5, 5, 0, 0, 0 },
+    { "add rax, imm32 (66 + REX.W)", X64, { 0x66, 0x48, 0x05, 1, 2, 3, 4 }, 7, 7, 0, 0, 0 },
+    { "push imm16",                 X64, { 0x66, 0x68, 1, 2 }, 4, 4, 0, 0, 0 },
+    { "mov word [rip+d32], imm16",  X64, { 0x66, 0xC7, 0x05, 1, 2, 3, 4, 5, 6 }, 9, 9, INSTRUCTION_FLAG_RIP_RELATIVE, 3, 0 },
+    { "sub rsp, imm8",              X64, { 0x48, 0x83, 0xEC, 0x28 }, 4, 4, 0, 0, 0 },
+    { "sub rsp, imm32",             X64, { 0x48, 0x81, 0xEC, 0, 1, 0, 0 }, 7, 7, 0, 0, 0 },
+    { "test al, imm8",              X64, { 0xF6, 0xC0, 0x01 }, 3, 3, 0, 0, 0 },
+    { "test eax, imm32 via F7",     X64, { 0xF7, 0xC0, 1, 2, 3, 4 }, 6, 6, 0, 0, 0 },
+    { "test ax, imm16 via F7",      X64, { 0x66, 0xF7, 0xC0, 1, 2 }, 5, 5, 0, 0, 0 },
+    { "not eax",                    X64, { 0xF7, 0xD0 }, 2, 2, 0, 0, 0 },
+    { "enter imm16, imm8",          X64, { 0xC8, 0x10, 0x00, 0x00 }, 4, 4, 0, 0, 0 },
+
+    // moffs, sized by the address size rather than the operand size
+    { "mov eax, [moffs64]",         X64, { 0xA1, 1, 2, 3, 4, 5, 6, 7, 8 }, 9, 9, 0, 0, 0 },
+    { "mov rax, [moffs64]",         X64, { 0x48, 0xA1, 1, 2, 3, 4, 5, 6, 7, 8 }, 10, 10, 0, 0, 0 },
+    { "mov eax, [moffs32] (67)",    X64, { 0x67, 0xA1, 1, 2, 3, 4 }, 6, 6, 0, 0, 0 },
+    { "mov eax, [moffs32] (x86)",   X86, { 0xA1, 1, 2, 3, 4 }, 5, 5, 0, 0, 0 },
+    { "mov ax, [moffs32] (x86)",    X86, { 0x66, 0xA1, 1, 2, 3, 4 }, 6, 6, 0, 0, 0 },
+    { "mov al, [moffs16] (x86)",    X86, { 0x67, 0xA0, 1, 2 }, 4, 4, 0, 0, 0 },
+
+    // VEX
+    { "vzeroupper",                 X64, { 0xC5, 0xF8, 0x77 }, 3, 3, 0, 0, 0 },
+    { "vzeroupper (x86)",           X86, { 0xC5, 0xF8, 0x77 }, 3, 3, 0, 0, 0 },
+    { "vmovdqa ymm0, [rip+d32]",    X64, { 0xC5, 0xFD, 0x6F, 0x05, 1, 2, 3, 4 }, 8, 8, INSTRUCTION_FLAG_RIP_RELATIVE, 4, 0 },
+    { "vbroadcastss ymm0, [rip+d32]", X64, { 0xC4, 0xE2, 0x7D, 0x18, 0x05, 1, 2, 3, 4 }, 9, 9, INSTRUCTION_FLAG_RIP_RELATIVE, 5, 0 },
+    { "vinsertf128 ymm0, ymm0, xmm1, 1", X64, { 0xC4, 0xE3, 0x7D, 0x18, 0xC1, 0x01 }, 6, 6, 0, 0, 0 },
+    { "lds eax, [ecx] (x86)",       X86, { 0xC5, 0x01 }, 2, 2, 0, 0, 0 },
+    { "EVEX",                       X64, { 0x62, 0xF1, 0x7C, 0x48, 0x10, 0xC1 }, 6, 0, 0, 0, 0 },
+
+    // Other maps and addressing forms
+    { "nop dword [rax+rax+0]",      X64, { 0x0F, 0x1F, 0x44, 0x00, 0x00 }, 5, 5, 0, 0, 0 },
+    { "nop dword [rax+d32]",        X64, { 0x0F, 0x1F, 0x80, 1, 2, 3, 4 }, 7, 7, 0, 0, 0 },
+    { "pshufb xmm0, xmm1",          X64, { 0x66, 0x0F, 0x38, 0x00, 0xC1 }, 5, 5, 0, 0, 0 },
+    { "palignr xmm0, xmm1, 8",      X64, { 0x66, 0x0F, 0x3A, 0x0F, 0xC1, 0x08 }, 6, 6, 0, 0, 0 },
+    { "bt eax, 5",                  X64, { 0x0F, 0xBA, 0xE0, 0x05 }, 4, 4, 0, 0, 0 },
+    { "syscall",                    X64, { 0x0F, 0x05 }, 2, 2, 0, 0, 0 },
+    { "rep movsq",                  X64, { 0xF3, 0x48, 0xA5 }, 3, 3, 0, 0, 0 },
+    { "lock cmpxchg [rcx], edx",    X64, { 0xF0, 0x0F, 0xB1, 0x11 }, 4, 4, 0, 0, 0 },
+    { "mov eax, [bx+si+d16] (x86)", X86, { 0x67, 0x8B, 0x80, 1, 2 }, 5, 5, 0, 0, 0 },
+    { "inc eax (x86)",              X86, { 0x40 }, 1, 1, 0, 0, 0 },
+    { "push rax",                   X64, { 0x50 }, 1, 1, 0, 0, 0 },
+    { "int3",                       X64, { 0xCC }, 1, 1, 0, 0, 0 },
+
+    // Running past the buffer
+    { "jmp rel32, truncated",       X64, { 0xE9, 1, 2 }, 3, 0, 0, 0, 0 },
+    { "REX with nothing after",     X64, { 0x48 }, 1, 0, 0, 0, 0 },
+    { "prefixes only",              X64, { 0x66, 0x66 }, 2, 0, 0, 0, 0 },
+};
+
+int main() {
+    int failed = 0;
+    for (const DecoderCase& test : g_cases) {
+        DecodedInstruction instruction;
+        size_t length = InstructionDecoder::decode(test.code, test.available, test.is64Bit, &instruction);
+
+        bool passed = length == test.length;
+        if (passed && length) {
+            passed = instruction.length == length && instruction.flags == test.flags
+                && (!test.dispOffset || instruction.dispOffset == test.dispOffset)
+                && (!test.relOffset || instruction.relOffset == test.relOffset);
+        }
+        if (!passed) {
+            printf("FAIL %s: length %zu flags 0x%02x disp %u rel %u, expected length %zu flags 0x%02x disp %u rel %u\n",
+                test.name, length, instruction.flags, instruction.dispOffset, instruction.relOffset,
+                test.length, test.flags, test.dispOffset, test.relOffset);
+            failed++;
+        }
+    }
+
+    printf("%d of %d cases passed\n", (int)(sizeof(g_cases) / sizeof(g_cases[0])) - failed, (int)(sizeof(g_cases) / sizeof(g_cases[0])));
+    return failed;
+}